@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file backend.h
+ * Interface between mcds and its runtime loaded credential backends.
+ *
+ * A backend is a shared object in the package library directory that
+ * exports a struct backend named by MCDS_BACKEND_SYMBOL. Backends are
+ * only handed plain strings, they must not use the options structure.
+ *
+ * \ingroup secret
+ * \{
+ **/
+
+#ifndef MCDS_BACKEND_H
+#define MCDS_BACKEND_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define MCDS_BACKEND_VERSION  1
+#define MCDS_BACKEND_SYMBOL   "mcds_backend"
+
+/** A credential backend, unsupported operations are NULL **/
+struct backend {
+	int version;
+	const char *name;
+	/* Decrypt a password file */
+	int (*decrypt)(const char *file, char **password);
+	/* Lookup, store and clear the password for a URL and user */
+	int (*lookup)(const char *url, const char *user, char **password);
+	int (*store)(const char *url, const char *user, const char *password);
+	int (*clear)(const char *url, const char *user);
+};
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_BACKEND_H */
+/**
+ * \}
+ **/
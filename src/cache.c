@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file cache.c
+ * Routines to name the files mcds keeps between runs, all held in
+ * $XDG_CACHE_HOME/mcds or ~/.cache/mcds.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "mem.h"
+#include "cache.h"
+
+/**
+ * Name a file in the cache directory.
+ *
+ * \parm[in] name The file, or NULL for the directory itself.
+ *
+ * \return The path, to be freed, NULL if it can not be named.
+ **/
+char *
+cache_path(const char *name)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *sub = "/mcds";
+	char *path = NULL;
+	size_t len = 0;
+
+	if (base == NULL || base[0] != '/') {
+		if ((base = getenv("HOME")) == NULL) {
+			return(NULL);
+		}
+		sub = "/.cache/mcds";
+	}
+	if (name == NULL) {
+		name = "";
+	}
+
+	len = strlen(base) + strlen(sub) + strlen(name) + 2;
+	path = xmalloc(len);
+	snprintf(path, len, "%s%s%s%s", base, sub, name[0] ? "/" : "", name);
+
+	return(path);
+}
+
+/**
+ * Create the directories leading to a file, only the user may read
+ * those it creates.
+ *
+ * \parm[in] path The file.
+ **/
+void
+cache_dirs(char *path)
+{
+	char *p = path;
+
+	while ((p = strchr(p + 1, '/')) != NULL) {
+		*p = '\0';
+		mkdir(path, 0700);
+		*p = '/';
+	}
+}
+
+/**
+ * \}
+ **/
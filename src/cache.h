@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file cache.h
+ * Internal definitions for naming the files mcds keeps between runs.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifndef MCDS_CACHE_H
+#define MCDS_CACHE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Name a file in the cache directory, or the directory for NULL */
+char *cache_path(const char *);
+
+/** Create the directories leading to a file */
+void cache_dirs(char *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_CACHE_H */
+/**
+ * \}
+ **/
@@ -40,10 +40,14 @@
 #include "options.h"
 #include "mem.h"
 #include "carddav.h"
+#include "store.h"
+#include "xml.h"
+#include "mcds.h"
 
 /** Curl response data structure **/
 struct r_data {
 	size_t size;
+	size_t alloc;
 	char *data;
 };
 
@@ -64,29 +68,35 @@ static const char sterm[] =
   </D:prop>\n\
   <C:filter test='anyof'>\n\
     <C:prop-filter name='%s'>\n\
-      <C:text-match collation='i;unicode-casemap'\n\
+      <C:text-match collation='%s'\n\
                     match-type='contains'>%s</C:text-match>\n\
     </C:prop-filter>\n\
   </C:filter>\n\
 </C:addressbook-query>";
 
 /**
- * Query for a name from the carddav server.
+ * Send a WebDAV request to the server and collect the response. The
+ * HTTP status is kept in the context, so the caller can tell a
+ * rejected password.
  *
- * \parm[in] hdl     Curl handle.
- * \parm[out] result The results from the query.
+ * \parm[in]  ctx    The context.
+ * \parm[in]  method The request method, such as REPORT or PROPFIND.
+ * \parm[in]  url    The resource to send it to.
+ * \parm[in]  depth  The Depth header.
+ * \parm[in]  body   The XML request body.
+ * \parm[out] result The response body.
  *
  * \retval 0 If there were no errors.
- * \retval 1 If an error was encounted.
+ * \retval 1 If an error was encounted, or the status was not 2xx.
  **/
 int
-query(CURL *hdl, char **result)
+request(struct mcds *ctx, const char *method, const char *url,
+	const char *depth, const char *body, char **result)
 {
-
-	int plen = 0;
-	size_t len = 0;
-	char *s = NULL;
-	long response_code;
+	int rtn = EXIT_FAILURE;
+	long response_code = 0;
+	char dhdr[32] = {0};
+	CURL *hdl = ctx->hdl;
 	CURLcode res = CURLE_OK;
 	struct curl_slist *hdrs = NULL;
 	struct r_data buffer = {0};
@@ -95,35 +105,24 @@ query(CURL *hdl, char **result)
 		warnx(_("Will not to write results to non-null pointer."));
 		return(EXIT_FAILURE);
 	}
-
-	len = strlen(sterm) -8
-		+ strlen(sterm_name[options.search])
-		+ (2*strlen(sterm_name[options.query]))
-		+ strlen(options.term) + 1;
-	s = xmalloc(len*sizeof(char));
-	plen = snprintf(s, len, sterm,
-		     sterm_name[options.search],
-		     sterm_name[options.query],
-		     sterm_name[options.query],
-		     options.term);
-	if (plen < 0 || (size_t)plen != len -1) {
-		warnx(_("Unable to build search string."));
-		return(EXIT_FAILURE);
-	}
+	ctx->status = 0;
 
 	/* Response buffer, will be realloc'ed by the call back */
-	buffer.data = xmalloc(1);
+	buffer.data = xmalloc(BUFSIZ);
+	buffer.alloc = BUFSIZ;
 	buffer.size = 0;
 
-	if (options.verbose) {
-		fprintf(stderr, "  Sending    :\n%s\n", s);
+	if (ctx->opts->verbose) {
+		fprintf(stderr, "  Sending    : %s %s\n%s\n", method, url, body);
 	}
 
+	snprintf(dhdr, sizeof(dhdr), "Depth: %s", depth);
 	hdrs = curl_slist_append(hdrs, "Content-Type: text/xml; charset=utf-8");
-	hdrs = curl_slist_append(hdrs, "Depth: 1");
+	hdrs = curl_slist_append(hdrs, dhdr);
 
-	curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, "REPORT");
-	curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, s);
+	curl_easy_setopt(hdl, CURLOPT_URL, url);
+	curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, method);
+	curl_easy_setopt(hdl, CURLOPT_POSTFIELDS, body);
 	curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, hdrs);
 	curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, query_cb);
 	curl_easy_setopt(hdl, CURLOPT_WRITEDATA, (void *)&buffer);
@@ -132,33 +131,30 @@ query(CURL *hdl, char **result)
 	if (res == CURLE_OK)
 		res = curl_easy_getinfo(hdl, CURLINFO_RESPONSE_CODE, &response_code);
 	if (res != CURLE_OK) {
-		warnx(_("Unable to search for %s: %s"),
-				options.term, curl_easy_strerror(res));
-		return(EXIT_FAILURE);
+		warnx(_("Unable to send %s to %s: %s"),
+				method, url, curl_easy_strerror(res));
+		goto rtn;
 	}
-	/* Write out a blank line for mutt */
-	printf("\n");
+	ctx->status = response_code;
 
 	if (response_code < 200 || response_code > 299 ||
 	    buffer.size == 0) {
-		warnx(_("Unable to obtain a result: %ld (%zu bytes)."),
-		      response_code, buffer.size);
-		return(EXIT_FAILURE);
+		if (ctx->opts->verbose) {
+			fprintf(stderr, "%s %s: %ld (%zu bytes)\n", method, url,
+				response_code, buffer.size);
+		}
+		goto rtn;
 	}
-	*result = xmalloc(buffer.size+1);
-	memcpy(*result, buffer.data, buffer.size);
-	(*result)[buffer.size] = '\0';
 
-	if (options.verbose) {
-		fprintf(stderr, "Retrieved:\n======\n%s\n======\n", *result);
-	}
+	/* The decoded response is handed over, not copied */
+	*result = buffer.data;
+	buffer.data = NULL;
 
-	curl_slist_free_all(hdrs);
+	rtn = EXIT_SUCCESS;
 
-	if (s) {
-		free(s);
-		s = NULL;
-	}
+rtn:
+	curl_slist_free_all(hdrs);
+	curl_easy_setopt(hdl, CURLOPT_HTTPHEADER, NULL);
 
 	if (buffer.data) {
 		free(buffer.data);
@@ -166,7 +162,71 @@ query(CURL *hdl, char **result)
 		buffer.size = 0;
 	}
 
-	return(EXIT_SUCCESS);
+	return(rtn);
+}
+
+/**
+ * Query for a name from the carddav server. The collection and the
+ * collation are those discovery found.
+ *
+ * \parm[in] ctx     The context.
+ * \parm[in] q       The lookup.
+ * \parm[out] result The results from the query.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+query(struct mcds *ctx, const struct mcds_query *q, char **result)
+{
+
+	int rtn = EXIT_FAILURE;
+	int plen = 0;
+	size_t len = 0;
+	char *s = NULL;
+	const char *coll = NULL;
+	const char *url = ctx->dav.url ? ctx->dav.url : ctx->opts->url;
+
+	/* i;ascii-casemap is the one every server must support */
+	coll = ctx->dav.caps & dav_ascii ?
+		"i;ascii-casemap" : "i;unicode-casemap";
+
+	len = strlen(sterm) -10
+		+ strlen(sterm_name[q->search])
+		+ (2*strlen(sterm_name[q->query]))
+		+ strlen(coll)
+		+ strlen(q->term) + 1;
+	s = xmalloc(len*sizeof(char));
+	plen = snprintf(s, len, sterm,
+		     sterm_name[q->search],
+		     sterm_name[q->query],
+		     sterm_name[q->query],
+		     coll,
+		     q->term);
+	if (plen < 0 || (size_t)plen != len -1) {
+		warnx(_("Unable to build search string."));
+		goto rtn;
+	}
+
+	if (request(ctx, "REPORT", url, "1", s, result)) {
+		warnx(_("Unable to obtain a result for %s: %ld."),
+		      q->term, ctx->status);
+		goto rtn;
+	}
+
+	if (ctx->opts->verbose) {
+		fprintf(stderr, "Retrieved:\n======\n%s\n======\n", *result);
+	}
+
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	if (s) {
+		free(s);
+		s = NULL;
+	}
+
+	return(rtn);
 }
 
 
@@ -177,7 +237,9 @@ query(CURL *hdl, char **result)
  * Note curl normally writes out every 16k (as defined
  * by CURL_MAX_WRITE_SIZE in curl.h). So if the response is
  * larger than 16k, this callback will be called multiple
- * times.
+ * times. A compressed response is decoded by curl as it arrives,
+ * so only the decoded bytes are kept, and the buffer doubles to
+ * avoid copying them on every call.
  *
  * \parm[in] contents The contents received by curl.
  * \parm[in] size     The size of a member returned.
@@ -192,13 +254,23 @@ size_t
 query_cb(void *contents, size_t size, size_t nmemb, void *mem)
 {
 	size_t len = 0;
+	size_t alloc = 0;
+	char *data = NULL;
 	struct r_data *res = (struct r_data *)mem;
 
 	len = size * nmemb;
-	res->data = realloc(res->data, res->size + len + 1);
-	if (res->data == NULL) {
-		warn(_("Unable to extend the response data buffer"));
-		return(0);
+	if (res->size + len + 1 > res->alloc) {
+		alloc = res->alloc;
+		while (res->size + len + 1 > alloc) {
+			alloc *= 2;
+		}
+		data = realloc(res->data, alloc);
+		if (data == NULL) {
+			warn(_("Unable to extend the response data buffer"));
+			return(0);
+		}
+		res->data = data;
+		res->alloc = alloc;
 	}
 
 	memcpy(&(res->data[res->size]), contents, len);
@@ -209,6 +281,84 @@ query_cb(void *contents, size_t size, size_t nmemb, void *mem)
 
 }
 
+/**
+ * Query the server for the context's lookup and search the response.
+ * The address book is found first, if the context does not know it.
+ * When it can be synced the local copy is searched instead.
+ * Contexts sharing a table of flights share identical queries.
+ *
+ * \parm[in] src The source.
+ * \parm[in] ctx The context, with credentials set.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+carddav_search(const struct source *src, struct mcds *ctx)
+{
+	int rtn = EXIT_FAILURE;
+	char *res = NULL;
+	struct flight *f = NULL;
+
+	if (discover(ctx)) {
+		goto rtn;
+	}
+	if (src->data && (ctx->dav.caps & dav_sync)) {
+		if (store_search((struct store *)src->data, ctx)) {
+			goto rtn;
+		}
+	} else if (ctx->flights) {
+		if (flight_join(ctx->flights, ctx, ctx->q, &f)) {
+			goto rtn;
+		}
+		if (parse_xml(ctx, f->res)) {
+			goto rtn;
+		}
+	} else {
+		if (query(ctx, ctx->q, &res)) {
+			goto rtn;
+		}
+		if (parse_xml(ctx, res)) {
+			goto rtn;
+		}
+	}
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	/* The address book was moved or removed since it was found */
+	if (rtn && ctx->status == 404) {
+		discover_forget(ctx);
+	}
+	if (f) {
+		flight_leave(ctx->flights, f);
+		f = NULL;
+	}
+	if (res) {
+		free(res);
+		res = NULL;
+	}
+
+	return(rtn);
+}
+
+/**
+ * Describe the carddav server as a source of cards. It filters on the
+ * term itself, but needs the network. With a store, a server that
+ * supports sync-collection is searched through a local copy instead.
+ *
+ * \parm[out] src   The source.
+ * \parm[in]  store The local copy, or NULL to always query.
+ **/
+void
+carddav_source(struct source *src, struct store *store)
+{
+	src->name = "carddav";
+	src->caps = src_filter | src_remote;
+	src->cost = SRC_COST_NET;
+	src->data = store;
+	src->search = carddav_search;
+}
+
 /**
  * \}
  **/
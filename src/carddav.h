@@ -32,8 +32,23 @@ extern "C"
 {
 #endif
 
+#include "options.h"
+
+struct mcds;
+
+struct source;
+
+struct store;
+
+/* Send a WebDAV request to a carddav server */
+int request(struct mcds *, const char *, const char *, const char *,
+	    const char *, char **);
+
 /* Query a carddav server */
-int query(CURL *, char **);
+int query(struct mcds *, const struct mcds_query *, char **);
+
+/* Describe the carddav server as a source of cards */
+void carddav_source(struct source *, struct store *);
 
 #ifdef __cplusplus
 }                               /* extern "C" */
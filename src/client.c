@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file client.c
+ * Main entry point for the program mcds-client.
+ *
+ * The client hands its arguments to a resident "mcds --serve" and
+ * copies the answer to standard output. It only needs libc, so
+ * starting it costs no more than starting the shell that runs it.
+ *
+ * \ingroup main
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "proto.h"
+
+/**
+ * Write all of a buffer, retrying short writes.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n = 0;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return(EXIT_FAILURE);
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * The main entry point of the program.
+ *
+ * \param argc Number of command line arguments.
+ * \param argv Reference to the pointer to the argument array list.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted, or there were no matches.
+ **/
+int
+main(int argc, char **argv)
+{
+	int i = 0;
+	int fd = -1;
+	size_t len = 0;
+	size_t got = 0;
+	ssize_t n = 0;
+	char buf[BUFSIZ];
+	char *path = NULL;
+	struct sockaddr_un sa = {0};
+
+#ifdef HAVE_PLEDGE
+	if (pledge("stdio unix", NULL) == -1) {
+		err(1, "pledge");
+	}
+#endif
+
+	for (i = 1; i < argc; ++i) {
+		len += strlen(argv[i]) + 1;
+	}
+	if (argc < 2 || len + 1 > MCDS_REQUEST_MAX) {
+		fprintf(stderr, "usage: %s [mcds options] string\n", argv[0]);
+		return(EXIT_FAILURE);
+	}
+
+	if ((path = socket_path()) == NULL) {
+		err(EXIT_FAILURE, "socket path");
+	}
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		errx(EXIT_FAILURE, "%s: path too long", path);
+	}
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		err(EXIT_FAILURE, "socket");
+	}
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		err(EXIT_FAILURE, "%s", path);
+	}
+	if (socket_peer(fd)) {
+		errx(EXIT_FAILURE, "%s: not served by this user", path);
+	}
+	free(path);
+
+	/* Each argument keeps its NUL, an empty one ends the request */
+	for (i = 1; i < argc; ++i) {
+		if (write_all(fd, argv[i], strlen(argv[i]) + 1)) {
+			err(EXIT_FAILURE, "write");
+		}
+	}
+	if (write_all(fd, "", 1)) {
+		err(EXIT_FAILURE, "write");
+	}
+	shutdown(fd, SHUT_WR);
+
+	for (;;) {
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			err(EXIT_FAILURE, "read");
+		}
+		if (n == 0) {
+			break;
+		}
+		if (write_all(STDOUT_FILENO, buf, n)) {
+			err(EXIT_FAILURE, "write");
+		}
+		got += n;
+	}
+	close(fd);
+
+	/* The service sends nothing when the lookup failed */
+	return(got ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * \}
+ **/
@@ -30,96 +30,211 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <err.h>
+#include <pthread.h>
 #include <curl/curl.h>
 #include <locale.h>
 #include "gettext.h"
 #include "defs.h"
 #include "curl.h"
-#include "options.h"
+#include "mcds.h"
 
 /**
- * Initalise a curl handle.
+ * Initalise a context's curl handle from its configuration.
+ * curl must already have been globally initialised.
  *
- * \parm[in]  url The URL to connect to.
- * \parm[out] hdl The curl handle.
+ * \parm[in,out] ctx The context.
  *
  * \retval 0 If it was sucessful.
  * \retval 1 If the initialization failed.
  **/
 int
-cinit(CURL **hdl)
+cinit(struct mcds *ctx)
 {
+	CURL **hdl = &ctx->hdl;
+	const struct opts *o = ctx->opts;
 
 	if (*hdl != NULL) {
 		warnx(_("Unable to initialize non-null curl handle."));
 		return(EXIT_FAILURE);
 	}
 
-	if (curl_global_init(CURL_GLOBAL_DEFAULT)) {
-		warnx(_("Unable to initialize curl."));
-		return(EXIT_FAILURE);
-	}
-
 	*hdl = curl_easy_init();
 	if (*hdl == NULL) {
 		warnx(_("Unable to initialize curl handle."));
 		return(EXIT_FAILURE);
 	}
-	if (curl_easy_setopt(*hdl, CURLOPT_VERBOSE, (long) options.verbose)) {
+	if (curl_easy_setopt(*hdl, CURLOPT_VERBOSE, (long) o->verbose)) {
 		warnx(_("Unable to set curls verbose option."));
 		return(EXIT_FAILURE);
 	}
-	if (curl_easy_setopt(*hdl, CURLOPT_URL, options.url)) {
+	if (curl_easy_setopt(*hdl, CURLOPT_URL, o->url)) {
 		warnx(_("Unable to set curls URL."));
 		return(EXIT_FAILURE);
 	}
-	if (curl_easy_setopt(*hdl, CURLOPT_SSL_VERIFYPEER, (long) options.verify)) {
+	if (curl_easy_setopt(*hdl, CURLOPT_SSL_VERIFYPEER, (long) o->verify)) {
 		warnx(_("Unable to set curls SSL verification."));
 		return(EXIT_FAILURE);
 	}
-	if (options.username) {
-		if (curl_easy_setopt(*hdl, CURLOPT_USERNAME, options.username)) {
+	if (curl_easy_setopt(*hdl, CURLOPT_HTTPAUTH, CURLAUTH_ANY)) {
+		warnx(_("Unable to set curls HTTP auth method."));
+		return(EXIT_FAILURE);
+	}
+	/* Multistatus XML compresses well, curl offers what it can decode */
+	if (curl_easy_setopt(*hdl, CURLOPT_ACCEPT_ENCODING, "")) {
+		warnx(_("Unable to set curls accepted encodings."));
+		return(EXIT_FAILURE);
+	}
+	/* Signals are process wide, so are unsafe with threaded lookups */
+	if (curl_easy_setopt(*hdl, CURLOPT_NOSIGNAL, 1L)) {
+		warnx(_("Unable to disable curls signals."));
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Set the credentials from the configuration on a context's curl handle.
+ *
+ * \parm[in] ctx The context.
+ *
+ * \retval 0 If it was sucessful.
+ * \retval 1 If an option could not be set.
+ **/
+int
+ccreds(struct mcds *ctx)
+{
+	CURL *hdl = ctx->hdl;
+	const struct opts *o = ctx->opts;
+
+	if (o->username) {
+		if (curl_easy_setopt(hdl, CURLOPT_USERNAME, o->username)) {
 			warnx(_("Unable to set curls username option."));
 			return(EXIT_FAILURE);
 		}
-		if (curl_easy_setopt(*hdl, CURLOPT_PASSWORD, options.password)) {
+		if (curl_easy_setopt(hdl, CURLOPT_PASSWORD, o->password)) {
 			warnx(_("Unable to set curls password option."));
 			return(EXIT_FAILURE);
 		}
 	} else {
-		if (curl_easy_setopt(*hdl, CURLOPT_NETRC, (long) options.netrc)) {
+		if (curl_easy_setopt(hdl, CURLOPT_NETRC, (long) o->netrc)) {
 			warnx(_("Unable to set curls .netrc option."));
 			return(EXIT_FAILURE);
 		}
 	}
-	if (curl_easy_setopt(*hdl, CURLOPT_HTTPAUTH, CURLAUTH_ANY)) {
-		warnx(_("Unable to set curls HTTP auth method."));
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Discard a response body.
+ **/
+static size_t
+discard_cb(void *contents, size_t size, size_t nmemb, void *mem)
+{
+	(void)contents;
+	(void)mem;
+	return(size * nmemb);
+}
+
+/**
+ * Body of the warm up thread. An unauthenticated OPTIONS request
+ * resolves the host and completes the TCP and TLS handshakes, the
+ * connection is then left in the handle's cache for the REPORT.
+ * Whatever the server answers is ignored.
+ **/
+static void *
+warm(void *arg)
+{
+	struct mcds *ctx = (struct mcds *)arg;
+	CURL *hdl = ctx->hdl;
+	CURLcode res = CURLE_OK;
+
+	curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, "OPTIONS");
+	curl_easy_setopt(hdl, CURLOPT_WRITEFUNCTION, discard_cb);
+	res = curl_easy_perform(hdl);
+	if (res != CURLE_OK && ctx->opts->verbose) {
+		fprintf(stderr, "Unable to pre-connect: %s\n",
+			curl_easy_strerror(res));
+	}
+	curl_easy_setopt(hdl, CURLOPT_CUSTOMREQUEST, NULL);
+
+	return(NULL);
+}
+
+/**
+ * Start connecting a context's curl handle to the server in the
+ * background. The handle must not be used until cwait() returns.
+ *
+ * \parm[in] ctx The context.
+ *
+ * \retval 0 If it was sucessful.
+ * \retval 1 If the thread could not be started.
+ **/
+int
+cwarm(struct mcds *ctx)
+{
+	int rerr = 0;
+
+	if (ctx->warming) {
+		warnx(_("Connection is already being made."));
+		return(EXIT_FAILURE);
+	}
+	if ((rerr = pthread_create(&ctx->warm, NULL, warm, ctx)) != 0) {
+		warnx(_("Unable to start connecting: %s"), strerror(rerr));
 		return(EXIT_FAILURE);
 	}
+	ctx->warming = 1;
 
 	return(EXIT_SUCCESS);
 }
 
 /**
- * Finalise a curl handle.
+ * Wait for a background connection started by cwarm() to finish.
  *
- * \parm[in] hdl The curl handle.
+ * \parm[in] ctx The context.
+ *
+ * \retval 0 If it was sucessful.
+ * \retval 1 If the thread could not be joined.
+ **/
+int
+cwait(struct mcds *ctx)
+{
+	int rerr = 0;
+
+	if (!ctx->warming) {
+		return(EXIT_SUCCESS);
+	}
+	ctx->warming = 0;
+	if ((rerr = pthread_join(ctx->warm, NULL)) != 0) {
+		warnx(_("Unable to finish connecting: %s"), strerror(rerr));
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Finalise a context's curl handle.
+ *
+ * \parm[in] ctx The context.
  *
  * \retval 0 If it was sucessful.
  * \retval 1 If the initialization failed.
  **/
 int
-cfini(CURL **hdl)
+cfini(struct mcds *ctx)
 {
 
-	if (*hdl == NULL) {
+	if (ctx->hdl == NULL) {
 		warnx(_("Unable to finalise null curl handle."));
 		return(EXIT_FAILURE);
 	}
 
-	curl_easy_cleanup(*hdl);
-	curl_global_cleanup();
+	curl_easy_cleanup(ctx->hdl);
+	ctx->hdl = NULL;
 
 	return(EXIT_SUCCESS);
 }
@@ -32,11 +32,22 @@ extern "C"
 {
 #endif
 
-/** Initialise a curl handle */
-int cinit(CURL **);
+struct mcds;
 
-/** Finalise a curl handle */
-int cfini(CURL **);
+/** Initialise a context's curl handle */
+int cinit(struct mcds *);
+
+/** Set the credentials on a context's curl handle */
+int ccreds(struct mcds *);
+
+/** Start connecting to the server in the background */
+int cwarm(struct mcds *);
+
+/** Wait for the background connection */
+int cwait(struct mcds *);
+
+/** Finalise a context's curl handle */
+int cfini(struct mcds *);
 
 #ifdef __cplusplus
 }                               /* extern "C" */
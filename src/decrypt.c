@@ -19,7 +19,8 @@
 
 /**
  * \file decrypt.c
- * Routines to decrypt the password file.
+ * Routines to decrypt the password file, built as a runtime loaded
+ * backend so GPGME is only linked in when a password file is used.
  *
  * \ingroup decrypt
  * \{
@@ -39,22 +40,23 @@
 #include <gpgme.h>
 #include "gettext.h"
 #include "defs.h"
-#include "options.h"
-#include "mem.h"
+#include "backend.h"
 
 #ifndef LINE_MAX
 #define LINE_MAX          sysconf(_SC_LINE_MAX)
 #endif
 
 /**
- * Decrypt the password file and save the password
- * in the options structure.
+ * Decrypt the password file.
+ *
+ * \parm[in]  filename The encrypted password file.
+ * \parm[out] password The decrypted password.
  *
  * \retval 0 If there were no errors.
  * \retval 1 If an error was encounted.
  **/
-int
-decrypt(char *filename)
+static int
+decrypt(const char *filename, char **password)
 {
 	int fd = 0;              /* Password file descriptor */
 	size_t ret = 0;          /* Number of bytes read from buffer */
@@ -121,14 +123,24 @@ decrypt(char *filename)
 
 	while ((ret = gpgme_data_read(out, tmp, LINE_MAX)) > 0) {
 		total += ret;
-		options.password = realloc(options.password, total);
-		if (!options.password) {
+		*password = realloc(*password, total);
+		if (!*password) {
 			warn(_("Unable to realloc password."));
 			return(EXIT_FAILURE);
 		}
-		memcpy(&(options.password[total - ret]), tmp, ret);
+		memcpy(&((*password)[total - ret]), tmp, ret);
+	}
+	if (total == 0) {
+		warnx(_("The password file is empty."));
+		close(fd);
+		free(*password);
+		*password = NULL;
+		gpgme_data_release(in);
+		gpgme_data_release(out);
+		gpgme_release(ctx);
+		return(EXIT_FAILURE);
 	}
-	options.password[total-1] = '\0';
+	(*password)[total-1] = '\0';
 
 	if (close(fd) < 0) {
 		warn(_("Unable to close password file."));
@@ -142,6 +154,13 @@ decrypt(char *filename)
 	return(EXIT_SUCCESS);
 }
 
+/** The backend loaded by mcds **/
+ATT_PUBLIC const struct backend mcds_backend = {
+	.version = MCDS_BACKEND_VERSION,
+	.name    = "gpgme",
+	.decrypt = decrypt,
+};
+
 /**
  * \}
  **/
@@ -33,7 +33,7 @@ extern "C"
 #endif
 
 /** Decrypt the password file */
-int decrypt(char *);
+int decrypt(const char *);
 
 #ifdef __cplusplus
 }                               /* extern "C" */
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file dedup.c
+ * Routines to collapse duplicate results.
+ *
+ * The same address is often held on several cards, or in several
+ * address books. Results are keyed by their search field, trimmed and
+ * lower cased, in a set using open addressing with linear probing. A
+ * set marked exact keeps its keys byte for byte instead, for values
+ * such as hrefs where case matters.
+ * Keys are compared without copying the value being looked up, and
+ * removed by shifting the following keys back, so no tombstones are
+ * left to slow later probes.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "mem.h"
+#include "dedup.h"
+
+/** Fewest slots in a set */
+#define DEDUP_MIN 64
+
+/**
+ * Trim the white space around a value.
+ **/
+static void
+trim(const char **v, size_t *len)
+{
+	while (*len > 0 && isspace((unsigned char)**v)) {
+		++*v;
+		--*len;
+	}
+	while (*len > 0 && isspace((unsigned char)(*v)[*len - 1])) {
+		--*len;
+	}
+}
+
+/**
+ * FNV-1a hash of a trimmed value, lower cased unless exact.
+ **/
+static unsigned long
+hash(const char *v, size_t len, int exact)
+{
+	unsigned long h = 2166136261UL;
+	size_t i = 0;
+
+	for (i = 0; i < len; ++i) {
+		h ^= exact ? (unsigned char)v[i] :
+			(unsigned char)tolower((unsigned char)v[i]);
+		h *= 16777619UL;
+	}
+	return(h);
+}
+
+/**
+ * Does a stored key equal a trimmed value, lower cased unless exact.
+ **/
+static int
+equal(const char *key, const char *v, size_t len, int exact)
+{
+	size_t i = 0;
+
+	if (exact) {
+		return(memcmp(key, v, len) == 0 && key[len] == '\0');
+	}
+	for (i = 0; i < len; ++i) {
+		if (key[i] != (char)tolower((unsigned char)v[i])) {
+			return(0);
+		}
+	}
+	return(key[len] == '\0');
+}
+
+/**
+ * Find the slot holding a value's key, or the empty slot ending its
+ * probe.
+ **/
+static struct d_slot *
+probe(const struct dedup *d, unsigned long h, const char *v, size_t len)
+{
+	size_t i = h & (d->size - 1);
+
+	while (d->slot[i].key &&
+	       (d->slot[i].hash != h ||
+		!equal(d->slot[i].key, v, len, d->exact))) {
+		i = (i + 1) & (d->size - 1);
+	}
+	return(&d->slot[i]);
+}
+
+/**
+ * Double the slots, placing every key again.
+ **/
+static void
+grow(struct dedup *d)
+{
+	struct d_slot *old = d->slot;
+	size_t n = d->size;
+	size_t i = 0;
+	size_t j = 0;
+
+	d->size = 2*n;
+	d->slot = xmalloc(d->size*sizeof(struct d_slot));
+	memset(d->slot, 0, d->size*sizeof(struct d_slot));
+	for (i = 0; i < n; ++i) {
+		if (old[i].key == NULL) {
+			continue;
+		}
+		j = old[i].hash & (d->size - 1);
+		while (d->slot[j].key) {
+			j = (j + 1) & (d->size - 1);
+		}
+		d->slot[j] = old[i];
+	}
+	free(old);
+}
+
+/**
+ * Empty the set, sized to hold n keys without growing. The slots of
+ * a large enough set are reused, and whether it is exact is kept.
+ *
+ * \parm[in] d The set.
+ * \parm[in] n The number of keys expected, 0 if unknown.
+ **/
+void
+dedup_init(struct dedup *d, size_t n)
+{
+	size_t size = DEDUP_MIN;
+	size_t i = 0;
+
+	while (size < 2*n) {
+		size *= 2;
+	}
+	for (i = 0; i < d->size; ++i) {
+		free(d->slot[i].key);
+	}
+	if (d->size < size) {
+		free(d->slot);
+		d->slot = xmalloc(size*sizeof(struct d_slot));
+		d->size = size;
+	}
+	memset(d->slot, 0, d->size*sizeof(struct d_slot));
+	d->used = 0;
+}
+
+/**
+ * Find a value's key.
+ *
+ * \parm[in] d   The set.
+ * \parm[in] v   The value, which need not be NUL terminated.
+ * \parm[in] len Length of the value.
+ *
+ * \return The value kept with the key, NULL if it is not held.
+ **/
+size_t *
+dedup_find(const struct dedup *d, const char *v, size_t len)
+{
+	struct d_slot *s = NULL;
+
+	if (d->size == 0) {
+		return(NULL);
+	}
+	if (!d->exact) {
+		trim(&v, &len);
+	}
+	s = probe(d, hash(v, len, d->exact), v, len);
+
+	return(s->key ? &s->val : NULL);
+}
+
+/**
+ * Add a value's key, unless it is already held.
+ *
+ * \parm[in]  d    The set, which must have been initialised.
+ * \parm[in]  v    The value, which need not be NUL terminated.
+ * \parm[in]  len  Length of the value.
+ * \parm[out] held Set when the key was already held.
+ *
+ * \return The value kept with the key.
+ **/
+size_t *
+dedup_add(struct dedup *d, const char *v, size_t len, int *held)
+{
+	unsigned long h = 0;
+	struct d_slot *s = NULL;
+	size_t i = 0;
+
+	if (!d->exact) {
+		trim(&v, &len);
+	}
+	h = hash(v, len, d->exact);
+	s = probe(d, h, v, len);
+	if (s->key) {
+		*held = 1;
+		return(&s->val);
+	}
+	*held = 0;
+
+	/* Keep the load under three quarters */
+	if (4*(d->used + 1) > 3*d->size) {
+		grow(d);
+		s = probe(d, h, v, len);
+	}
+	s->hash = h;
+	s->key = xmalloc(len + 1);
+	for (i = 0; i < len; ++i) {
+		s->key[i] = d->exact ? v[i] : (char)tolower((unsigned char)v[i]);
+	}
+	s->key[len] = '\0';
+	s->val = 0;
+	d->used++;
+
+	return(&s->val);
+}
+
+/**
+ * Remove a value's key, if it is held. The keys after it in its probe
+ * are shifted back into the gap.
+ *
+ * \parm[in] d   The set.
+ * \parm[in] v   The value, which need not be NUL terminated.
+ * \parm[in] len Length of the value.
+ **/
+void
+dedup_del(struct dedup *d, const char *v, size_t len)
+{
+	struct d_slot *s = NULL;
+	size_t mask = d->size - 1;
+	size_t i = 0;
+	size_t j = 0;
+	size_t home = 0;
+
+	if (d->size == 0) {
+		return;
+	}
+	if (!d->exact) {
+		trim(&v, &len);
+	}
+	s = probe(d, hash(v, len, d->exact), v, len);
+	if (s->key == NULL) {
+		return;
+	}
+	free(s->key);
+	s->key = NULL;
+	d->used--;
+
+	i = s - d->slot;
+	for (j = (i + 1) & mask; d->slot[j].key; j = (j + 1) & mask) {
+		home = d->slot[j].hash & mask;
+		/* Move it back unless its home lies in (i, j] */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			d->slot[i] = d->slot[j];
+			d->slot[j].key = NULL;
+			i = j;
+		}
+	}
+}
+
+/**
+ * Release the set.
+ *
+ * \parm[in] d The set.
+ **/
+void
+dedup_free(struct dedup *d)
+{
+	size_t i = 0;
+
+	for (i = 0; i < d->size; ++i) {
+		free(d->slot[i].key);
+	}
+	free(d->slot);
+	d->slot = NULL;
+	d->size = 0;
+	d->used = 0;
+}
+
+/**
+ * \}
+ **/
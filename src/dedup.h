@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file dedup.h
+ * Internal definitions for collapsing duplicate results.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifndef MCDS_DEDUP_H
+#define MCDS_DEDUP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** A slot of the set **/
+struct d_slot {
+	unsigned long hash;		/* Hash of the key */
+	char *key;			/* Key, NULL when empty */
+	size_t val;			/* Value kept with the key */
+};
+
+/** A set of normalised values, or exact ones, by open addressing **/
+struct dedup {
+	struct d_slot *slot;		/* Slots, a power of two of them */
+	size_t size;			/* Number of slots */
+	size_t used;			/* Keys held */
+	int exact;			/* Keys are held as given */
+};
+
+/** Empty the set, sized for n keys */
+void dedup_init(struct dedup *, size_t);
+
+/** Find a value's key, NULL if it is not held */
+size_t *dedup_find(const struct dedup *, const char *, size_t);
+
+/** Add a value's key, returning its slot value and if it was held */
+size_t *dedup_add(struct dedup *, const char *, size_t, int *);
+
+/** Remove a value's key */
+void dedup_del(struct dedup *, const char *, size_t);
+
+/** Release the set */
+void dedup_free(struct dedup *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_DEDUP_H */
+/**
+ * \}
+ **/
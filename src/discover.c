@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file discover.c
+ * Routines to find the address book on a CardDAV server.
+ *
+ * The configured URL may name the address book itself, or only the
+ * server. Discovery follows RFC 6764 and RFC 6352: the URL, or
+ * failing that /.well-known/carddav, gives the user's principal, the
+ * principal gives the address book home, and the first address book
+ * listed there is used. The reports and collations the server
+ * supports are noted on the way.
+ * The result is kept in the cache directory, one line per URL and
+ * user, so later runs send no discovery requests at all. It is
+ * forgotten when the server no longer has the address book.
+ *
+ * \ingroup carddav
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "options.h"
+#include "cache.h"
+#include "carddav.h"
+#include "mem.h"
+#include "xml.h"
+#include "mcds.h"
+#include "discover.h"
+
+/** Properties asked of the configured URL **/
+static const char pstart[] =
+"<?xml version='1.0' encoding='utf-8' ?>\n\
+<D:propfind xmlns:D='DAV:' xmlns:C='urn:ietf:params:xml:ns:carddav'>\n\
+  <D:prop>\n\
+    <D:resourcetype/>\n\
+    <D:current-user-principal/>\n\
+    <C:addressbook-home-set/>\n\
+    <D:supported-report-set/>\n\
+    <C:supported-collation-set/>\n\
+  </D:prop>\n\
+</D:propfind>";
+
+/** Properties asked of the well known URL **/
+static const char pprincipal[] =
+"<?xml version='1.0' encoding='utf-8' ?>\n\
+<D:propfind xmlns:D='DAV:'>\n\
+  <D:prop>\n\
+    <D:current-user-principal/>\n\
+  </D:prop>\n\
+</D:propfind>";
+
+/** Properties asked of the principal **/
+static const char phome[] =
+"<?xml version='1.0' encoding='utf-8' ?>\n\
+<D:propfind xmlns:D='DAV:' xmlns:C='urn:ietf:params:xml:ns:carddav'>\n\
+  <D:prop>\n\
+    <C:addressbook-home-set/>\n\
+  </D:prop>\n\
+</D:propfind>";
+
+/** Properties asked of each collection in the home **/
+static const char plist[] =
+"<?xml version='1.0' encoding='utf-8' ?>\n\
+<D:propfind xmlns:D='DAV:' xmlns:C='urn:ietf:params:xml:ns:carddav'>\n\
+  <D:prop>\n\
+    <D:resourcetype/>\n\
+    <D:supported-report-set/>\n\
+    <C:supported-collation-set/>\n\
+  </D:prop>\n\
+</D:propfind>";
+
+/**
+ * Send a PROPFIND and parse the multistatus answer.
+ *
+ * \return The document, to be freed, NULL on any failure.
+ **/
+static xmlDocPtr
+propfind(struct mcds *ctx, const char *url, const char *depth,
+	 const char *body)
+{
+	char *res = NULL;
+	xmlDocPtr doc = NULL;
+
+	if (request(ctx, "PROPFIND", url, depth, body, &res)) {
+		return(NULL);
+	}
+	if (ctx->opts->verbose) {
+		fprintf(stderr, "Retrieved:\n======\n%s\n======\n", res);
+	}
+	doc = xmlReadMemory(res, strlen(res), "noname.xml", NULL,
+			    XML_PARSE_NONET);
+	free(res);
+
+	return(doc);
+}
+
+/**
+ * The href held by a property, such as a principal or home set.
+ *
+ * \return The href, to be freed, NULL if the property has none.
+ **/
+static char *
+prop_href(xmlNode *node, const char *name)
+{
+	xmlNode *p = NULL;
+	xmlNode *h = NULL;
+	xmlChar *s = NULL;
+	char *href = NULL;
+
+	if ((p = xml_find(node, name)) == NULL ||
+	    (h = xml_find(p->children, "href")) == NULL) {
+		return(NULL);
+	}
+	s = xmlNodeGetContent(h);
+	if (s && s[0]) {
+		href = strdup((const char *)s);
+	}
+	xmlFree(s);
+
+	return(href);
+}
+
+/**
+ * Make an href absolute, against the URL the last response came from.
+ *
+ * \return The URL, to be freed.
+ **/
+static char *
+absolute(struct mcds *ctx, const char *href)
+{
+	size_t len = 0;
+	char *url = NULL;
+	char *base = NULL;
+	const char *p = NULL;
+
+	if (strstr(href, "://")) {
+		return(strdup(href));
+	}
+	curl_easy_getinfo(ctx->hdl, CURLINFO_EFFECTIVE_URL, &base);
+	if (base == NULL) {
+		base = ctx->opts->url;
+	}
+
+	/* An absolute path replaces everything after the host */
+	if (href[0] == '/') {
+		p = strstr(base, "://");
+		p = p ? strchr(p + 3, '/') : NULL;
+		len = p ? (size_t)(p - base) : strlen(base);
+	} else {
+		p = strrchr(base, '/');
+		len = p ? (size_t)(p - base) + 1 : strlen(base);
+	}
+	url = xmalloc(len + strlen(href) + 1);
+	memcpy(url, base, len);
+	strcpy(url + len, href);
+
+	return(url);
+}
+
+/**
+ * Is the resource described by a response an address book.
+ **/
+static int
+is_book(xmlNode *response)
+{
+	xmlNode *rt = NULL;
+
+	rt = xml_find(response->children, "resourcetype");
+	return(rt && xml_find(rt->children, "addressbook") != NULL);
+}
+
+/**
+ * Note whether a response says sync-collection is supported, and
+ * which collations.
+ **/
+static int
+capabilities(xmlNode *response)
+{
+	int caps = 0;
+	int unicode = 0;
+	xmlNode *set = NULL;
+	xmlNode *n = NULL;
+	xmlChar *s = NULL;
+
+	if ((set = xml_find(response->children, "supported-report-set"))) {
+		if (xml_find(set->children, "sync-collection")) {
+			caps |= dav_sync;
+		}
+	}
+	if ((set = xml_find(response->children, "supported-collation-set"))) {
+		for (n = set->children; n; n = n->next) {
+			if (n->type != XML_ELEMENT_NODE) {
+				continue;
+			}
+			s = xmlNodeGetContent(n);
+			if (s && xmlStrcmp(s, (const xmlChar *)"i;unicode-casemap") == 0) {
+				unicode = 1;
+			}
+			xmlFree(s);
+		}
+		if (!unicode && set->children) {
+			caps |= dav_ascii;
+		}
+	}
+
+	return(caps);
+}
+
+/**
+ * Ask the server where the address book is.
+ *
+ * \retval 0 If an address book was found.
+ * \retval 1 Otherwise.
+ **/
+static int
+ask(struct mcds *ctx)
+{
+	int rtn = EXIT_FAILURE;
+	char *href = NULL;
+	char *url = NULL;
+	char *home = NULL;
+	const char *start = ctx->opts->url;
+	xmlDocPtr doc = NULL;
+	xmlNode *root = NULL;
+	xmlNode *r = NULL;
+
+	/* The configured URL may already be the address book */
+	if ((doc = propfind(ctx, start, "0", pstart)) != NULL &&
+	    (root = xmlDocGetRootElement(doc)) != NULL) {
+		r = xml_find(root, "response");
+		if (r && is_book(r)) {
+			ctx->dav.url = strdup(start);
+			ctx->dav.caps = capabilities(r);
+			rtn = EXIT_SUCCESS;
+			goto rtn;
+		}
+		if ((href = prop_href(root, "addressbook-home-set")) == NULL) {
+			href = prop_href(root, "current-user-principal");
+		} else {
+			home = absolute(ctx, href);
+		}
+	}
+	if (ctx->status == 401) {
+		goto rtn;
+	}
+
+	/* Otherwise the server's well known URL leads to the principal */
+	if (home == NULL && href == NULL) {
+		url = absolute(ctx, "/.well-known/carddav");
+		xmlFreeDoc(doc);
+		curl_easy_setopt(ctx->hdl, CURLOPT_FOLLOWLOCATION, 1L);
+		doc = propfind(ctx, url, "0", pprincipal);
+		curl_easy_setopt(ctx->hdl, CURLOPT_FOLLOWLOCATION, 0L);
+		if (doc && (root = xmlDocGetRootElement(doc))) {
+			href = prop_href(root, "current-user-principal");
+		}
+		free(url);
+		url = NULL;
+	}
+
+	/* The principal names the home holding the address books */
+	if (home == NULL && href != NULL) {
+		url = absolute(ctx, href);
+		xmlFreeDoc(doc);
+		doc = propfind(ctx, url, "0", phome);
+		free(href);
+		href = NULL;
+		if (doc && (root = xmlDocGetRootElement(doc))) {
+			href = prop_href(root, "addressbook-home-set");
+		}
+		if (href) {
+			home = absolute(ctx, href);
+		}
+	}
+	if (home == NULL) {
+		goto rtn;
+	}
+
+	/* The first address book in the home is used */
+	xmlFreeDoc(doc);
+	if ((doc = propfind(ctx, home, "1", plist)) == NULL ||
+	    (root = xmlDocGetRootElement(doc)) == NULL) {
+		goto rtn;
+	}
+	for (r = xml_find(root, "response"); r; r = r->next) {
+		if (r->type != XML_ELEMENT_NODE || !is_book(r)) {
+			continue;
+		}
+		/* The response's own href comes before its properties */
+		free(href);
+		if ((href = prop_href(r, "response")) == NULL) {
+			continue;
+		}
+		ctx->dav.url = absolute(ctx, href);
+		ctx->dav.caps = capabilities(r);
+		rtn = EXIT_SUCCESS;
+		break;
+	}
+
+rtn:
+	xmlFreeDoc(doc);
+	free(href);
+	free(home);
+	free(url);
+
+	return(rtn);
+}
+
+/**
+ * Read or rewrite the cache of discovered address books. Each line is
+ * the configured URL, the user, the address book and its
+ * capabilities, separated by tabs. Reading fills in the context on a
+ * match. Writing drops the line matching the context, and adds the
+ * context's address book if it has one.
+ *
+ * \retval 0 If a line matched, or the cache was written.
+ * \retval 1 Otherwise.
+ **/
+static int
+cache(struct mcds *ctx, int write)
+{
+	int rtn = EXIT_FAILURE;
+	int fd = -1;
+	char *path = NULL;
+	char *tmp = NULL;
+	char *line = NULL;
+	char *f[4] = {0};
+	size_t size = 0;
+	size_t len = 0;
+	ssize_t n = 0;
+	int i = 0;
+	FILE *in = NULL;
+	FILE *out = NULL;
+	const struct opts *o = ctx->opts;
+	const char *user = o->username ? o->username : "";
+
+	if ((path = cache_path("discovery")) == NULL) {
+		return(EXIT_FAILURE);
+	}
+	if (write) {
+		cache_dirs(path);
+		len = strlen(path) + sizeof(".XXXXXX");
+		tmp = xmalloc(len);
+		snprintf(tmp, len, "%s.XXXXXX", path);
+		if ((fd = mkstemp(tmp)) == -1 ||
+		    (out = fdopen(fd, "w")) == NULL) {
+			goto rtn;
+		}
+	}
+
+	in = fopen(path, "r");
+	while (in && (n = getline(&line, &size, in)) != -1) {
+		if (n > 0 && line[n-1] == '\n') {
+			line[n-1] = '\0';
+		}
+		f[0] = line;
+		for (i = 1; i < 4 && f[i-1]; ++i) {
+			if ((f[i] = strchr(f[i-1], '\t')) != NULL) {
+				*f[i]++ = '\0';
+			}
+		}
+		if (f[3] == NULL) {
+			continue;
+		}
+		if (strcmp(f[0], o->url) == 0 && strcmp(f[1], user) == 0) {
+			if (!write) {
+				ctx->dav.url = strdup(f[2]);
+				ctx->dav.caps = atoi(f[3]);
+				rtn = EXIT_SUCCESS;
+				break;
+			}
+			continue;
+		}
+		if (write) {
+			fprintf(out, "%s\t%s\t%s\t%s\n", f[0], f[1], f[2], f[3]);
+		}
+	}
+
+	if (write) {
+		if (ctx->dav.url) {
+			fprintf(out, "%s\t%s\t%s\t%d\n", o->url, user,
+				ctx->dav.url, ctx->dav.caps);
+		}
+		fd = -1;
+		if (fclose(out) == 0 && rename(tmp, path) == 0) {
+			rtn = EXIT_SUCCESS;
+		}
+	}
+
+rtn:
+	if (in) {
+		fclose(in);
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	if (tmp && rtn) {
+		unlink(tmp);
+	}
+	free(tmp);
+	free(line);
+	free(path);
+
+	return(rtn);
+}
+
+/**
+ * Find the address book on the server, unless the context already
+ * knows it. The cache is used when it has the configured URL and
+ * user. If nothing is found the configured URL is used as it is, as
+ * it always was, and remembered only when the server's answer was
+ * definite: a multistatus without an address book, or a PROPFIND
+ * forbidden or not allowed. An error that may pass is tried again by
+ * the next lookup.
+ *
+ * \parm[in] ctx The context, with credentials set.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If the server refused the credentials.
+ **/
+int
+discover(struct mcds *ctx)
+{
+	const struct opts *o = ctx->opts;
+
+	if (ctx->dav.url) {
+		return(EXIT_SUCCESS);
+	}
+	if (cache(ctx, 0) == 0) {
+		if (o->verbose) {
+			fprintf(stderr, "Using the cached address book %s\n",
+				ctx->dav.url);
+		}
+		return(EXIT_SUCCESS);
+	}
+
+	if (ask(ctx)) {
+		if (ctx->status == 401) {
+			return(EXIT_FAILURE);
+		}
+		if (o->verbose) {
+			fprintf(stderr, "No address book found, using %s\n",
+				o->url);
+		}
+		ctx->dav.url = strdup(o->url);
+		ctx->dav.caps = 0;
+		if (ctx->status == 207 || ctx->status == 403 ||
+		    ctx->status == 405) {
+			cache(ctx, 1);
+		}
+		return(EXIT_SUCCESS);
+	}
+
+	if (o->verbose) {
+		fprintf(stderr, "Found the address book %s\n", ctx->dav.url);
+	}
+	if (cache(ctx, 1) && o->verbose) {
+		fprintf(stderr, "Unable to cache the address book\n");
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Forget the address book found for the context, in the cache as
+ * well, so the next lookup looks for it again.
+ *
+ * \parm[in] ctx The context.
+ **/
+void
+discover_forget(struct mcds *ctx)
+{
+	free(ctx->dav.url);
+	ctx->dav.url = NULL;
+	ctx->dav.caps = 0;
+	cache(ctx, 1);
+}
+
+/**
+ * \}
+ **/
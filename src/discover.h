@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file discover.h
+ * Internal definitions for finding the address book on a server.
+ *
+ * \ingroup carddav
+ * \{
+ **/
+
+#ifndef MCDS_DISCOVER_H
+#define MCDS_DISCOVER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+
+/** What the server says it supports, bit 0 is unused **/
+enum dav_caps {
+	dav_sync = 1 << 1,		/* The sync-collection report */
+	dav_ascii = 1 << 2		/* Only the i;ascii-casemap collation */
+};
+
+/** The address book found on the server **/
+struct dav {
+	char *url;			/* The collection, NULL until found */
+	int caps;			/* Of enum dav_caps */
+};
+
+/** Find the address book, from the cache or the server */
+int discover(struct mcds *);
+
+/** Forget the address book found, once the server no longer has it */
+void discover_forget(struct mcds *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_DISCOVER_H */
+/**
+ * \}
+ **/
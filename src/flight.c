@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file flight.c
+ * Routines to merge identical queries that are in flight together.
+ *
+ * The first lookup to ask the server a question leads the flight and
+ * sends the REPORT. Lookups asking the same question before it is
+ * answered wait for the leader, then all of them parse the one shared
+ * response, each with its own format and limit. A flight is only kept
+ * while it has lookups, so nothing is cached once it has landed.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "mem.h"
+#include "carddav.h"
+#include "mcds.h"
+#include "flight.h"
+
+/**
+ * Build the key identifying a query: the server, the user the server
+ * answers for, the fields and the term.
+ *
+ * \return A newly allocated key.
+ **/
+static char *
+flight_key(const struct mcds *ctx, const struct mcds_query *q)
+{
+	int len = 0;
+	char *key = NULL;
+	const char *url = ctx->opts->url ? ctx->opts->url : "";
+	const char *user = ctx->opts->username ? ctx->opts->username : "";
+
+	len = strlen(url) + strlen(user) + strlen(q->term) + 32;
+	key = xmalloc(len*sizeof(char));
+	snprintf(key, len, "%s\n%s\n%d\n%d\n%s",
+		 url, user, q->query, q->search, q->term);
+
+	return(key);
+}
+
+/**
+ * Initialise a table of queries in flight.
+ *
+ * \parm[out] fl The table.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+flights_init(struct flights *fl)
+{
+	fl->head = NULL;
+	if (pthread_mutex_init(&fl->lock, NULL) != 0) {
+		warnx(_("Unable to initialize the flight lock."));
+		return(EXIT_FAILURE);
+	}
+	if (pthread_cond_init(&fl->cond, NULL) != 0) {
+		warnx(_("Unable to initialize the flight condition."));
+		pthread_mutex_destroy(&fl->lock);
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Release a table of queries in flight. No lookup may still hold one.
+ *
+ * \parm[in] fl The table.
+ **/
+void
+flights_free(struct flights *fl)
+{
+	pthread_cond_destroy(&fl->cond);
+	pthread_mutex_destroy(&fl->lock);
+}
+
+/**
+ * Query the server for a lookup. If an identical query is already in
+ * flight wait for its response, otherwise lead a new flight. The
+ * response must be let go of with flight_leave(), whatever the result.
+ *
+ * \parm[in] fl   The table of queries in flight.
+ * \parm[in] ctx  The context, with credentials set.
+ * \parm[in] q    The lookup.
+ * \parm[out] fp  The flight, holding the response.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+flight_join(struct flights *fl, struct mcds *ctx, const struct mcds_query *q,
+	    struct flight **fp)
+{
+	char *key = NULL;
+	struct flight *f = NULL;
+	struct flight **pp = NULL;
+
+	key = flight_key(ctx, q);
+
+	pthread_mutex_lock(&fl->lock);
+	for (f = fl->head; f; f = f->next) {
+		if (strcmp(f->key, key) == 0) {
+			break;
+		}
+	}
+
+	if (f != NULL) {
+		/* Follow the leader */
+		free(key);
+		++f->refs;
+		if (ctx->opts->verbose) {
+			fprintf(stderr, "Joining the query in flight for %s\n",
+				q->term);
+		}
+		while (!f->done) {
+			pthread_cond_wait(&fl->cond, &fl->lock);
+		}
+		pthread_mutex_unlock(&fl->lock);
+
+		*fp = f;
+		ctx->status = f->status;
+		return(f->rtn);
+	}
+
+	/* Lead a new flight */
+	f = xmalloc(sizeof(struct flight));
+	memset(f, 0, sizeof(struct flight));
+	f->key = key;
+	f->refs = 1;
+	f->next = fl->head;
+	fl->head = f;
+	pthread_mutex_unlock(&fl->lock);
+
+	f->rtn = query(ctx, q, &f->res);
+	f->status = ctx->status;
+
+	/* Land, later lookups must ask the server again */
+	pthread_mutex_lock(&fl->lock);
+	for (pp = &fl->head; *pp; pp = &(*pp)->next) {
+		if (*pp == f) {
+			*pp = f->next;
+			break;
+		}
+	}
+	f->next = NULL;
+	f->done = 1;
+	pthread_cond_broadcast(&fl->cond);
+	pthread_mutex_unlock(&fl->lock);
+
+	*fp = f;
+	return(f->rtn);
+}
+
+/**
+ * Let go of a query's response, releasing it when no other lookup
+ * holds it.
+ *
+ * \parm[in] fl The table of queries in flight.
+ * \parm[in] f  The flight.
+ **/
+void
+flight_leave(struct flights *fl, struct flight *f)
+{
+	int refs = 0;
+
+	pthread_mutex_lock(&fl->lock);
+	refs = --f->refs;
+	pthread_mutex_unlock(&fl->lock);
+
+	if (refs > 0) {
+		return;
+	}
+	free(f->res);
+	free(f->key);
+	free(f);
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file flight.h
+ * Internal definitions for sharing a query between identical lookups.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifndef MCDS_FLIGHT_H
+#define MCDS_FLIGHT_H
+
+#include <pthread.h>
+#include "options.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+
+/** A query to the server, shared by every lookup asking it **/
+struct flight {
+	struct flight *next;		/* Next query in flight */
+	char *key;			/* Server, user, fields and term */
+	int refs;			/* Lookups holding the flight */
+	int done;			/* Has the query finished */
+	int rtn;			/* Status of the query */
+	long status;			/* HTTP status of the query */
+	char *res;			/* The response */
+};
+
+/** The queries in flight, shared by contexts **/
+struct flights {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct flight *head;
+};
+
+/** Initialise a table of queries in flight */
+int flights_init(struct flights *);
+
+/** Release a table of queries in flight, none may be left */
+void flights_free(struct flights *);
+
+/** Query the server, or join an identical query in flight */
+int flight_join(struct flights *, struct mcds *, const struct mcds_query *,
+		struct flight **);
+
+/** Let go of a query's response */
+void flight_leave(struct flights *, struct flight *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_FLIGHT_H */
+/**
+ * \}
+ **/
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file keyring.c
+ * Routines to cache the decrypted password in the Linux kernel
+ * user keyring, so later runs can skip GPGME or libsecret.
+ *
+ * The password is held in a "user" key described by the username
+ * and URL, and expires after options.keyring_timeout seconds.
+ *
+ * \ingroup secret
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <locale.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "gettext.h"
+#include "defs.h"
+#include "mem.h"
+#include "options.h"
+#include "keyring.h"
+
+#ifdef HAVE_LINUX_KEYCTL_H
+#include <linux/keyctl.h>
+
+/* Key permissions, as in keyutils.h */
+#define KEY_POS_ALL       0x3f000000
+#define KEY_USR_VIEW      0x00010000
+#define KEY_USR_READ      0x00020000
+#define KEY_USR_SEARCH    0x00080000
+
+#define MCDS_KEY_TYPE     "user"
+#define MCDS_KEY_FORMAT   "mcds:%s@%s"
+
+/**
+ * Build the key description from the username and URL.
+ *
+ * \return A newly allocated description.
+ **/
+static char *
+describe(void)
+{
+	int len = 0;
+	char *desc = NULL;
+	const char *user = options.username ? options.username : "";
+
+	len = strlen(MCDS_KEY_FORMAT) + strlen(user) + strlen(options.url);
+	desc = xmalloc(len*sizeof(char));
+	snprintf(desc, len, MCDS_KEY_FORMAT, user, options.url);
+
+	return(desc);
+}
+
+/**
+ * Find the key holding the cached password.
+ *
+ * \return The key serial number, -1 if there is none.
+ **/
+static long
+find(void)
+{
+	long id = -1;
+	char *desc = NULL;
+
+	desc = describe();
+	id = syscall(SYS_keyctl, KEYCTL_SEARCH, KEY_SPEC_USER_KEYRING,
+		     MCDS_KEY_TYPE, desc, 0);
+	free(desc);
+
+	return(id);
+}
+
+/**
+ * Lookup the cached password and save it in the options structure.
+ *
+ * \retval 0 If the password was found.
+ * \retval 1 If there is no cached password.
+ **/
+int
+keyring_lookup(void)
+{
+	long id = 0;
+	long len = 0;
+	long got = 0;
+	char *password = NULL;
+
+	if (options.url == NULL) {
+		return(EXIT_FAILURE);
+	}
+
+	if ((id = find()) < 0) {
+		return(EXIT_FAILURE);
+	}
+
+	/* Size the buffer from the key, it may change under us */
+	len = syscall(SYS_keyctl, KEYCTL_READ, id, NULL, 0);
+	while (len > 0) {
+		password = realloc(password, len + 1);
+		if (password == NULL) {
+			warn(_("Unable to allocate the cached password"));
+			return(EXIT_FAILURE);
+		}
+		got = syscall(SYS_keyctl, KEYCTL_READ, id, password, len);
+		if (got <= len) {
+			break;
+		}
+		len = got;
+	}
+	if (len <= 0 || got < 0) {
+		free(password);
+		return(EXIT_FAILURE);
+	}
+	password[got] = '\0';
+
+	if (options.verbose) {
+		fprintf(stderr, "Using the password cached in key %ld\n", id);
+	}
+	options.password = password;
+	options.cached = 1;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Cache the password from the options structure, replacing any
+ * previously cached one.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+keyring_store(void)
+{
+	long id = 0;
+	char *desc = NULL;
+
+	if (options.url == NULL || options.password == NULL) {
+		return(EXIT_FAILURE);
+	}
+
+	desc = describe();
+	id = syscall(SYS_add_key, MCDS_KEY_TYPE, desc, options.password,
+		     strlen(options.password), KEY_SPEC_USER_KEYRING);
+	free(desc);
+	if (id < 0) {
+		if (options.verbose) {
+			warn(_("Unable to cache the password in the keyring"));
+		}
+		return(EXIT_FAILURE);
+	}
+
+	/* Let the user read it back from a new session, but no one else */
+	syscall(SYS_keyctl, KEYCTL_SETPERM, id,
+		KEY_POS_ALL | KEY_USR_VIEW | KEY_USR_READ | KEY_USR_SEARCH);
+
+	if (options.keyring_timeout > 0) {
+		if (syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id,
+			    (unsigned)options.keyring_timeout) < 0) {
+			warn(_("Unable to set the cached password timeout"));
+			syscall(SYS_keyctl, KEYCTL_INVALIDATE, id);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Drop the cached password, e.g. after the server rejected it.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+keyring_clear(void)
+{
+	long id = 0;
+
+	if (options.url == NULL || (id = find()) < 0) {
+		return(EXIT_FAILURE);
+	}
+	if (syscall(SYS_keyctl, KEYCTL_INVALIDATE, id) < 0) {
+		warn(_("Unable to clear the cached password"));
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
+#endif
+
+/**
+ * \}
+ **/
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file keyring.h
+ * Internal definitions for caching the password in the kernel keyring.
+ *
+ * \ingroup secret
+ * \{
+ **/
+
+#ifndef MCDS_KEYRING_H
+#define MCDS_KEYRING_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Lookup a cached password */
+int keyring_lookup(void);
+
+/** Cache the password */
+int keyring_store(void);
+
+/** Drop the cached password */
+int keyring_clear(void);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_KEYRING_H */
+/**
+ * \}
+ **/
@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file ldif.c
+ * Routines to look up cards in an LDIF export.
+ *
+ * Mail clients and directory servers export address books as LDIF
+ * (RFC2849). Each entry is turned into a small vCard, holding the
+ * fields mcds can search, so it is matched like any other card:
+ *  - cn, or displayName without a cn, as FN.
+ *  - mail and mozillaSecondEmail as EMAIL.
+ *  - telephoneNumber, mobile and homePhone as TEL.
+ *  - postalAddress and homePostalAddress as ADR.
+ * The file is read again only when its modification time or size
+ * changes.
+ *
+ * \ingroup vdir
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "mem.h"
+#include "vcard.h"
+#include "mcds.h"
+#include "ldif.h"
+
+/** LDIF attributes and the vCard property each becomes **/
+static const struct {
+	const char *attr;
+	const char *prop;
+} ldif_map[] = {
+	{"cn",                 "FN"},
+	{"displayName",        "FN"},
+	{"mail",               "EMAIL"},
+	{"mozillaSecondEmail", "EMAIL"},
+	{"telephoneNumber",    "TEL"},
+	{"mobile",             "TEL"},
+	{"homePhone",          "TEL"},
+	{"postalAddress",      "ADR"},
+	{"homePostalAddress",  "ADR"},
+};
+
+/** A growing buffer of cards **/
+struct cbuf {
+	char *buf;
+	size_t used;
+	size_t size;
+};
+
+static void
+cbuf_put(struct cbuf *b, const char *s, size_t n)
+{
+	if (b->used + n > b->size) {
+		b->size = b->size ? 2*b->size : 4096;
+		while (b->used + n > b->size) {
+			b->size *= 2;
+		}
+		b->buf = realloc(b->buf, b->size);
+		if (b->buf == NULL) {
+			err(EXIT_FAILURE, _("Unable to extend the card buffer"));
+		}
+	}
+	memcpy(b->buf + b->used, s, n);
+	b->used += n;
+}
+
+/**
+ * Decode base64 in place, as used by "attr:: value" lines.
+ *
+ * \return The decoded length.
+ **/
+static size_t
+base64(char *s)
+{
+	static const char set[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const char *p = NULL;
+	const char *in = s;
+	char *out = s;
+	unsigned int acc = 0;
+	int bits = 0;
+
+	for (; *in && *in != '='; ++in) {
+		if ((p = strchr(set, *in)) == NULL) {
+			continue;
+		}
+		acc = (acc << 6) | (unsigned int)(p - set);
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			*out++ = (char)((acc >> bits) & 0xff);
+		}
+	}
+	*out = '\0';
+
+	return(out - s);
+}
+
+/**
+ * Append an entry's lines, as a card, when it has a name or an email.
+ *
+ * \parm[in,out] b     The cards.
+ * \parm[in]     line  The entry's unfolded lines.
+ * \parm[in]     n     Number of lines.
+ **/
+static void
+add_entry(struct cbuf *b, char **line, size_t n)
+{
+	static const char begin[] = "BEGIN:VCARD\nVERSION:3.0\n";
+	static const char end[] = "END:VCARD";
+	size_t i = 0;
+	size_t j = 0;
+	size_t len = 0;
+	size_t start = b->used;
+	int have_fn = 0;
+	int useful = 0;
+	char *v = NULL;
+	char *c = NULL;
+
+	cbuf_put(b, begin, sizeof(begin) - 1);
+	for (j = 0; j < sizeof(ldif_map)/sizeof(ldif_map[0]); ++j) {
+		for (i = 0; i < n; ++i) {
+			len = strlen(ldif_map[j].attr);
+			if (strncasecmp(line[i], ldif_map[j].attr, len) != 0 ||
+			    line[i][len] != ':') {
+				continue;
+			}
+			/* The first of cn and displayName is the name */
+			if (strcmp(ldif_map[j].prop, "FN") == 0) {
+				if (have_fn) {
+					continue;
+				}
+				have_fn = 1;
+			}
+			v = line[i] + len + 1;
+			if (*v == ':') {
+				++v;
+				v += strspn(v, " ");
+				base64(v);
+			} else {
+				v += strspn(v, " ");
+			}
+			/* A card line may not hold a newline, and an
+			 * address's lines are separated by "$" */
+			for (c = v; *c; ++c) {
+				if (*c == '\n' || *c == '\r') {
+					*c = ' ';
+				} else if (*c == '$' &&
+					   ldif_map[j].prop[0] == 'A') {
+					*c = ';';
+				}
+			}
+			cbuf_put(b, ldif_map[j].prop,
+				 strlen(ldif_map[j].prop));
+			cbuf_put(b, ":", 1);
+			cbuf_put(b, v, strlen(v));
+			cbuf_put(b, "\n", 1);
+			useful = 1;
+		}
+	}
+	if (!useful) {
+		b->used = start;
+		return;
+	}
+	cbuf_put(b, end, sizeof(end));
+}
+
+/**
+ * Turn LDIF text into cards, each NUL terminated.
+ *
+ * \parm[in,out] text The LDIF, unfolded in place.
+ * \parm[out]    b    The cards.
+ **/
+static void
+convert(char *text, struct cbuf *b)
+{
+	char **line = NULL;
+	size_t n = 0;
+	size_t max = 0;
+	char *p = text;
+	char *r = text;
+	char *w = text;
+	char *nl = NULL;
+
+	/* Unfold: a line starting with a space continues the last */
+	while (*r) {
+		if (r[0] == '\r' && r[1] == '\n' && r[2] == ' ') {
+			r += 3;
+		} else if (r[0] == '\n' && r[1] == ' ') {
+			r += 2;
+		} else {
+			*w++ = *r++;
+		}
+	}
+	*w = '\0';
+
+	/* Entries are separated by empty lines */
+	while (p && *p) {
+		if ((nl = strchr(p, '\n')) != NULL) {
+			*nl = '\0';
+		}
+		if (nl > p && nl[-1] == '\r') {
+			nl[-1] = '\0';
+		}
+		if (p[0] == '\0' || p[0] == '\r') {
+			if (n > 0) {
+				add_entry(b, line, n);
+			}
+			n = 0;
+		} else if (p[0] != '#') {
+			if (n == max) {
+				max = max ? 2*max : 16;
+				line = realloc(line, max*sizeof(char *));
+				if (line == NULL) {
+					err(EXIT_FAILURE,
+					    _("Unable to read the entry"));
+				}
+			}
+			line[n++] = p;
+		}
+		p = nl ? nl + 1 : NULL;
+	}
+	if (n > 0) {
+		add_entry(b, line, n);
+	}
+
+	free(line);
+}
+
+/**
+ * Read the file again if it changed since it was last read.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+refresh(struct ldif *l)
+{
+	int rtn = EXIT_FAILURE;
+	int fd = -1;
+	struct stat st;
+	char *text = NULL;
+	size_t len = 0;
+	ssize_t n = 0;
+	size_t i = 0;
+	size_t max = 0;
+	char **card = NULL;
+	size_t ncards = 0;
+	struct cbuf b = {0};
+
+	pthread_mutex_lock(&l->scan);
+
+	if ((fd = open(l->path, O_RDONLY | O_CLOEXEC)) == -1) {
+		warn(_("Unable to open %s"), l->path);
+		goto rtn;
+	}
+	if (fstat(fd, &st) == -1) {
+		warn(_("Unable to stat %s"), l->path);
+		goto rtn;
+	}
+	if (st.st_size == l->size &&
+	    st.st_mtim.tv_sec == l->mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == l->mtime.tv_nsec) {
+		rtn = EXIT_SUCCESS;
+		goto rtn;
+	}
+
+	text = xmalloc(st.st_size + 1);
+	while ((size_t)st.st_size > len) {
+		n = read(fd, text + len, st.st_size - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			warn(_("Unable to read %s"), l->path);
+			goto rtn;
+		}
+		if (n == 0) {
+			break;
+		}
+		len += n;
+	}
+	text[len] = '\0';
+
+	convert(text, &b);
+	for (i = 0; i < b.used; i += strlen(b.buf + i) + 1) {
+		if (ncards == max) {
+			max = max ? 2*max : 64;
+			card = realloc(card, max*sizeof(char *));
+			if (card == NULL) {
+				err(EXIT_FAILURE, _("Unable to split %s"),
+				    l->path);
+			}
+		}
+		card[ncards++] = b.buf + i;
+	}
+	if (l->verbose) {
+		fprintf(stderr, "Read %zu entries from %s\n", ncards, l->path);
+	}
+
+	pthread_rwlock_wrlock(&l->lock);
+	free(l->data);
+	free(l->card);
+	l->data = b.buf;
+	l->card = card;
+	l->ncards = ncards;
+	l->mtime = st.st_mtim;
+	l->size = st.st_size;
+	pthread_rwlock_unlock(&l->lock);
+	b.buf = NULL;
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	if (fd != -1) {
+		close(fd);
+	}
+	free(text);
+	free(b.buf);
+	pthread_mutex_unlock(&l->scan);
+
+	return(rtn);
+}
+
+/**
+ * Bring the cards up to date then search them for the context's
+ * lookup, stopping early once the ranking heap can no longer be
+ * improved, unless a session is keeping the matched cards.
+ **/
+static int
+ldif_search(const struct source *src, struct mcds *ctx)
+{
+	struct ldif *l = (struct ldif *)src->data;
+	size_t i = 0;
+
+	if (refresh(l)) {
+		return(EXIT_FAILURE);
+	}
+
+	pthread_rwlock_rdlock(&l->lock);
+	for (i = 0; i < l->ncards; ++i) {
+		if (!ctx->session.on && rank_full(&ctx->rank)) {
+			break;
+		}
+		if (search(ctx, l->card[i]) == 0 && ctx->session.on) {
+			session_keep(&ctx->session, l->card[i]);
+		}
+	}
+	pthread_rwlock_unlock(&l->lock);
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Initialise an LDIF address book. Nothing is read until the first
+ * lookup.
+ *
+ * \parm[out] l       The address book.
+ * \parm[in]  path    The LDIF file.
+ * \parm[in]  verbose Report each read.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+ldif_init(struct ldif *l, const char *path, int verbose)
+{
+	memset(l, 0, sizeof(struct ldif));
+
+	if (pthread_mutex_init(&l->scan, NULL) != 0 ||
+	    pthread_rwlock_init(&l->lock, NULL) != 0) {
+		warnx(_("Unable to initialise the LDIF locks."));
+		return(EXIT_FAILURE);
+	}
+	l->path = xmalloc(strlen(path) + 1);
+	strcpy(l->path, path);
+	l->size = -1;
+	l->verbose = verbose;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Release an LDIF address book. No lookup may be using it.
+ *
+ * \parm[in] l The address book.
+ **/
+void
+ldif_free(struct ldif *l)
+{
+	if (l->path == NULL) {
+		return;
+	}
+	free(l->data);
+	free(l->card);
+	free(l->path);
+	pthread_rwlock_destroy(&l->lock);
+	pthread_mutex_destroy(&l->scan);
+	memset(l, 0, sizeof(struct ldif));
+}
+
+/**
+ * Describe an LDIF address book as a source of cards.
+ *
+ * \parm[out] src The source.
+ * \parm[in]  l   The address book, which must outlive the source.
+ **/
+void
+ldif_source(struct source *src, struct ldif *l)
+{
+	src->name = "ldif";
+	src->caps = 0;
+	src->cost = SRC_COST_FILE;
+	src->data = l;
+	src->search = ldif_search;
+}
+
+/**
+ * \}
+ **/
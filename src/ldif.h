@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file ldif.h
+ * Internal definitions for looking up cards in an LDIF export.
+ *
+ * \ingroup vdir
+ * \{
+ **/
+
+#ifndef MCDS_LDIF_H
+#define MCDS_LDIF_H
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+struct source;
+
+/** An LDIF address book, with its entries as cards **/
+struct ldif {
+	pthread_mutex_t scan;		/* Held while rereading */
+	pthread_rwlock_t lock;		/* Guards the cards */
+	char *path;			/* The file */
+	struct timespec mtime;		/* Modification time when read */
+	off_t size;			/* Size when read, -1 before */
+	char *data;			/* The cards, each NUL terminated */
+	char **card;			/* Cards in data */
+	size_t ncards;			/* Number of cards */
+	int verbose;			/* Report each read */
+};
+
+/** Initialise an LDIF address book, nothing is read until a lookup */
+int ldif_init(struct ldif *, const char *, int);
+
+/** Release an LDIF address book */
+void ldif_free(struct ldif *);
+
+/** Describe an LDIF address book as a source of cards */
+void ldif_source(struct source *, struct ldif *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_LDIF_H */
+/**
+ * \}
+ **/
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file lookup.c
+ * Routine to run one lookup, from the query to the written results.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <curl/curl.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "options.h"
+#include "mcds.h"
+#include "lookup.h"
+#include "miss.h"
+
+/**
+ * Search each source in turn, cheapest first, skipping the rest once
+ * the ranking heap can no longer be improved. A source that fails is
+ * reported and the others are still searched. A remote source is not
+ * asked again for a term it recently had no cards for.
+ *
+ * \parm[in]  ctx      The context, with its lookup under way.
+ * \parm[out] complete Set when every source was searched.
+ *
+ * \retval 0 If at least one source was searched.
+ * \retval 1 If no source could be searched.
+ **/
+static int
+search_sources(struct mcds *ctx, int *complete)
+{
+	int i = 0;
+	int ok = 0;
+	size_t matched = 0;
+	const struct source *src = NULL;
+	const struct opts *o = ctx->opts;
+
+	*complete = 1;
+	for (i = 0; i < ctx->nsrc; ++i) {
+		src = ctx->src[i];
+		if (!ctx->session.on && rank_full(&ctx->rank)) {
+			if (ctx->opts->verbose) {
+				fprintf(stderr, "Skipping the %s source\n",
+					src->name);
+			}
+			break;
+		}
+		if ((src->caps & src_remote) && !ctx->q->fuzzy &&
+		    !ctx->q->phonetic && miss_check(o, ctx->q)) {
+			if (o->verbose) {
+				fprintf(stderr, "Skipping the %s source, "
+					"a recent miss\n", src->name);
+			}
+			ok = 1;
+			continue;
+		}
+		matched = ctx->matched;
+		if (src->search(src, ctx)) {
+			warnx(_("Unable to search the %s source."), src->name);
+			*complete = 0;
+			continue;
+		}
+		/* Only an exact lookup finding nothing is a miss */
+		if ((src->caps & src_remote) && !ctx->q->fuzzy &&
+		    !ctx->q->phonetic && ctx->matched == matched) {
+			miss_record(o, ctx->q);
+		}
+		ok = 1;
+	}
+
+	if (ctx->nsrc == 0) {
+		warnx(_("No source of cards to search."));
+	}
+
+	return(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * Search the context's sources for a term and write the results.
+ * In a session a term that extends the last one is answered from the
+ * kept cards.
+ *
+ * \parm[in] ctx A context, with its sources added.
+ * \parm[in] q   The lookup.
+ * \parm[in] fd  The file descriptor to write the results to.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+lookup(struct mcds *ctx, const struct mcds_query *q, int fd)
+{
+	int rtn = EXIT_FAILURE;
+	int complete = 0;
+	const char *freq_file = ctx->opts->freq_file;
+
+	ctx->q = q;
+
+	if (output_open(&ctx->out, q, fd)) {
+		goto rtn;
+	}
+
+	if (q->limit > 0) {
+		if (rank_init(&ctx->rank, q->limit, q->search)) {
+			goto rtn;
+		}
+		if (freq_file && !ctx->rank.loaded &&
+		    rank_frequency(&ctx->rank, freq_file)) {
+			goto rtn;
+		}
+	} else {
+		dedup_init(&ctx->seen, 0);
+	}
+
+	if (match_init(&ctx->m, q, ctx->opts->verbose)) {
+		goto rtn;
+	}
+
+	if (session_covers(&ctx->session, q)) {
+		if (ctx->opts->verbose) {
+			fprintf(stderr, _("Refining %zu kept cards\n"),
+				ctx->session.ncards);
+		}
+		if (session_refine(ctx)) {
+			goto rtn;
+		}
+		complete = 1;
+	} else {
+		if (ctx->session.on) {
+			session_start(&ctx->session, q);
+		}
+		if (search_sources(ctx, &complete)) {
+			goto rtn;
+		}
+	}
+
+	if (q->limit > 0) {
+		if (rank_write(&ctx->rank, &ctx->out)) {
+			goto rtn;
+		}
+	}
+	if (output_close(&ctx->out)) {
+		goto rtn;
+	}
+	/* Cards missing from a failed source must not be refined away */
+	if (ctx->session.on && complete) {
+		session_done(&ctx->session);
+	}
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	if (rtn) {
+		output_abort(&ctx->out);
+	}
+	rank_clear(&ctx->rank);
+	match_free(&ctx->m);
+	ctx->q = NULL;
+
+	return(rtn);
+}
+
+/**
+ * \}
+ **/
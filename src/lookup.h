@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file lookup.h
+ * Internal definitions for running a lookup.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifndef MCDS_LOOKUP_H
+#define MCDS_LOOKUP_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+
+/** Run a lookup and write the results to a file descriptor */
+int lookup(struct mcds *, const struct mcds_query *, int);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_LOOKUP_H */
+/**
+ * \}
+ **/
@@ -50,26 +50,23 @@
 #include "mem.h"
 #include "rc.h"
 #include "curl.h"
-#include "carddav.h"
-#include "xml.h"
+#include "keyring.h"
+#include "lookup.h"
+#include "mcds.h"
+#include "serve.h"
+#include "sources.h"
 
 #if HAVE_LIBSECRET
 #include "secret.h"
 #endif
 
-/* Initalise extern definitions */
-#define X(a, b) b,
-char *sterm_name[] = {			/**< Search term names */
-	STERMS_TABLE
-};
-#undef X
-
 struct opts options = {0};		/**< Program options */
 
 /* Internal functions */
 static void print_usage(void);
 static void print_version(void);
 static int  parse_argv(int, char **, char **);
+static int  interact(struct mcds *, struct mcds_query *);
 static const char *program_name(void);
 
 /**
@@ -86,11 +83,13 @@ main(int argc, char **argv)
 {
 
 	char *file = NULL;	/* config file */
-	char *res = NULL;	/* query result */
-	CURL *hdl = NULL;	/* Curl handle */
+	struct mcds ctx;	/* Query engine context */
+	struct mcds_query q = {0};	/* The lookup */
+	int lfd = -1;		/* Service socket */
+	int rtn = EXIT_SUCCESS;	/* Lookup status */
 
 #ifdef HAVE_PLEDGE
-	if (pledge("stdio rpath inet dns proc exec unveil", NULL) == -1) {
+	if (pledge("stdio rpath wpath cpath flock inet dns unix proc exec prot_exec unveil", NULL) == -1) {
 		err(1, "pledge");
 	}
 #endif
@@ -110,6 +109,38 @@ main(int argc, char **argv)
 	if (read_rc(file)) {
 		return(EXIT_FAILURE);
 	}
+	if (sources_open()) {
+		return(EXIT_FAILURE);
+	}
+
+	/* The service obtains the credentials on the first request */
+	if (options.serve) {
+		if ((lfd = serve_listen()) == -1) {
+			return(EXIT_FAILURE);
+		}
+		rtn = serve(lfd);
+		sources_close();
+		mcds_cleanup();
+		goto done;
+	}
+
+	/* Connect while the credentials are being obtained */
+	if (mcds_init(&ctx, &options) || sources_add(&ctx)) {
+		return(EXIT_FAILURE);
+	}
+	/* Local sources need neither credentials nor a connection */
+	if (sources_remote()) {
+		if (options.preconnect) {
+			cwarm(&ctx);
+		}
+		if (read_credentials()) {
+			mcds_free(&ctx);
+			return(EXIT_FAILURE);
+		}
+		if (cwait(&ctx)) {
+			return(EXIT_FAILURE);
+		}
+	}
 
 #ifdef HAVE_UNVEIL
 	if (unveil(NULL, NULL) == -1) {
@@ -121,31 +152,53 @@ main(int argc, char **argv)
 	if (options.verbose) {
 		fprintf(stderr, "%s options are:\n", program_name());
 		fprintf(stderr, "  URL               : %s\n", options.url);
+		fprintf(stderr, "  vdir              : %s\n", options.vdir);
+		fprintf(stderr, "  LDIF              : %s\n", options.ldif);
 		fprintf(stderr, "  SSL Verify        : %d\n", options.verify);
 		fprintf(stderr, "  Use .netrc        : %d\n", options.netrc);
 		fprintf(stderr, "  Use libsecret     : %d\n", options.libsecret);
+		fprintf(stderr, "  Use keyring       : %d\n", options.keyring);
+		fprintf(stderr, "  Pre-connect       : %d\n", options.preconnect);
 		fprintf(stderr, "  Save password     : %d\n", options.save);
 		fprintf(stderr, "  Password prompted : %d\n", options.pwprompt);
 		fprintf(stderr, "  Username          : %s\n", options.username);
 		fprintf(stderr, "  Password          : %s\n", options.password);
 		fprintf(stderr, "  Query term        : %s\n", options.term);
+		fprintf(stderr, "  Limit             : %d\n", options.limit);
+		fprintf(stderr, "  Typos allowed     : %d\n", options.fuzzy);
+		fprintf(stderr, "  Phonetic          : %d\n", options.phonetic);
+		fprintf(stderr, "  Format            : %d\n", options.format);
 		fprintf(stderr, "  Query             : %s\n",
 				sterm_name[options.query]);
 		fprintf(stderr, "  Search            : %s\n",
 				sterm_name[options.search]);
 	}
 
-	if (cinit(&hdl)) {
+	if (sources_remote() && ccreds(&ctx)) {
 		return(EXIT_FAILURE);
 	}
-	if (query(hdl, &res)) {
-		return(EXIT_FAILURE);
+	q.query  = options.query;
+	q.search = options.search;
+	q.format = options.format;
+	q.limit  = options.limit;
+	q.fuzzy  = options.fuzzy;
+	q.phonetic = options.phonetic;
+	q.term   = options.term;
+	if (options.interactive) {
+		rtn = interact(&ctx, &q);
+	} else {
+		rtn = lookup(&ctx, &q, STDOUT_FILENO);
 	}
-	if (cfini(&hdl)) {
-		return(EXIT_FAILURE);
+#ifdef HAVE_LINUX_KEYCTL_H
+	/* A stale cached password must not be offered again */
+	if (ctx.status == 401 && options.cached) {
+		keyring_clear();
 	}
-
-	if (parse_xml(res)) {
+#endif
+	mcds_free(&ctx);
+	sources_close();
+	mcds_cleanup();
+	if (rtn) {
 		return(EXIT_FAILURE);
 	}
 
@@ -159,6 +212,7 @@ main(int argc, char **argv)
 #endif
 	}
 
+done:
 	if (options.url) {
 		free(options.url);
 		options.url = NULL;
@@ -175,9 +229,21 @@ main(int argc, char **argv)
 		free(options.password);
 		options.password = NULL;
 	}
-	if (res) {
-		free(res);
-		res = NULL;
+	if (options.freq_file) {
+		free(options.freq_file);
+		options.freq_file = NULL;
+	}
+	if (options.socket) {
+		free(options.socket);
+		options.socket = NULL;
+	}
+	if (options.vdir) {
+		free(options.vdir);
+		options.vdir = NULL;
+	}
+	if (options.ldif) {
+		free(options.ldif);
+		options.ldif = NULL;
 	}
 
 	if (file) {
@@ -185,7 +251,53 @@ main(int argc, char **argv)
 		file = NULL;
 	}
 
-	return(EXIT_SUCCESS);
+	return(rtn);
+}
+
+/**
+ * Answer each line read from standard input as a term, until the end
+ * of the input. Each answer ends with an empty record. The context
+ * keeps the cards matched, so a term extending the last one is
+ * answered without asking the server.
+ *
+ * \param[in] ctx The context, with credentials set.
+ * \param[in] q   The lookup, without a term.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If the server refused the credentials.
+ **/
+static int
+interact(struct mcds *ctx, struct mcds_query *q)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len = 0;
+	int rtn = EXIT_SUCCESS;
+
+	ctx->session.on = 1;
+	q->delimit = 1;
+
+	while ((len = getline(&line, &size, stdin)) != -1) {
+		while (len > 0 && (line[len-1] == '\n' ||
+				   line[len-1] == '\r')) {
+			line[--len] = '\0';
+		}
+		q->term = line;
+		lookup(ctx, q, STDOUT_FILENO);
+		/* Every later term would be refused as well */
+		if (ctx->status == 401) {
+			rtn = EXIT_FAILURE;
+			break;
+		}
+	}
+	q->term = NULL;
+
+	if (line) {
+		free(line);
+		line = NULL;
+	}
+
+	return(rtn);
 }
 
 /**
@@ -202,17 +314,23 @@ parse_argv(int argc, char **argv, char **file)
 {
 	int opt = 0;
 	int opt_index = 0;
-	char *soptions = "c:hpq:Ss:u:Vv";        /* short options structure */
+	char *soptions = "c:Df:hil:Ppq:Ss:u:Vvz:";        /* short options structure */
 	static struct option loptions[] = {     /* long options structure */
 		{"config",     required_argument,  NULL,  'c'},
+		{"serve",      no_argument,        NULL,  'D'},
+		{"format",     required_argument,  NULL,  'f'},
 		{"help",       no_argument,        NULL,  'h'},
+		{"interactive", no_argument,       NULL,  'i'},
+		{"limit",      required_argument,  NULL,  'l'},
 		{"password",   no_argument,        NULL,  'p'},
+		{"phonetic",   no_argument,        NULL,  'P'},
 		{"query",      required_argument,  NULL,  'q'},
 		{"save",       no_argument,        NULL,  'S'},
 		{"search",     required_argument,  NULL,  's'},
 		{"url",        required_argument,  NULL,  'u'},
 		{"version",    no_argument,        NULL,  'V'},
 		{"verbose",    no_argument,        NULL,  'v'},
+		{"fuzzy",      required_argument,  NULL,  'z'},
 		{NULL,         1,                  NULL,  0}
 	};
 
@@ -220,6 +338,13 @@ parse_argv(int argc, char **argv, char **file)
 	options.query  = name;
 	options.search = email;
 
+	/* cache passwords in the keyring for ten minutes */
+	options.keyring_timeout = 600;
+	options.miss_ttl = 300;
+
+	/* connect to the server while obtaining the credentials */
+	options.preconnect = 1;
+
 	/* parse the arguments */
 	while ((opt = getopt_long(argc, argv, soptions, loptions,
 				  &opt_index)) != -1) {
@@ -227,12 +352,40 @@ parse_argv(int argc, char **argv, char **file)
 		case 'c':
 			*file = strdup(optarg);
 			break;
+		case 'D':
+			options.serve = 1;
+			break;
+		case 'f':
+			if (optarg[0] == 'm' ||
+			    optarg[0] == 'M' ) {
+				options.format = fmt_mutt;
+			} else if (optarg[0] == 't' ||
+				   optarg[0] == 'T' ) {
+				options.format = fmt_tsv;
+			} else if (optarg[0] == 'j' ||
+				   optarg[0] == 'J' ) {
+				options.format = fmt_json;
+			}
+			break;
 		case 'h':
 			print_usage();
 			break;
+		case 'i':
+			options.interactive = 1;
+			break;
+		case 'l':
+			options.limit = atoi(optarg);
+			if (options.limit < 1) {
+				warnx(_("The limit must be a positive number."));
+				print_usage();
+			}
+			break;
 		case 'p':
 			options.pwprompt = 1;
 			break;
+		case 'P':
+			options.phonetic = 1;
+			break;
 		case 'q':
 			if (optarg[0] == 'a' ||
 			    optarg[0] == 'A' ) {
@@ -279,6 +432,13 @@ parse_argv(int argc, char **argv, char **file)
 		case 'v':
 			options.verbose = 1;
 			break;
+		case 'z':
+			options.fuzzy = atoi(optarg);
+			if (options.fuzzy < 0 || options.fuzzy > 2) {
+				warnx(_("The typos allowed must be 0, 1 or 2."));
+				print_usage();
+			}
+			break;
 		default:
 			print_usage();
 			break;
@@ -287,6 +447,28 @@ parse_argv(int argc, char **argv, char **file)
 	argc -= optind;
 	argv += optind;
 
+	/* The service takes its terms from the clients */
+	if (options.serve) {
+		if (argc != 0) {
+			warnx(_("A term can not be given with --serve."));
+			print_usage();
+		}
+		if (options.interactive) {
+			warnx(_("--interactive can not be used with --serve."));
+			print_usage();
+		}
+		return(EXIT_SUCCESS);
+	}
+
+	/* A session reads its terms from standard input */
+	if (options.interactive) {
+		if (argc != 0) {
+			warnx(_("A term can not be given with --interactive."));
+			print_usage();
+		}
+		return(EXIT_SUCCESS);
+	}
+
 	if (argc != 1) {
 		warnx(_("Must specify a term to query for."));
 		print_usage();
@@ -306,9 +488,17 @@ static void
 print_usage(void)
 {
 	printf(_("\
-usage: %s [-c config] [-h] [-q a|e|n|t] [-s a|e|n|t] [-u URL] [-V] [-v] string\n\
+usage: %s [-c config] [-D] [-f j|m|t] [-h] [-i] [-l N] [-P] [-q a|e|n|t] [-s a|e|n|t] [-u URL] [-V] [-v] [-z N] string\n\
   -c, --config       A configuration file to use.\n\
+  -D, --serve        Answer lookups from mcds-client over a socket.\n\
+  -f, --format j|m|t Output format (default mutt). Known formats are:\n\
+                     j = JSON lines\n\
+                     m = mutt\n\
+                     t = tab separated, NUL terminated records\n\
   -h, --help         Display this help and exit.\n\
+  -i, --interactive  Answer each line of standard input as a string.\n\
+  -l, --limit N      Only print the N best ranked matches.\n\
+  -P, --phonetic     Match names by how they sound.\n\
   -p, --password     Prompt for a password.\n\
   -q, --query  a|e|n|t Query term (default name). Known terms are:\n\
                      a = address\n\
@@ -324,6 +514,7 @@ usage: %s [-c config] [-h] [-q a|e|n|t] [-s a|e|n|t] [-u URL] [-V] [-v] string\n
   -u, --url          The URL of the carddav server to query.\n\
   -V, --version      Display version information and exit.\n\
   -v, --verbose      Verbose mode.\n\
+  -z, --fuzzy N      When nothing matches, allow N typos (1 or 2).\n\
   string             The query string to look for within the query term.\n\
 "), program_name());
 	exit(EXIT_FAILURE);
@@ -344,10 +535,12 @@ This is free software: you are free to change and redistribute it.\n\
 There is NO WARRANTY, to the extent permitted by law.\n\n"), "2019");
 	printf(_("Compiled on %s at %s:\n"
 		 " - %s GPGME support.\n"
-		 " - %s libsecret support.\n\n"),
+		 " - %s libsecret support.\n"
+		 " - %s Zstandard support.\n\n"),
 	       __DATE__, __TIME__,
 	       ngettext("with", "with-out", HAVE_GPGME),
-	       ngettext("with", "with-out", HAVE_LIBSECRET)
+	       ngettext("with", "with-out", HAVE_LIBSECRET),
+	       ngettext("with", "with-out", HAVE_ZSTD)
 	       );
 	exit(EXIT_FAILURE);
 }
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file mcds.c
+ * Routines to create and release query engine contexts.
+ *
+ * curl and libxml2 each have global state that must be set up once,
+ * before any thread uses them, and is only released at exit.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include <libxml/parser.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "curl.h"
+#include "mcds.h"
+
+/* Initalise extern definitions */
+#define X(a, b) b,
+const char *const sterm_name[] = {	/**< Search term names */
+	STERMS_TABLE
+};
+#undef X
+#define X(a, b) #a,
+const char *const sterm_key[] = {	/**< Search term output keys */
+	STERMS_TABLE
+};
+#undef X
+
+/** Global library set up, run once **/
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static CURLcode once_rtn = CURLE_OK;
+
+static void
+global_init(void)
+{
+	once_rtn = curl_global_init(CURL_GLOBAL_DEFAULT);
+	xmlInitParser();
+}
+
+/**
+ * Initialise a context and its curl handle.
+ *
+ * \parm[out] ctx The context.
+ * \parm[in]  o   The configuration, which must outlive the context.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+mcds_init(struct mcds *ctx, const struct opts *o)
+{
+	memset(ctx, 0, sizeof(struct mcds));
+	ctx->opts = o;
+	ctx->out.fd = -1;
+
+	pthread_once(&once, global_init);
+	if (once_rtn != CURLE_OK) {
+		warnx(_("Unable to initialize curl."));
+		return(EXIT_FAILURE);
+	}
+
+	if (cinit(ctx)) {
+		mcds_free(ctx);
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Add a source of cards to a context, keeping the sources ordered by
+ * their cost.
+ *
+ * \parm[in] ctx The context.
+ * \parm[in] src The source, which must outlive the context.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+mcds_source(struct mcds *ctx, const struct source *src)
+{
+	int i = 0;
+
+	if (ctx->nsrc == MCDS_SOURCES) {
+		warnx(_("Too many sources of cards."));
+		return(EXIT_FAILURE);
+	}
+	for (i = ctx->nsrc; i > 0 && ctx->src[i-1]->cost > src->cost; --i) {
+		ctx->src[i] = ctx->src[i-1];
+	}
+	ctx->src[i] = src;
+	ctx->nsrc++;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Release everything held by a context.
+ *
+ * \parm[in] ctx The context.
+ **/
+void
+mcds_free(struct mcds *ctx)
+{
+	cwait(ctx);
+	if (ctx->hdl) {
+		cfini(ctx);
+	}
+	match_free(&ctx->m);
+	rank_free(&ctx->rank);
+	dedup_free(&ctx->seen);
+	output_free(&ctx->out);
+	session_free(&ctx->session);
+	free(ctx->dav.url);
+	ctx->dav.url = NULL;
+}
+
+/**
+ * Release the global state of curl and libxml2.
+ * No context may be used afterwards.
+ **/
+void
+mcds_cleanup(void)
+{
+	curl_global_cleanup();
+	xmlCleanupParser();
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file mcds.h
+ * Definitions for libmcds, the query engine.
+ *
+ * Everything a lookup needs is held in a context. The engine keeps no
+ * other state, so lookups on different contexts may run at the same
+ * time in different threads. A context runs one lookup at a time.
+ * The configuration it is given is only read, and may be shared.
+ * Contexts given the same table of flights send identical concurrent
+ * queries to the server only once. The cards come from the sources
+ * added to the context, which may themselves be shared. A context
+ * with its session on keeps the cards of each lookup, to answer a
+ * longer term without asking the server.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifndef MCDS_MCDS_H
+#define MCDS_MCDS_H
+
+#include <pthread.h>
+#include <curl/curl.h>
+#include "options.h"
+#include "output.h"
+#include "rank.h"
+#include "vcard.h"
+#include "flight.h"
+#include "session.h"
+#include "source.h"
+#include "discover.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Most sources a context searches **/
+#define MCDS_SOURCES 4
+
+/** A query engine context **/
+struct mcds {
+	const struct opts *opts;	/* Configuration and credentials */
+	const struct mcds_query *q;	/* The lookup in progress */
+	CURL *hdl;			/* Curl handle */
+	pthread_t warm;			/* Connection warm up thread */
+	int warming;			/* Is the warm up thread running */
+	long status;			/* HTTP status of the last query */
+	struct flights *flights;	/* Queries shared with other contexts */
+	struct dav dav;			/* The address book on the server */
+	const struct source *src[MCDS_SOURCES];	/* Sources, cheapest first */
+	int nsrc;			/* Number of sources */
+	struct matcher m;		/* Compiled matcher */
+	struct rank rank;		/* Ranking heap */
+	struct dedup seen;		/* Values written, without a limit */
+	size_t matched;			/* Cards matching the lookup so far */
+	struct output out;		/* Output buffer */
+	struct session session;		/* Cards kept between lookups */
+};
+
+/** Initialise a context and its curl handle */
+int mcds_init(struct mcds *, const struct opts *);
+
+/** Add a source of cards to a context */
+int mcds_source(struct mcds *, const struct source *);
+
+/** Release everything held by a context */
+void mcds_free(struct mcds *);
+
+/** Release the libraries' global state, once no context is left */
+void mcds_cleanup(void);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_MCDS_H */
+/**
+ * \}
+ **/
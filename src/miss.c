@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file miss.c
+ * Routines to remember lookups the server had no cards for.
+ *
+ * Many lookups are for senders that are in no address book, and each
+ * would cost a query to the server. A miss is kept for
+ * options.miss_ttl seconds in a small file under the user's cache
+ * directory, shared by every mcds process. The file holds a Bloom
+ * filter, so most lookups that are not misses are told apart with a
+ * few bit tests, backed by a sorted table of exact hashes and expiry
+ * times. A term extending a missed one also misses, so every prefix
+ * of a term is checked.
+ * The misses belong to a server and user, and are forgotten whenever
+ * a sync reports a new token for the collection.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "cache.h"
+#include "mem.h"
+#include "miss.h"
+
+/** Identifies the file format */
+#define MISS_MAGIC   "mcdsmis1"
+
+/** Bytes in the Bloom filter */
+#define MISS_BLOOM   4096
+
+/** Bits set for each miss */
+#define MISS_HASHES  4
+
+/** Most misses kept */
+#define MISS_MAX     8192
+
+/** Header of the misses file **/
+struct miss_hdr {
+	char magic[8];
+	uint64_t scope;			/* Hash of the server and user */
+	uint64_t gen;			/* Hash of the last sync token */
+	uint32_t nent;			/* Number of entries */
+	uint32_t pad;
+};
+
+/** A miss **/
+struct miss_ent {
+	uint64_t hash;			/* Hash of the field and term */
+	int64_t expires;		/* When it is forgotten */
+};
+
+/** The misses file in memory **/
+struct misses {
+	struct miss_hdr hdr;
+	unsigned char bloom[MISS_BLOOM];
+	struct miss_ent *ent;		/* Sorted by hash */
+};
+
+static uint64_t
+fnv(uint64_t h, const void *p, size_t len, int fold)
+{
+	const unsigned char *s = p;
+	size_t i = 0;
+
+	for (i = 0; i < len; ++i) {
+		h ^= fold ? (unsigned char)tolower(s[i]) : s[i];
+		h *= 1099511628211ULL;
+	}
+	return(h);
+}
+
+/**
+ * Hash the server and user the misses belong to.
+ **/
+static uint64_t
+scope(const struct opts *o)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	if (o->url) {
+		h = fnv(h, o->url, strlen(o->url) + 1, 0);
+	}
+	if (o->username) {
+		h = fnv(h, o->username, strlen(o->username) + 1, 0);
+	}
+	return(h);
+}
+
+/**
+ * Hash the field and the first len bytes of the term, lower cased.
+ * The hash is never 0, which stands for no entry.
+ **/
+static uint64_t
+key(enum s_terms query, const char *term, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+	unsigned char f = (unsigned char)query;
+
+	h = fnv(h, &f, 1, 0);
+	return(fnv(h, term, len, 1) | 1);
+}
+
+static void
+bloom_set(unsigned char *bloom, uint64_t h)
+{
+	uint64_t b = 0;
+	int i = 0;
+
+	for (i = 0; i < MISS_HASHES; ++i) {
+		b = ((h >> 32) + i*(h & 0xffffffff)) % (8*MISS_BLOOM);
+		bloom[b/8] |= 1 << (b%8);
+	}
+}
+
+static int
+bloom_test(const unsigned char *bloom, uint64_t h)
+{
+	uint64_t b = 0;
+	int i = 0;
+
+	for (i = 0; i < MISS_HASHES; ++i) {
+		b = ((h >> 32) + i*(h & 0xffffffff)) % (8*MISS_BLOOM);
+		if (!(bloom[b/8] & (1 << (b%8)))) {
+			return(0);
+		}
+	}
+	return(1);
+}
+
+static int
+by_hash(const void *a, const void *b)
+{
+	uint64_t x = ((const struct miss_ent *)a)->hash;
+	uint64_t y = ((const struct miss_ent *)b)->hash;
+
+	return((x > y) - (x < y));
+}
+
+/**
+ * Read the misses file. A missing, foreign or damaged file reads as
+ * holding no misses.
+ **/
+static void
+load(int fd, struct misses *m)
+{
+	struct miss_hdr h;
+	size_t len = 0;
+
+	memset(m, 0, sizeof(struct misses));
+	if (pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+	    memcmp(h.magic, MISS_MAGIC, 8) != 0 || h.nent > MISS_MAX) {
+		return;
+	}
+	if (pread(fd, m->bloom, MISS_BLOOM, sizeof(h)) != MISS_BLOOM) {
+		return;
+	}
+	len = h.nent*sizeof(struct miss_ent);
+	m->ent = xmalloc(len + 1);
+	if (pread(fd, m->ent, len, sizeof(h) + MISS_BLOOM) != (ssize_t)len) {
+		free(m->ent);
+		m->ent = NULL;
+		memset(m->bloom, 0, MISS_BLOOM);
+		return;
+	}
+	m->hdr = h;
+}
+
+/**
+ * Did the server recently have no cards for the lookup, or for a
+ * term the lookup's term extends.
+ *
+ * \parm[in] o The options.
+ * \parm[in] q The lookup.
+ *
+ * \retval 1 If it is a recent miss.
+ * \retval 0 Otherwise.
+ **/
+int
+miss_check(const struct opts *o, const struct mcds_query *q)
+{
+	int hit = 0;
+	int fd = -1;
+	char *path = NULL;
+	size_t len = 0;
+	struct misses m;
+	struct miss_ent k = {0};
+	struct miss_ent *e = NULL;
+	int64_t now = time(NULL);
+
+	if (o->miss_ttl <= 0 || (path = cache_path("misses")) == NULL) {
+		return(0);
+	}
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd == -1) {
+		return(0);
+	}
+	load(fd, &m);
+	close(fd);
+
+	if (m.hdr.nent == 0 || m.hdr.scope != scope(o)) {
+		free(m.ent);
+		return(0);
+	}
+
+	for (len = strlen(q->term); len > 0 && !hit; --len) {
+		k.hash = key(q->query, q->term, len);
+		if (!bloom_test(m.bloom, k.hash)) {
+			continue;
+		}
+		e = bsearch(&k, m.ent, m.hdr.nent, sizeof(struct miss_ent),
+			    by_hash);
+		hit = e && e->expires > now;
+	}
+	free(m.ent);
+
+	return(hit);
+}
+
+/**
+ * Write the misses file again, with the given generation and the live
+ * entries, plus one entry if h is not 0. The file is replaced whole.
+ **/
+static void
+store(const struct opts *o, uint64_t gen, uint64_t h)
+{
+	int fd = -1;
+	int tfd = -1;
+	char *path = NULL;
+	char *tmp = NULL;
+	size_t len = 0;
+	size_t i = 0;
+	size_t n = 0;
+	struct stat fst;
+	struct stat pst;
+	struct misses m;
+	struct miss_ent *e = NULL;
+	int64_t now = time(NULL);
+
+	if ((path = cache_path("misses")) == NULL) {
+		return;
+	}
+
+	cache_dirs(path);
+
+	/* A writer that replaced the file while we waited left it unlocked */
+	for (;;) {
+		fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (fd == -1) {
+			if (o->verbose) {
+				warn(_("Unable to open %s"), path);
+			}
+			free(path);
+			return;
+		}
+		flock(fd, LOCK_EX);
+		if (fstat(fd, &fst) == -1 || stat(path, &pst) == -1 ||
+		    (fst.st_dev == pst.st_dev && fst.st_ino == pst.st_ino)) {
+			break;
+		}
+		close(fd);
+	}
+	load(fd, &m);
+	if (m.hdr.scope != scope(o)) {
+		m.hdr.nent = 0;
+	}
+	if (gen && m.hdr.gen && gen != m.hdr.gen) {
+		m.hdr.nent = 0;
+	}
+	if (gen == 0) {
+		gen = m.hdr.gen;
+	}
+
+	/* Keep the live entries, dropping those expiring first if full */
+	e = xmalloc((m.hdr.nent + 1)*sizeof(struct miss_ent));
+	for (i = 0; i < m.hdr.nent; ++i) {
+		if (m.ent[i].expires > now && m.ent[i].hash != h) {
+			e[n++] = m.ent[i];
+		}
+	}
+	if (h) {
+		e[n].hash = h;
+		e[n].expires = now + o->miss_ttl;
+		n++;
+	}
+	while (n > MISS_MAX) {
+		for (i = 1, len = 0; i < n; ++i) {
+			if (e[i].expires < e[len].expires) {
+				len = i;
+			}
+		}
+		e[len] = e[--n];
+	}
+	qsort(e, n, sizeof(struct miss_ent), by_hash);
+
+	memset(&m.hdr, 0, sizeof(m.hdr));
+	memcpy(m.hdr.magic, MISS_MAGIC, 8);
+	m.hdr.scope = scope(o);
+	m.hdr.gen = gen;
+	m.hdr.nent = n;
+	memset(m.bloom, 0, MISS_BLOOM);
+	for (i = 0; i < n; ++i) {
+		bloom_set(m.bloom, e[i].hash);
+	}
+
+	/* Readers see the old file or the new one, never a mix */
+	len = strlen(path) + sizeof(".XXXXXX");
+	tmp = xmalloc(len);
+	snprintf(tmp, len, "%s.XXXXXX", path);
+	if ((tfd = mkstemp(tmp)) != -1) {
+		if (write(tfd, &m.hdr, sizeof(m.hdr)) == sizeof(m.hdr) &&
+		    write(tfd, m.bloom, MISS_BLOOM) == MISS_BLOOM &&
+		    write(tfd, e, n*sizeof(struct miss_ent)) ==
+		    (ssize_t)(n*sizeof(struct miss_ent)) &&
+		    rename(tmp, path) == 0) {
+			tmp[0] = '\0';
+		}
+		close(tfd);
+		if (tmp[0]) {
+			unlink(tmp);
+		}
+	}
+
+	close(fd);
+	free(tmp);
+	free(e);
+	free(m.ent);
+	free(path);
+}
+
+/**
+ * Remember that the server had no cards for the lookup.
+ *
+ * \parm[in] o The options.
+ * \parm[in] q The lookup.
+ **/
+void
+miss_record(const struct opts *o, const struct mcds_query *q)
+{
+	if (o->miss_ttl <= 0) {
+		return;
+	}
+	store(o, 0, key(q->query, q->term, strlen(q->term)));
+}
+
+/**
+ * Forget every miss if the collection's sync token changed since the
+ * last one seen.
+ *
+ * \parm[in] o     The options.
+ * \parm[in] token The collection's sync token.
+ **/
+void
+miss_sync(const struct opts *o, const char *token)
+{
+	uint64_t gen = 14695981039346656037ULL;
+
+	if (o->miss_ttl <= 0) {
+		return;
+	}
+	store(o, fnv(gen, token, strlen(token), 0) | 1, 0);
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file miss.h
+ * Internal definitions for remembering lookups the server had no
+ * cards for.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifndef MCDS_MISS_H
+#define MCDS_MISS_H
+
+#include "options.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Did the server recently have no cards for the lookup */
+int miss_check(const struct opts *, const struct mcds_query *);
+
+/** Remember that the server had no cards for the lookup */
+void miss_record(const struct opts *, const struct mcds_query *);
+
+/** Forget the misses once the collection's sync token changes */
+void miss_sync(const struct opts *, const char *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_MISS_H */
+/**
+ * \}
+ **/
@@ -41,9 +41,29 @@ extern "C"
 #define X(a, b) a,
 enum s_terms {
 	STERMS_TABLE
+	nterms
 };
 #undef X
 
+/** Output formats **/
+enum o_format {
+	fmt_mutt = 0,
+	fmt_tsv,
+	fmt_json
+};
+
+/** A lookup, what to query for and how to write the results **/
+struct mcds_query {
+	enum s_terms query;
+	enum s_terms search;
+	enum o_format format;
+	int limit;
+	int fuzzy;		/* Typos allowed when nothing matched */
+	int phonetic;		/* Match names by how they sound */
+	int delimit;		/* End the results with an empty record */
+	const char *term;
+};
+
 /** Program command line options **/
 struct opts {
 	int verbose;
@@ -52,17 +72,35 @@ struct opts {
 	int pwprompt;
 	int libsecret;
 	int save;
+	int keyring;
+	int keyring_timeout;
+	int cached;
+	int preconnect;
+	int limit;
+	int fuzzy;
+	int phonetic;
+	int serve;
+	int interactive;
+	int idle_timeout;
+	int miss_ttl;
+	int sync;
+	enum o_format format;
 	enum s_terms query;
 	enum s_terms search;
 	char *url;
 	char *term;
 	char *username;
 	char *password;
+	char *freq_file;
+	char *socket;
+	char *vdir;
+	char *ldif;
 };
 
 /** Extern declarations **/
 extern struct opts options;
-extern char *sterm_name[];
+extern const char *const sterm_name[];
+extern const char *const sterm_key[];
 
 #ifdef __cplusplus
 }                               /* extern "C" */
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file output.c
+ * Routines to format and write the search results.
+ *
+ * Results are formatted into a buffer, kept by the context across
+ * lookups, which is only written out, with a single writev(2), when it
+ * fills or the output is closed.
+ * The supported formats are:
+ *  - mutt: a blank first line then "value<TAB>name" lines.
+ *  - tsv:  the search field then the query field separated by a tab,
+ *          each record terminated by a NUL. A field the card lacks is
+ *          empty, and a tab within a value is written as a space.
+ *  - json: one JSON object per line, keyed by field.
+ *
+ * A delimited lookup, as answered in an interactive session, ends with
+ * an empty record instead: an empty line, or a lone NUL for tsv. It has
+ * no mutt status line.
+ *
+ * \ingroup output
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "options.h"
+#include "mem.h"
+#include "output.h"
+
+/** Initial size of the output buffer **/
+#define OBUF_SIZE  65536
+
+/**
+ * Make sure there is space for n more bytes in the buffer, flushing
+ * it first if needed. A record larger than the whole buffer grows it.
+ **/
+static int
+reserve(struct output *o, size_t n)
+{
+	if (o->used + n <= o->size) {
+		return(EXIT_SUCCESS);
+	}
+	if (output_flush(o)) {
+		return(EXIT_FAILURE);
+	}
+	if (n > o->size) {
+		o->buf = realloc(o->buf, n);
+		if (o->buf == NULL) {
+			err(EXIT_FAILURE, _("Unable to extend the output buffer"));
+		}
+		o->size = n;
+	}
+	return(EXIT_SUCCESS);
+}
+
+static void
+put(struct output *o, const char *s, size_t n)
+{
+	memcpy(o->buf + o->used, s, n);
+	o->used += n;
+}
+
+/**
+ * Append a TSV value, which may be missing, with its tabs made spaces
+ * so it stays one field.
+ **/
+static void
+put_tsv(struct output *o, const char *s, size_t n)
+{
+	size_t i = 0;
+
+	for (i = 0; s && i < n; ++i) {
+		o->buf[o->used++] = s[i] == '\t' ? ' ' : s[i];
+	}
+}
+
+/**
+ * Append a JSON string, escaping as needed. The caller reserves
+ * the worst case of six bytes per input byte plus the quotes.
+ **/
+static void
+put_json(struct output *o, const char *s, size_t n)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i = 0;
+	unsigned char c = 0;
+	char *buf = o->buf;
+	size_t used = o->used;
+
+	buf[used++] = '"';
+	for (i = 0; i < n; ++i) {
+		c = (unsigned char)s[i];
+		if (c == '"' || c == '\\') {
+			buf[used++] = '\\';
+			buf[used++] = c;
+		} else if (c < 0x20) {
+			memcpy(buf + used, "\\u00", 4);
+			used += 4;
+			buf[used++] = hex[c >> 4];
+			buf[used++] = hex[c & 0xf];
+		} else {
+			buf[used++] = c;
+		}
+	}
+	buf[used++] = '"';
+	o->used = used;
+}
+
+/**
+ * Start writing results.
+ *
+ * \parm[in] o  The output state.
+ * \parm[in] q  The lookup, giving the format and fields.
+ * \parm[in] fd The file descriptor to write to.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+output_open(struct output *o, const struct mcds_query *q, int fd)
+{
+	if (o->buf == NULL) {
+		o->size = OBUF_SIZE;
+		o->buf = xmalloc(o->size);
+	}
+	o->used = 0;
+	o->fd = fd;
+	o->q = q;
+
+	/* Mutt shows the first line as a status message */
+	if (q->format == fmt_mutt && !q->delimit) {
+		put(o, "\n", 1);
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Format a result into the output buffer.
+ *
+ * \parm[in] o The output state.
+ * \parm[in] r The result.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+output_record(struct output *o, const struct result *r)
+{
+	int i = 0;
+	int first = 1;
+	size_t n = 0;
+	enum s_terms s = 0;
+	enum s_terms q = 0;
+
+	if (o->q == NULL) {
+		warnx(_("Output has not been opened."));
+		return(EXIT_FAILURE);
+	}
+	s = o->q->search;
+	q = o->q->query;
+
+	/* Worst case size of the formatted record */
+	for (i = 0; i < nterms; ++i) {
+		if (r->val[i]) {
+			n += strlen(sterm_key[i]) + 6*r->len[i] + 8;
+		}
+	}
+	if (reserve(o, n + 4)) {
+		return(EXIT_FAILURE);
+	}
+
+	switch (o->q->format) {
+	case fmt_mutt:
+		put(o, r->val[s], r->len[s]);
+		put(o, "\t", 1);
+		put(o, r->val[q], r->len[q]);
+		put(o, "\n", 1);
+		break;
+	case fmt_tsv:
+		/* Every record has the same fields, in the same order */
+		put_tsv(o, r->val[s], r->len[s]);
+		if (q != s) {
+			put(o, "\t", 1);
+			put_tsv(o, r->val[q], r->len[q]);
+		}
+		put(o, "\0", 1);
+		break;
+	case fmt_json:
+		put(o, "{", 1);
+		for (i = 0; i < nterms; ++i) {
+			if (r->val[i] == NULL) {
+				continue;
+			}
+			if (!first) {
+				put(o, ",", 1);
+			}
+			first = 0;
+			put_json(o, sterm_key[i], strlen(sterm_key[i]));
+			put(o, ":", 1);
+			put_json(o, r->val[i], r->len[i]);
+		}
+		put(o, "}\n", 2);
+		break;
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Write out everything held in the buffer.
+ *
+ * \parm[in] o The output state.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+output_flush(struct output *o)
+{
+	ssize_t n = 0;
+	struct iovec iov = {0};
+
+	iov.iov_base = o->buf;
+	iov.iov_len = o->used;
+	while (iov.iov_len > 0) {
+		n = writev(o->fd, &iov, 1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			warn(_("Unable to write the results"));
+			o->used = 0;
+			return(EXIT_FAILURE);
+		}
+		iov.iov_base = (char *)iov.iov_base + n;
+		iov.iov_len -= n;
+	}
+	o->used = 0;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Append the empty record that ends the results of a delimited lookup.
+ **/
+static int
+put_delimiter(struct output *o)
+{
+	if (reserve(o, 1)) {
+		return(EXIT_FAILURE);
+	}
+	if (o->q->format == fmt_tsv) {
+		put(o, "\0", 1);
+	} else {
+		put(o, "\n", 1);
+	}
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Finish writing results, flushing anything still buffered.
+ * The buffer is kept for the next lookup.
+ *
+ * \parm[in] o The output state.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+output_close(struct output *o)
+{
+	int rtn = EXIT_SUCCESS;
+
+	if (o->q == NULL) {
+		return(EXIT_SUCCESS);
+	}
+	if (o->q->delimit && put_delimiter(o)) {
+		o->q = NULL;
+		return(EXIT_FAILURE);
+	}
+	rtn = output_flush(o);
+	o->q = NULL;
+
+	return(rtn);
+}
+
+/**
+ * Give up on writing the results of a failed lookup. Whatever is still
+ * buffered is dropped, but a delimited lookup is still ended, so the
+ * reader is not left waiting for it.
+ *
+ * \parm[in] o The output state.
+ **/
+void
+output_abort(struct output *o)
+{
+	if (o->q == NULL) {
+		return;
+	}
+	o->used = 0;
+	if (o->q->delimit && put_delimiter(o) == EXIT_SUCCESS) {
+		output_flush(o);
+	}
+	o->q = NULL;
+}
+
+/**
+ * Release the output buffer.
+ *
+ * \parm[in] o The output state.
+ **/
+void
+output_free(struct output *o)
+{
+	free(o->buf);
+	o->buf = NULL;
+	o->size = 0;
+	o->used = 0;
+	o->q = NULL;
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file output.h
+ * Internal definitions for writing the search results.
+ *
+ * \ingroup output
+ * \{
+ **/
+
+#ifndef MCDS_OUTPUT_H
+#define MCDS_OUTPUT_H
+
+#include "options.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** A search result, holding a value for each requested field.
+ * Fields that were not requested are NULL. **/
+struct result {
+	const char *val[nterms];
+	size_t len[nterms];
+};
+
+/** The output state of a lookup **/
+struct output {
+	char *buf;			/* Output buffer */
+	size_t size;			/* Allocated size of the buffer */
+	size_t used;			/* Bytes held in the buffer */
+	int fd;				/* File descriptor to write to */
+	const struct mcds_query *q;	/* The lookup being written */
+};
+
+/** Start writing the results of a lookup to a file descriptor */
+int output_open(struct output *, const struct mcds_query *, int);
+
+/** Write a result */
+int output_record(struct output *, const struct result *);
+
+/** Write out the buffered results */
+int output_flush(struct output *);
+
+/** Finish writing results */
+int output_close(struct output *);
+
+/** Drop the results of a failed lookup */
+void output_abort(struct output *);
+
+/** Release the output buffer */
+void output_free(struct output *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_OUTPUT_H */
+/**
+ * \}
+ **/
@@ -0,0 +1,679 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/**
+ * \file phonetic.c
+ * Routines to find how a name sounds, by Lawrence Philips' Double
+ * Metaphone.
+ *
+ * A word is reduced to a primary code of up to four letters, and an
+ * alternate code where a name of another origin would be said
+ * otherwise, so "Jon" and "John" are both JN and "Smyth" and "Smith"
+ * are SM0 and XMT. 0 stands for "th", X for "sh" and "ch". Each code is
+ * packed into the four bytes of an integer, so codes are compared and
+ * indexed as numbers.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include "defs.h"
+#include "phonetic.h"
+
+/** Longest word looked at */
+#define PHONETIC_WORD 64
+
+/** A word being coded **/
+struct dm {
+	char w[PHONETIC_WORD + 6];	/* Upper cased, padded with blanks */
+	int len;			/* Its length, without the padding */
+	int last;			/* Its last letter */
+	int slavo;			/* Is it Slavic or Germanic */
+	char code[2][PHONETIC_MAX + 8];	/* Primary and alternate codes */
+	int clen[2];
+};
+
+static char
+at(const struct dm *d, int i)
+{
+	if (i < 0 || i >= d->len + 5) {
+		return('\0');
+	}
+	return(d->w[i]);
+}
+
+static int
+vowel(const struct dm *d, int i)
+{
+	if (i < 0 || i >= d->len) {
+		return(0);
+	}
+	return(strchr("AEIOUY", d->w[i]) != NULL);
+}
+
+/**
+ * Does the word hold one of the strings, all of length n, at i. The
+ * list is ended by NULL.
+ **/
+static int
+is(const struct dm *d, int i, int n, ...)
+{
+	int rtn = 0;
+	const char *s = NULL;
+	va_list ap;
+
+	if (i < 0 || i + n > d->len + 5) {
+		return(0);
+	}
+	va_start(ap, n);
+	while ((s = va_arg(ap, const char *)) != NULL) {
+		if (strncmp(d->w + i, s, n) == 0) {
+			rtn = 1;
+			break;
+		}
+	}
+	va_end(ap);
+
+	return(rtn);
+}
+
+/**
+ * Add to the primary code, and to the alternate, which may differ.
+ **/
+static void
+add(struct dm *d, const char *p, const char *a)
+{
+	int k = 0;
+	const char *s = NULL;
+
+	for (k = 0; k < 2; ++k) {
+		for (s = k ? a : p; *s && d->clen[k] < PHONETIC_MAX + 4; ++s) {
+			d->code[k][d->clen[k]++] = *s;
+		}
+	}
+}
+
+/**
+ * The letter C.
+ *
+ * \return The letters it takes.
+ **/
+static int
+letter_c(struct dm *d, int i)
+{
+	/* Germanic, as in "bacher", "macher" */
+	if (i > 1 && !vowel(d, i - 2) && is(d, i - 1, 3, "ACH", NULL) &&
+	    at(d, i + 2) != 'I' && (at(d, i + 2) != 'E' ||
+	    is(d, i - 2, 6, "BACHER", "MACHER", NULL))) {
+		add(d, "K", "K");
+		return(2);
+	}
+	if (i == 0 && is(d, i, 6, "CAESAR", NULL)) {
+		add(d, "S", "S");
+		return(2);
+	}
+	if (is(d, i, 4, "CHIA", NULL)) {
+		add(d, "K", "K");
+		return(2);
+	}
+	if (is(d, i, 2, "CH", NULL)) {
+		if (i > 0 && is(d, i, 4, "CHAE", NULL)) {
+			add(d, "K", "X");
+			return(2);
+		}
+		/* Greek roots, as in "chemistry", "chorus" */
+		if (i == 0 && (is(d, i + 1, 5, "HARAC", "HARIS", NULL) ||
+		    is(d, i + 1, 3, "HOR", "HYM", "HIA", "HEM", NULL)) &&
+		    !is(d, 0, 5, "CHORE", NULL)) {
+			add(d, "K", "K");
+			return(2);
+		}
+		if (is(d, 0, 4, "VAN ", "VON ", NULL) ||
+		    is(d, 0, 3, "SCH", NULL) ||
+		    is(d, i - 2, 6, "ORCHES", "ARCHIT", "ORCHID", NULL) ||
+		    is(d, i + 2, 1, "T", "S", NULL) ||
+		    ((is(d, i - 1, 1, "A", "O", "U", "E", NULL) || i == 0) &&
+		     is(d, i + 2, 1, "L", "R", "N", "M", "B", "H", "F", "V",
+			"W", " ", NULL))) {
+			add(d, "K", "K");
+		} else if (i > 0) {
+			if (is(d, 0, 2, "MC", NULL)) {
+				add(d, "K", "K");
+			} else {
+				add(d, "X", "K");
+			}
+		} else {
+			add(d, "X", "X");
+		}
+		return(2);
+	}
+	if (is(d, i, 2, "CZ", NULL) && !is(d, i - 2, 4, "WICZ", NULL)) {
+		add(d, "S", "X");
+		return(2);
+	}
+	if (is(d, i + 1, 3, "CIA", NULL)) {
+		add(d, "X", "X");
+		return(3);
+	}
+	/* A double C, but not as in "McClellan" */
+	if (is(d, i, 2, "CC", NULL) && !(i == 1 && at(d, 0) == 'M')) {
+		if (is(d, i + 2, 1, "I", "E", "H", NULL) &&
+		    !is(d, i + 2, 2, "HU", NULL)) {
+			if ((i == 1 && at(d, i - 1) == 'A') ||
+			    is(d, i - 1, 5, "UCCEE", "UCCES", NULL)) {
+				add(d, "KS", "KS");
+			} else {
+				add(d, "X", "X");
+			}
+			return(3);
+		}
+		add(d, "K", "K");
+		return(2);
+	}
+	if (is(d, i, 2, "CK", "CG", "CQ", NULL)) {
+		add(d, "K", "K");
+		return(2);
+	}
+	if (is(d, i, 2, "CI", "CE", "CY", NULL)) {
+		if (is(d, i, 3, "CIO", "CIE", "CIA", NULL)) {
+			add(d, "S", "X");
+		} else {
+			add(d, "S", "S");
+		}
+		return(2);
+	}
+	add(d, "K", "K");
+	if (is(d, i + 1, 2, " C", " Q", " G", NULL)) {
+		return(3);
+	}
+	if (is(d, i + 1, 1, "C", "K", "Q", NULL) &&
+	    !is(d, i + 1, 2, "CE", "CI", NULL)) {
+		return(2);
+	}
+	return(1);
+}
+
+/**
+ * The letter G.
+ *
+ * \return The letters it takes.
+ **/
+static int
+letter_g(struct dm *d, int i)
+{
+	if (at(d, i + 1) == 'H') {
+		if (i > 0 && !vowel(d, i - 1)) {
+			add(d, "K", "K");
+			return(2);
+		}
+		if (i == 0) {
+			if (at(d, i + 2) == 'I') {
+				add(d, "J", "J");
+			} else {
+				add(d, "K", "K");
+			}
+			return(2);
+		}
+		/* Parker's rule, as in "hugh", "bough", "broughton" */
+		if ((i > 1 && is(d, i - 2, 1, "B", "H", "D", NULL)) ||
+		    (i > 2 && is(d, i - 3, 1, "B", "H", "D", NULL)) ||
+		    (i > 3 && is(d, i - 4, 1, "B", "H", NULL))) {
+			return(2);
+		}
+		/* As in "laugh", "McLaughlin", "cough", "rough" */
+		if (i > 2 && at(d, i - 1) == 'U' &&
+		    is(d, i - 3, 1, "C", "G", "L", "R", "T", NULL)) {
+			add(d, "F", "F");
+		} else if (i > 0 && at(d, i - 1) != 'I') {
+			add(d, "K", "K");
+		}
+		return(2);
+	}
+	if (at(d, i + 1) == 'N') {
+		if (i == 1 && vowel(d, 0) && !d->slavo) {
+			add(d, "KN", "N");
+		} else if (!is(d, i + 2, 2, "EY", NULL) &&
+			   at(d, i + 1) != 'Y' && !d->slavo) {
+			add(d, "N", "KN");
+		} else {
+			add(d, "KN", "KN");
+		}
+		return(2);
+	}
+	if (is(d, i + 1, 2, "LI", NULL) && !d->slavo) {
+		add(d, "KL", "L");
+		return(2);
+	}
+	if (i == 0 && (at(d, i + 1) == 'Y' ||
+	    is(d, i + 1, 2, "ES", "EP", "EB", "EL", "EY", "IB", "IL", "IN",
+	       "IE", "EI", "ER", NULL))) {
+		add(d, "K", "J");
+		return(2);
+	}
+	if ((is(d, i + 1, 2, "ER", NULL) || at(d, i + 1) == 'Y') &&
+	    !is(d, 0, 6, "DANGER", "RANGER", "MANGER", NULL) &&
+	    !is(d, i - 1, 1, "E", "I", NULL) &&
+	    !is(d, i - 1, 3, "RGY", "OGY", NULL)) {
+		add(d, "K", "J");
+		return(2);
+	}
+	/* Italian, as in "biaggi" */
+	if (is(d, i + 1, 1, "E", "I", "Y", NULL) ||
+	    is(d, i - 1, 4, "AGGI", "OGGI", NULL)) {
+		if (is(d, 0, 4, "VAN ", "VON ", NULL) ||
+		    is(d, 0, 3, "SCH", NULL) || is(d, i + 1, 2, "ET", NULL)) {
+			add(d, "K", "K");
+		} else if (is(d, i + 1, 4, "IER ", NULL)) {
+			add(d, "J", "J");
+		} else {
+			add(d, "J", "K");
+		}
+		return(2);
+	}
+	add(d, "K", "K");
+	return(at(d, i + 1) == 'G' ? 2 : 1);
+}
+
+/**
+ * The letter J.
+ *
+ * \return The letters it takes.
+ **/
+static int
+letter_j(struct dm *d, int i)
+{
+	/* Spanish, as in "Jose", "San Jacinto" */
+	if (is(d, i, 4, "JOSE", NULL) || is(d, 0, 4, "SAN ", NULL)) {
+		if ((i == 0 && at(d, i + 4) == ' ') ||
+		    is(d, 0, 4, "SAN ", NULL)) {
+			add(d, "H", "H");
+		} else {
+			add(d, "J", "H");
+		}
+		return(1);
+	}
+	if (i == 0) {
+		add(d, "J", "A");
+	} else if (vowel(d, i - 1) && !d->slavo &&
+		   (at(d, i + 1) == 'A' || at(d, i + 1) == 'O')) {
+		add(d, "J", "H");
+	} else if (i == d->last) {
+		add(d, "J", "");
+	} else if (!is(d, i + 1, 1, "L", "T", "K", "S", "N", "M", "B", "Z",
+		       NULL) && !is(d, i - 1, 1, "S", "K", "L", NULL)) {
+		add(d, "J", "J");
+	}
+	return(at(d, i + 1) == 'J' ? 2 : 1);
+}
+
+/**
+ * The letter S.
+ *
+ * \return The letters it takes.
+ **/
+static int
+letter_s(struct dm *d, int i)
+{
+	/* As in "island", "carlisle" */
+	if (is(d, i - 1, 3, "ISL", "YSL", NULL)) {
+		return(1);
+	}
+	if (i == 0 && is(d, i, 5, "SUGAR", NULL)) {
+		add(d, "X", "S");
+		return(1);
+	}
+	if (is(d, i, 2, "SH", NULL)) {
+		if (is(d, i + 1, 4, "HEIM", "HOEK", "HOLM", "HOLZ", NULL)) {
+			add(d, "S", "S");
+		} else {
+			add(d, "X", "X");
+		}
+		return(2);
+	}
+	/* Italian and Armenian */
+	if (is(d, i, 3, "SIO", "SIA", NULL) || is(d, i, 4, "SIAN", NULL)) {
+		if (!d->slavo) {
+			add(d, "S", "X");
+		} else {
+			add(d, "S", "S");
+		}
+		return(3);
+	}
+	/* As in "Smith" for "Schmidt", "Snider" for "Schneider" */
+	if ((i == 0 && is(d, i + 1, 1, "M", "N", "L", "W", NULL)) ||
+	    is(d, i + 1, 1, "Z", NULL)) {
+		add(d, "S", "X");
+		return(is(d, i + 1, 1, "Z", NULL) ? 2 : 1);
+	}
+	if (is(d, i, 2, "SC", NULL)) {
+		/* Schlesinger's rule */
+		if (at(d, i + 2) == 'H') {
+			if (is(d, i + 3, 2, "OO", "ER", "EN", "UY", "ED", "EM",
+			       NULL)) {
+				if (is(d, i + 3, 2, "ER", "EN", NULL)) {
+					add(d, "X", "SK");
+				} else {
+					add(d, "SK", "SK");
+				}
+			} else if (i == 0 && !vowel(d, 3) && at(d, 3) != 'W') {
+				add(d, "X", "S");
+			} else {
+				add(d, "X", "X");
+			}
+			return(3);
+		}
+		if (is(d, i + 2, 1, "I", "E", "Y", NULL)) {
+			add(d, "S", "S");
+		} else {
+			add(d, "SK", "SK");
+		}
+		return(3);
+	}
+	/* French, as in "Resnais", "Artois" */
+	if (i == d->last && is(d, i - 2, 2, "AI", "OI", NULL)) {
+		add(d, "", "S");
+	} else {
+		add(d, "S", "S");
+	}
+	return(is(d, i + 1, 1, "S", "Z", NULL) ? 2 : 1);
+}
+
+/**
+ * The letter W.
+ *
+ * \return The letters it takes.
+ **/
+static int
+letter_w(struct dm *d, int i)
+{
+	if (is(d, i, 2, "WR", NULL)) {
+		add(d, "R", "R");
+		return(2);
+	}
+	if (i == 0 && (vowel(d, i + 1) || is(d, i, 2, "WH", NULL))) {
+		/* "Wasserman" as "Vasserman", "Uomo" as "Womo" */
+		if (vowel(d, i + 1)) {
+			add(d, "A", "F");
+		} else {
+			add(d, "A", "A");
+		}
+	}
+	/* "Arnow" as "Arnoff" */
+	if ((i == d->last && vowel(d, i - 1)) ||
+	    is(d, i - 1, 5, "EWSKI", "EWSKY", "OWSKI", "OWSKY", NULL) ||
+	    is(d, 0, 3, "SCH", NULL)) {
+		add(d, "", "F");
+		return(1);
+	}
+	/* Polish, as in "Filipowicz" */
+	if (is(d, i, 4, "WICZ", "WITZ", NULL)) {
+		add(d, "TS", "FX");
+		return(4);
+	}
+	return(1);
+}
+
+/**
+ * Pack a code into an integer.
+ **/
+static uint32_t
+pack(const char *code, int len)
+{
+	int i = 0;
+	uint32_t c = 0;
+
+	for (i = 0; i < PHONETIC_MAX; ++i) {
+		c = c << 8 | (i < len ? (unsigned char)code[i] : 0);
+	}
+	return(c);
+}
+
+/**
+ * Find the Double Metaphone codes of a word. Only the ASCII letters of
+ * the word are looked at.
+ *
+ * \parm[in]  word The word.
+ * \parm[in]  len  Its length.
+ * \parm[out] code The primary and alternate codes, 0 for a word with
+ *                 no sound.
+ **/
+void
+phonetic(const char *word, size_t len, uint32_t *code)
+{
+	int i = 0;
+	size_t j = 0;
+	struct dm d;
+
+	memset(&d, 0, sizeof(struct dm));
+	for (j = 0; j < len && d.len < PHONETIC_WORD; ++j) {
+		if (isalpha((unsigned char)word[j]) &&
+		    (unsigned char)word[j] < 0x80) {
+			d.w[d.len++] = toupper((unsigned char)word[j]);
+		}
+	}
+	memset(d.w + d.len, ' ', 5);
+	d.last = d.len - 1;
+	d.slavo = strchr(d.w, 'W') || strchr(d.w, 'K') ||
+		strstr(d.w, "CZ") || strstr(d.w, "WITZ");
+
+	/* Silent at the start of a word */
+	if (is(&d, 0, 2, "GN", "KN", "PN", "WR", "PS", NULL)) {
+		i = 1;
+	}
+	/* As in "Xavier" */
+	if (at(&d, 0) == 'X') {
+		add(&d, "S", "S");
+		i = 1;
+	}
+
+	while (i < d.len &&
+	       (d.clen[0] < PHONETIC_MAX || d.clen[1] < PHONETIC_MAX)) {
+		switch (d.w[i]) {
+		case 'A':
+		case 'E':
+		case 'I':
+		case 'O':
+		case 'U':
+		case 'Y':
+			if (i == 0) {
+				add(&d, "A", "A");
+			}
+			i += 1;
+			break;
+		case 'B':
+			add(&d, "P", "P");
+			i += at(&d, i + 1) == 'B' ? 2 : 1;
+			break;
+		case 'C':
+			i += letter_c(&d, i);
+			break;
+		case 'D':
+			if (is(&d, i, 2, "DG", NULL)) {
+				if (is(&d, i + 2, 1, "I", "E", "Y", NULL)) {
+					add(&d, "J", "J");
+					i += 3;
+				} else {
+					add(&d, "TK", "TK");
+					i += 2;
+				}
+			} else {
+				add(&d, "T", "T");
+				i += is(&d, i, 2, "DT", "DD", NULL) ? 2 : 1;
+			}
+			break;
+		case 'F':
+			add(&d, "F", "F");
+			i += at(&d, i + 1) == 'F' ? 2 : 1;
+			break;
+		case 'G':
+			i += letter_g(&d, i);
+			break;
+		case 'H':
+			/* Only before a vowel, and first or after one */
+			if ((i == 0 || vowel(&d, i - 1)) && vowel(&d, i + 1)) {
+				add(&d, "H", "H");
+				i += 2;
+			} else {
+				i += 1;
+			}
+			break;
+		case 'J':
+			i += letter_j(&d, i);
+			break;
+		case 'K':
+			add(&d, "K", "K");
+			i += at(&d, i + 1) == 'K' ? 2 : 1;
+			break;
+		case 'L':
+			if (at(&d, i + 1) == 'L') {
+				/* Spanish, as in "Cabrillo", "Gallegos" */
+				if ((i == d.len - 3 &&
+				     is(&d, i - 1, 4, "ILLO", "ILLA", "ALLE",
+					NULL)) ||
+				    ((is(&d, d.last - 1, 2, "AS", "OS", NULL) ||
+				      is(&d, d.last, 1, "A", "O", NULL)) &&
+				     is(&d, i - 1, 4, "ALLE", NULL))) {
+					add(&d, "L", "");
+				} else {
+					add(&d, "L", "L");
+				}
+				i += 2;
+			} else {
+				add(&d, "L", "L");
+				i += 1;
+			}
+			break;
+		case 'M':
+			add(&d, "M", "M");
+			/* As in "dumb", "thumb" */
+			if ((is(&d, i - 1, 3, "UMB", NULL) &&
+			     (i + 1 == d.last || is(&d, i + 2, 2, "ER", NULL))) ||
+			    at(&d, i + 1) == 'M') {
+				i += 2;
+			} else {
+				i += 1;
+			}
+			break;
+		case 'N':
+			add(&d, "N", "N");
+			i += at(&d, i + 1) == 'N' ? 2 : 1;
+			break;
+		case 'P':
+			if (at(&d, i + 1) == 'H') {
+				add(&d, "F", "F");
+				i += 2;
+			} else {
+				/* As in "Campbell", "raspberry" */
+				add(&d, "P", "P");
+				i += is(&d, i + 1, 1, "P", "B", NULL) ? 2 : 1;
+			}
+			break;
+		case 'Q':
+			add(&d, "K", "K");
+			i += at(&d, i + 1) == 'Q' ? 2 : 1;
+			break;
+		case 'R':
+			/* French, as in "Rogier", but not "Hochmeier" */
+			if (i == d.last && !d.slavo &&
+			    is(&d, i - 2, 2, "IE", NULL) &&
+			    !is(&d, i - 4, 2, "ME", "MA", NULL)) {
+				add(&d, "", "R");
+			} else {
+				add(&d, "R", "R");
+			}
+			i += at(&d, i + 1) == 'R' ? 2 : 1;
+			break;
+		case 'S':
+			i += letter_s(&d, i);
+			break;
+		case 'T':
+			if (is(&d, i, 4, "TION", NULL) ||
+			    is(&d, i, 3, "TIA", "TCH", NULL)) {
+				add(&d, "X", "X");
+				i += 3;
+			} else if (is(&d, i, 2, "TH", NULL) ||
+				   is(&d, i, 3, "TTH", NULL)) {
+				/* As in "Thomas", "Thames", or Germanic */
+				if (is(&d, i + 2, 2, "OM", "AM", NULL) ||
+				    is(&d, 0, 4, "VAN ", "VON ", NULL) ||
+				    is(&d, 0, 3, "SCH", NULL)) {
+					add(&d, "T", "T");
+				} else {
+					add(&d, "0", "T");
+				}
+				i += 2;
+			} else {
+				add(&d, "T", "T");
+				i += is(&d, i + 1, 1, "T", "D", NULL) ? 2 : 1;
+			}
+			break;
+		case 'V':
+			add(&d, "F", "F");
+			i += at(&d, i + 1) == 'V' ? 2 : 1;
+			break;
+		case 'W':
+			i += letter_w(&d, i);
+			break;
+		case 'X':
+			/* French, as in "Breaux" */
+			if (!(i == d.last &&
+			      (is(&d, i - 3, 3, "IAU", "EAU", NULL) ||
+			       is(&d, i - 2, 2, "AU", "OU", NULL)))) {
+				add(&d, "KS", "KS");
+			}
+			i += is(&d, i + 1, 1, "C", "X", NULL) ? 2 : 1;
+			break;
+		case 'Z':
+			/* Chinese pinyin, as in "Zhao" */
+			if (at(&d, i + 1) == 'H') {
+				add(&d, "J", "J");
+				i += 2;
+				break;
+			}
+			if (is(&d, i + 1, 2, "ZO", "ZI", "ZA", NULL) ||
+			    (d.slavo && i > 0 && at(&d, i - 1) != 'T')) {
+				add(&d, "S", "TS");
+			} else {
+				add(&d, "S", "S");
+			}
+			i += at(&d, i + 1) == 'Z' ? 2 : 1;
+			break;
+		default:
+			i += 1;
+			break;
+		}
+	}
+
+	code[0] = pack(d.code[0], d.clen[0]);
+	code[1] = pack(d.code[1], d.clen[1]);
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/**
+ * \file phonetic.h
+ * Internal definitions for finding how a name sounds.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifndef MCDS_PHONETIC_H
+#define MCDS_PHONETIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Longest code kept */
+#define PHONETIC_MAX 4
+
+/** Find the primary and alternate Double Metaphone codes of a word */
+void phonetic(const char *, size_t, uint32_t *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_PHONETIC_H */
+/**
+ * \}
+ **/
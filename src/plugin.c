@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file plugin.c
+ * Routines to load the credential backends at runtime.
+ *
+ * GPGME, libsecret and GLib are only mapped into the process when the
+ * rc file selects a backend that needs them. The public functions here
+ * keep the interfaces of decrypt.h and secret.h.
+ *
+ * \ingroup secret
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <dlfcn.h>
+#include <locale.h>
+#include <unistd.h>
+#include "gettext.h"
+#include "defs.h"
+#include "options.h"
+#include "backend.h"
+#include "decrypt.h"
+#include "secret.h"
+
+#if HAVE_GPGME == 1 || HAVE_LIBSECRET
+/**
+ * Load a backend, reusing it if it was already loaded.
+ *
+ * \parm[in] name The backend name.
+ *
+ * \return The backend, NULL if it could not be loaded.
+ **/
+static const struct backend *
+load(const char *name)
+{
+	static struct {
+		const char *name;
+		const struct backend *be;
+	} loaded[2] = {{0}};
+	size_t i = 0;
+	int len = 0;
+	char *path = NULL;
+	void *so = NULL;
+	const struct backend *be = NULL;
+
+	for (i = 0; i < sizeof(loaded)/sizeof(loaded[0]); ++i) {
+		if (loaded[i].name && strcmp(loaded[i].name, name) == 0) {
+			return(loaded[i].be);
+		}
+	}
+
+	len = strlen(PKGLIBDIR) + strlen(name) + 14;
+	path = malloc(len*sizeof(char));
+	if (path == NULL) {
+		warn(_("Unable to allocate the backend path"));
+		return(NULL);
+	}
+	snprintf(path, len, "%s/backend_%s.so", PKGLIBDIR, name);
+
+#ifdef HAVE_UNVEIL
+	if (unveil(PKGLIBDIR, "r") == -1) {
+		warn(_("Unable to unveil %s"), PKGLIBDIR);
+		free(path);
+		return(NULL);
+	}
+#endif
+
+	if (options.verbose) {
+		fprintf(stderr, "Loading backend %s\n", path);
+	}
+	so = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (so == NULL) {
+		warnx(_("Unable to load the %s backend: %s"), name, dlerror());
+		free(path);
+		return(NULL);
+	}
+	free(path);
+
+	be = (const struct backend *)dlsym(so, MCDS_BACKEND_SYMBOL);
+	if (be == NULL || be->version != MCDS_BACKEND_VERSION) {
+		warnx(_("The %s backend is not compatible."), name);
+		dlclose(so);
+		return(NULL);
+	}
+
+	for (i = 0; i < sizeof(loaded)/sizeof(loaded[0]); ++i) {
+		if (loaded[i].name == NULL) {
+			loaded[i].name = name;
+			loaded[i].be = be;
+			break;
+		}
+	}
+
+	return(be);
+}
+#endif
+
+#if HAVE_GPGME == 1
+/**
+ * Decrypt the password file and save the password
+ * in the options structure.
+ *
+ * \parm[in] filename The encrypted password file.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+decrypt(const char *filename)
+{
+	const struct backend *be = NULL;
+
+	if ((be = load("gpgme")) == NULL || be->decrypt == NULL) {
+		return(EXIT_FAILURE);
+	}
+	return(be->decrypt(filename, &options.password));
+}
+#endif
+
+#if HAVE_LIBSECRET
+/**
+ * Save the password in the user's credential store.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+store_password(void)
+{
+	const struct backend *be = NULL;
+
+	if ((be = load("libsecret")) == NULL || be->store == NULL) {
+		return(EXIT_FAILURE);
+	}
+	return(be->store(options.url, options.username, options.password));
+}
+
+/**
+ * Lookup the password in the user's credential store and save
+ * it in the options structure.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+lookup_password(void)
+{
+	const struct backend *be = NULL;
+
+	if ((be = load("libsecret")) == NULL || be->lookup == NULL) {
+		return(EXIT_FAILURE);
+	}
+	return(be->lookup(options.url, options.username, &options.password));
+}
+
+/**
+ * Clear the password in the user's credential store.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+clear_password(void)
+{
+	const struct backend *be = NULL;
+
+	if ((be = load("libsecret")) == NULL || be->clear == NULL) {
+		return(EXIT_FAILURE);
+	}
+	return(be->clear(options.url, options.username));
+}
+#endif
+
+/**
+ * \}
+ **/
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file proto.c
+ * Routines shared by the lookup service and mcds-client.
+ *
+ * \ingroup serve
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "proto.h"
+
+/**
+ * Work out the default socket path. In order of preference it is
+ * $MCDS_SOCKET, $XDG_RUNTIME_DIR/mcds.sock or /tmp/mcds-UID/mcds.sock.
+ * The last directory is created with mode 0700, and refused if it
+ * belongs to someone else or others may enter it.
+ *
+ * \return A newly allocated path, NULL with errno set if an error was
+ *         encounted.
+ **/
+char *
+socket_path(void)
+{
+	int len = 0;
+	char *path = NULL;
+	const char *env = NULL;
+	struct stat sb;
+
+	if ((env = getenv(MCDS_SOCKET_ENV)) != NULL && env[0] != '\0') {
+		return(strdup(env));
+	}
+
+	if ((env = getenv("XDG_RUNTIME_DIR")) != NULL && env[0] != '\0') {
+		len = strlen(env) + strlen(MCDS_SOCKET_NAME) + 2;
+		if ((path = malloc(len)) != NULL) {
+			snprintf(path, len, "%s/%s", env, MCDS_SOCKET_NAME);
+		}
+		return(path);
+	}
+
+	len = sizeof(MCDS_SOCKET_DIR) + sizeof(MCDS_SOCKET_NAME) + 24;
+	if ((path = malloc(len)) == NULL) {
+		return(NULL);
+	}
+	snprintf(path, len, "%s%lu", MCDS_SOCKET_DIR, (unsigned long)getuid());
+
+	/* Another user may have made it first, to listen in our place */
+	if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+		free(path);
+		return(NULL);
+	}
+	if (lstat(path, &sb) == -1) {
+		free(path);
+		return(NULL);
+	}
+	if (!S_ISDIR(sb.st_mode) || sb.st_uid != getuid() ||
+	    (sb.st_mode & 077) != 0) {
+		free(path);
+		errno = EPERM;
+		return(NULL);
+	}
+
+	strcat(path, "/");
+	strcat(path, MCDS_SOCKET_NAME);
+	return(path);
+}
+
+/**
+ * Check the other end of a unix socket is run by this user, so the
+ * service answers only its user and the client only trusts its own
+ * service, wherever the socket lives.
+ *
+ * \parm[in] fd The connected socket.
+ *
+ * \retval 0 If the peer is this user.
+ * \retval 1 If it is not, or it could not be told.
+ **/
+int
+socket_peer(int fd)
+{
+#ifdef HAVE_GETPEEREID
+	uid_t uid = 0;
+	gid_t gid = 0;
+
+	if (getpeereid(fd, &uid, &gid) == -1) {
+		return(EXIT_FAILURE);
+	}
+	return(uid == getuid() ? EXIT_SUCCESS : EXIT_FAILURE);
+#elif defined(SO_PEERCRED)
+	struct ucred cred = {0};
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+		return(EXIT_FAILURE);
+	}
+	return(cred.uid == getuid() ? EXIT_SUCCESS : EXIT_FAILURE);
+#else
+	/* Nothing to ask, the socket's permissions have to do */
+	(void)fd;
+	return(EXIT_SUCCESS);
+#endif
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file proto.h
+ * Definitions shared by the lookup service and mcds-client.
+ *
+ * A client connects to the service's unix socket and sends its
+ * arguments, each terminated by a NUL, followed by one more NUL.
+ * The service answers with the formatted results and closes the
+ * connection. Nothing is sent back if the lookup failed.
+ *
+ * This header and proto.c must only depend on libc.
+ *
+ * \ingroup serve
+ * \{
+ **/
+
+#ifndef MCDS_PROTO_H
+#define MCDS_PROTO_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Largest request accepted from a client */
+#define MCDS_REQUEST_MAX  4096
+
+/** Environment variable overriding the socket path */
+#define MCDS_SOCKET_ENV   "MCDS_SOCKET"
+
+/** Socket name within $XDG_RUNTIME_DIR */
+#define MCDS_SOCKET_NAME  "mcds.sock"
+
+/** Directory below /tmp holding the socket, when there is no other */
+#define MCDS_SOCKET_DIR   "/tmp/mcds-"
+
+/** The default socket path */
+char *socket_path(void);
+
+/** Check the other end of a connection is run by the same user */
+int socket_peer(int);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_PROTO_H */
+/**
+ * \}
+ **/
@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file rank.c
+ * Routines to keep only the best ranked search results.
+ *
+ * The results are held in a bounded min-heap, the worst of the kept
+ * results sits at the root so a new result only has to beat it.
+ * Each search field value is held once: the heap index of each is
+ * kept in a set, and a duplicate only replaces the held result when it
+ * ranks better.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <err.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "options.h"
+#include "mem.h"
+#include "output.h"
+#include "rank.h"
+
+/** A ranked result **/
+struct r_entry {
+	enum r_class class;	/* How the term matched */
+	unsigned long freq;	/* Usage frequency of the value */
+	unsigned long seq;	/* Order the server returned it in */
+	struct result r;	/* Copy of the result */
+};
+
+/** A usage frequency **/
+struct r_freq {
+	unsigned long count;
+	char *value;
+};
+
+/**
+ * Release the fields copied into an entry.
+ **/
+static void
+release(struct r_entry *e)
+{
+	int i = 0;
+
+	for (i = 0; i < nterms; ++i) {
+		free((char *)e->r.val[i]);
+		e->r.val[i] = NULL;
+	}
+}
+
+/**
+ * Release the heap of a lookup, keeping the usage frequencies for the
+ * next.
+ *
+ * \parm[in] rk The ranking state.
+ **/
+void
+rank_clear(struct rank *rk)
+{
+	size_t i = 0;
+
+	for (i = 0; i < rk->hlen; ++i) {
+		release(&rk->heap[i]);
+	}
+	free(rk->heap);
+	rk->heap = NULL;
+	rk->hlen = 0;
+	rk->hmax = 0;
+	rk->seq = 0;
+	dedup_free(&rk->seen);
+}
+
+/**
+ * Release the heap and the usage frequencies.
+ *
+ * \parm[in] rk The ranking state.
+ **/
+void
+rank_free(struct rank *rk)
+{
+	size_t i = 0;
+
+	rank_clear(rk);
+	for (i = 0; i < rk->nfreqs; ++i) {
+		free(rk->freqs[i].value);
+	}
+	free(rk->freqs);
+	rk->freqs = NULL;
+	rk->nfreqs = 0;
+	rk->freq_max = 0;
+	rk->loaded = 0;
+}
+
+/**
+ * Is result a ranked better than result b.
+ * Ties on class and frequency go to the one the server returned first.
+ **/
+static int
+better(const struct r_entry *a, const struct r_entry *b)
+{
+	if (a->class != b->class) {
+		return(a->class > b->class);
+	}
+	if (a->freq != b->freq) {
+		return(a->freq > b->freq);
+	}
+	return(a->seq < b->seq);
+}
+
+/**
+ * Record where an entry sits in the heap.
+ **/
+static void
+place(struct rank *rk, size_t i)
+{
+	const struct result *r = &rk->heap[i].r;
+	size_t *pos = NULL;
+
+	pos = dedup_find(&rk->seen, r->val[rk->search], r->len[rk->search]);
+	if (pos) {
+		*pos = i;
+	}
+}
+
+static void
+swap(struct rank *rk, size_t a, size_t b)
+{
+	struct r_entry t = rk->heap[a];
+	rk->heap[a] = rk->heap[b];
+	rk->heap[b] = t;
+	place(rk, a);
+	place(rk, b);
+}
+
+/**
+ * Restore the heap property downwards from node i.
+ **/
+static void
+sift_down(struct rank *rk, size_t hlen, size_t i)
+{
+	struct r_entry *heap = rk->heap;
+	size_t l = 0;
+	size_t m = 0;
+
+	for (;;) {
+		m = i;
+		l = 2*i + 1;
+		if (l < hlen && better(&heap[m], &heap[l])) {
+			m = l;
+		}
+		if (l+1 < hlen && better(&heap[m], &heap[l+1])) {
+			m = l+1;
+		}
+		if (m == i) {
+			return;
+		}
+		swap(rk, i, m);
+		i = m;
+	}
+}
+
+/**
+ * Restore the heap property upwards from node i.
+ **/
+static void
+sift_up(struct rank *rk, size_t i)
+{
+	while (i > 0 && better(&rk->heap[(i-1)/2], &rk->heap[i])) {
+		swap(rk, (i-1)/2, i);
+		i = (i-1)/2;
+	}
+}
+
+static int
+freq_cmp(const void *a, const void *b)
+{
+	return(strcasecmp(((const struct r_freq *)a)->value,
+			  ((const struct r_freq *)b)->value));
+}
+
+/**
+ * Look up the usage frequency of a value.
+ *
+ * \parm[in] rk    The ranking state.
+ * \parm[in] value The value to find.
+ *
+ * \return The usage count, 0 if it is unknown.
+ **/
+static unsigned long
+frequency(const struct rank *rk, const char *value)
+{
+	struct r_freq key = {0};
+	struct r_freq *f = NULL;
+
+	if (rk->nfreqs == 0) {
+		return(0);
+	}
+	key.value = (char *)value;
+	f = bsearch(&key, rk->freqs, rk->nfreqs, sizeof(struct r_freq),
+		    freq_cmp);
+
+	return(f ? f->count : 0);
+}
+
+/**
+ * Read the usage frequencies used to break ties between equally
+ * good matches. Each line of the file holds a count followed by
+ * the value it belongs to, e.g. "12 ben@example.net".
+ *
+ * \parm[in] rk   The ranking state.
+ * \parm[in] file The frequency file.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+rank_frequency(struct rank *rk, const char *file)
+{
+	FILE *ifd = NULL;		/* File descriptor */
+	char *line = NULL;		/* Read line */
+	size_t sz = 0;			/* Size of the line buffer */
+	size_t amax = 0;		/* Allocated frequencies */
+	unsigned long count = 0;	/* Read count */
+	char *value = NULL;		/* Read value */
+	char *end = NULL;		/* End of the read value */
+
+	if ((ifd = fopen(file, "r")) == NULL) {
+		warn(_("Unable to open frequency file %s"), file);
+		return(EXIT_FAILURE);
+	}
+
+	while (getline(&line, &sz, ifd) != -1) {
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+		count = strtoul(line, &value, 10);
+		while (isspace((unsigned char)*value)) {
+			++value;
+		}
+		end = value + strlen(value);
+		while (end > value && isspace((unsigned char)end[-1])) {
+			--end;
+		}
+		if (end == value) {
+			continue;
+		}
+		if (rk->nfreqs == amax) {
+			amax = amax ? 2*amax : 64;
+			rk->freqs = realloc(rk->freqs,
+					    amax*sizeof(struct r_freq));
+			if (rk->freqs == NULL) {
+				err(EXIT_FAILURE, _("Unable to extend the frequencies"));
+			}
+		}
+		rk->freqs[rk->nfreqs].count = count;
+		rk->freqs[rk->nfreqs].value = strndup(value, end - value);
+		if (rk->freqs[rk->nfreqs].value == NULL) {
+			err(EXIT_FAILURE, _("Unable to duplicate string"));
+		}
+		if (count > rk->freq_max) {
+			rk->freq_max = count;
+		}
+		++rk->nfreqs;
+	}
+	free(line);
+
+	if (fclose(ifd)) {
+		warn(_("Unable to close %s"), file);
+	}
+
+	qsort(rk->freqs, rk->nfreqs, sizeof(struct r_freq), freq_cmp);
+	rk->loaded = 1;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Initialise the heap to hold the best n results. The usage
+ * frequencies are loaded afterwards, once for all the lookups.
+ *
+ * \parm[in] rk     The ranking state.
+ * \parm[in] n      The number of results to keep.
+ * \parm[in] search The field the usage frequencies apply to.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+rank_init(struct rank *rk, size_t n, enum s_terms search)
+{
+	/* Drop anything left over from a lookup that failed */
+	rank_clear(rk);
+
+	rk->hmax = n;
+	rk->heap = xmalloc(n*sizeof(struct r_entry));
+	rk->search = search;
+	dedup_init(&rk->seen, n);
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Classify how well the term matches a field.
+ * A match at the start of the field beats one at the start of
+ * a word, which beats one anywhere else. Every occurrence of the
+ * term is considered and the best one kept.
+ *
+ * \parm[in] field The field that was queried.
+ * \parm[in] term  The query term.
+ *
+ * \return The match class.
+ **/
+enum r_class
+rank_score(const char *field, const char *term)
+{
+	enum r_class best = r_none;
+	const char *p = field;
+
+	if (term[0] == '\0') {
+		return(r_prefix);
+	}
+	while ((p = strcasestr(p, term)) != NULL) {
+		if (p == field) {
+			return(r_prefix);
+		}
+		if (!isalnum((unsigned char)p[-1])) {
+			best = r_word;
+		} else if (best == r_none) {
+			best = r_substring;
+		}
+		++p;
+	}
+	return(best);
+}
+
+/**
+ * Offer a result to the heap. It is kept if the heap has space or it
+ * beats the worst result currently held, which is then dropped.
+ * A result whose search field is already held replaces that result
+ * if it ranks better, and is dropped otherwise.
+ *
+ * \parm[in] rk    The ranking state.
+ * \parm[in] r     The result.
+ * \parm[in] class How the term matched the query field.
+ *
+ * \retval 0 If there were no errors.
+ **/
+int
+rank_add(struct rank *rk, const struct result *r, enum r_class class)
+{
+	int i = 0;
+	int held = 0;
+	char *v = NULL;
+	size_t *pos = NULL;
+	size_t at = 0;
+	struct r_entry e = {0};
+	const char *key = r->val[rk->search];
+	size_t klen = r->len[rk->search];
+
+	e.class = class;
+	e.seq = rk->seq++;
+	if (rk->nfreqs) {
+		v = strndup(r->val[rk->search], r->len[rk->search]);
+		if (v == NULL) {
+			err(EXIT_FAILURE, _("Unable to duplicate string"));
+		}
+		e.freq = frequency(rk, v);
+		free(v);
+	}
+
+	pos = dedup_find(&rk->seen, key, klen);
+	if (pos && !better(&e, &rk->heap[*pos])) {
+		return(EXIT_SUCCESS);
+	}
+	if (pos == NULL && rk->hlen == rk->hmax &&
+	    (rk->hmax == 0 || !better(&e, &rk->heap[0]))) {
+		return(EXIT_SUCCESS);
+	}
+
+	for (i = 0; i < nterms; ++i) {
+		if (r->val[i]) {
+			e.r.val[i] = strndup(r->val[i], r->len[i]);
+			if (e.r.val[i] == NULL) {
+				err(EXIT_FAILURE, _("Unable to duplicate string"));
+			}
+			e.r.len[i] = r->len[i];
+		}
+	}
+
+	/* A better duplicate moves away from the root, towards the best */
+	if (pos) {
+		at = *pos;
+		release(&rk->heap[at]);
+		rk->heap[at] = e;
+		sift_down(rk, rk->hlen, at);
+		return(EXIT_SUCCESS);
+	}
+
+	if (rk->hlen < rk->hmax) {
+		at = rk->hlen++;
+	} else {
+		at = 0;
+		dedup_del(&rk->seen, rk->heap[0].r.val[rk->search],
+			  rk->heap[0].r.len[rk->search]);
+		release(&rk->heap[0]);
+	}
+	rk->heap[at] = e;
+	*dedup_add(&rk->seen, key, klen, &held) = at;
+	if (at == 0) {
+		sift_down(rk, rk->hlen, 0);
+	} else {
+		sift_up(rk, at);
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Check if scanning can stop. Once the heap is full and its worst
+ * entry is a prefix match with the highest known frequency, any later
+ * result would lose the tie on server order.
+ *
+ * \parm[in] rk The ranking state.
+ *
+ * \retval 1 If no later result can enter the heap.
+ * \retval 0 Otherwise.
+ **/
+int
+rank_full(const struct rank *rk)
+{
+	if (rk->heap == NULL || rk->hlen < rk->hmax) {
+		return(0);
+	}
+	if (rk->hmax == 0) {
+		return(1);
+	}
+	return(rk->heap[0].class == r_prefix &&
+	       rk->heap[0].freq >= rk->freq_max);
+}
+
+/**
+ * Write the held results, best first, and release them.
+ *
+ * \parm[in] rk The ranking state.
+ * \parm[in] o  The output to write to.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+rank_write(struct rank *rk, struct output *o)
+{
+	int rtn = EXIT_SUCCESS;
+	size_t i = 0;
+	size_t n = rk->hlen;
+
+	/* Pop the worst to the back, leaving the array best first */
+	while (rk->hlen > 1) {
+		--rk->hlen;
+		swap(rk, 0, rk->hlen);
+		sift_down(rk, rk->hlen, 0);
+	}
+
+	for (i = 0; i < n && rtn == EXIT_SUCCESS; ++i) {
+		rtn = output_record(o, &rk->heap[i].r);
+	}
+
+	rk->hlen = n;
+	rank_clear(rk);
+
+	return(rtn);
+}
+
+/**
+ * \}
+ **/
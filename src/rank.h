@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file rank.h
+ * Internal definitions for ranking the search results.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifndef MCDS_RANK_H
+#define MCDS_RANK_H
+
+#include "output.h"
+#include "dedup.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Match classes, a higher value is a better match */
+enum r_class {
+	r_none = 0,
+	r_substring,
+	r_word,
+	r_prefix
+};
+
+/** The ranking state of a lookup **/
+struct rank {
+	struct r_entry *heap;		/* Heap of kept results, worst first */
+	size_t hmax;			/* Results to keep */
+	size_t hlen;			/* Results kept */
+	unsigned long seq;		/* Results offered so far */
+	struct r_freq *freqs;		/* Usage frequencies, sorted by value */
+	size_t nfreqs;			/* Number of usage frequencies */
+	unsigned long freq_max;		/* Highest usage frequency */
+	enum s_terms search;		/* Field the frequencies apply to */
+	int loaded;			/* The frequencies were read */
+	struct dedup seen;		/* Heap index of each kept value */
+};
+
+/** Load the usage frequencies */
+int rank_frequency(struct rank *, const char *);
+
+/** Initialise the ranking heap to hold the best n results */
+int rank_init(struct rank *, size_t, enum s_terms);
+
+/** Score a field against the query term */
+enum r_class rank_score(const char *, const char *);
+
+/** Offer a result to the ranking heap */
+int rank_add(struct rank *, const struct result *, enum r_class);
+
+/** Can no later result displace the ones already held */
+int rank_full(const struct rank *);
+
+/** Write the ranked results, best first, and release them */
+int rank_write(struct rank *, struct output *);
+
+/** Release the ranking heap, keeping the usage frequencies */
+void rank_clear(struct rank *);
+
+/** Release the ranking heap and usage frequencies */
+void rank_free(struct rank *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_RANK_H */
+/**
+ * \}
+ **/
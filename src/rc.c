@@ -40,8 +40,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "gettext.h"
+#include "cache.h"
 #include "decrypt.h"
 #include "defs.h"
+#include "keyring.h"
 #include "mem.h"
 #include "options.h"
 #include "prompt.h"
@@ -51,6 +53,46 @@
 #define LINE_MAX          sysconf(_SC_LINE_MAX)
 #endif
 
+static int have_rc = 0;                /* Was an rc file read */
+static char *pfile = NULL;             /* Password file */
+
+/**
+ * Expand a leading "~/" in a filename to the home directory.
+ *
+ * \parm[in] file The filename.
+ *
+ * \return A newly allocated filename, NULL if an error was encounted.
+ **/
+static char *
+expand_home(const char *file)
+{
+	int len = 0;                   /* String length */
+	char *home = NULL;             /* Home directory */
+	char *abs_file = NULL;         /* Absolute filename */
+
+	if (file[0] != '~' || file[1] != '/') {
+		abs_file = strdup(file);
+		if (abs_file == NULL) {
+			warn(_("Unable to duplicate string"));
+		}
+		return(abs_file);
+	}
+
+	home = getenv("HOME");
+	if (home == NULL) {
+		warnx(_("Unable to obtain home directory"));
+		return(NULL);
+	}
+	len = strlen(home) + strlen(file);
+	abs_file = xmalloc(len*sizeof(char));
+	if (snprintf(abs_file, len, "%s/%s", home, file +2) >= len) {
+		warnx(_("Unable to build file string"));
+		free(abs_file);
+		return(NULL);
+	}
+	return(abs_file);
+}
+
 /**
  * Read the rc file and parse it into the options.
  *
@@ -64,7 +106,6 @@ read_rc(const char *file)
 	int i  = 0;                    /* Temporary loop indexer */
 	int len = 0;                   /* String length */
 	char *home = NULL;             /* Home directory */
-	char *pfile = NULL;            /* Password file */
 	char *abs_file = NULL;         /* Absolute filename */
 	FILE *ifd = NULL;              /* File descriptor */
 	char line[LINE_MAX];           /* Read line from file */
@@ -113,6 +154,7 @@ read_rc(const char *file)
 	if ((ifd = fopen(abs_file, "r")) == NULL) {
 		return(EXIT_FAILURE);
 	}
+	have_rc = 1;
 
 	while (fgets(line, LINE_MAX, ifd) != NULL) {
 		lptr = line;
@@ -153,10 +195,74 @@ read_rc(const char *file)
 				} else {
 					options.libsecret = 0;
 				}
+			} else if (strncmp("keyring_timeout", vals[0], 15) == 0) {
+				options.keyring_timeout = atoi(vals[1]);
+			} else if (strncmp("keyring", vals[0], 7) == 0) {
+				if ((vals[1][0] == 'y') || (vals[1][0] == 'Y')) {
+					options.keyring = 1;
+				} else {
+					options.keyring = 0;
+				}
+			} else if (strncmp("preconnect", vals[0], 10) == 0) {
+				if ((vals[1][0] == 'y') || (vals[1][0] == 'Y')) {
+					options.preconnect = 1;
+				} else {
+					options.preconnect = 0;
+				}
+			} else if (strncmp("sync", vals[0], 4) == 0) {
+				if ((vals[1][0] == 'y') || (vals[1][0] == 'Y')) {
+					options.sync = 1;
+				} else {
+					options.sync = 0;
+				}
 			} else if (strncmp("password_file", vals[0], 13) == 0) {
 				len = strlen(vals[1]) +1;
 				pfile = xmalloc(len);
 				strncpy(pfile, vals[1], len);
+			} else if (strncmp("limit", vals[0], 5) == 0) {
+				if (options.limit == 0) {
+					options.limit = atoi(vals[1]);
+				}
+			} else if (strncmp("frequency_file", vals[0], 14) == 0) {
+				if (options.freq_file == NULL) {
+					options.freq_file = expand_home(vals[1]);
+					if (options.freq_file == NULL) {
+						return(EXIT_FAILURE);
+					}
+				}
+			} else if (strncmp("idle_timeout", vals[0], 12) == 0) {
+				options.idle_timeout = atoi(vals[1]);
+			} else if (strncmp("fuzzy", vals[0], 5) == 0) {
+				if (options.fuzzy == 0) {
+					options.fuzzy = atoi(vals[1]);
+				}
+				if (options.fuzzy < 0 || options.fuzzy > 2) {
+					warnx(_("The typos allowed must be 0, 1 or 2."));
+					options.fuzzy = 0;
+				}
+			} else if (strncmp("miss_ttl", vals[0], 8) == 0) {
+				options.miss_ttl = atoi(vals[1]);
+			} else if (strncmp("socket", vals[0], 6) == 0) {
+				if (options.socket == NULL) {
+					options.socket = expand_home(vals[1]);
+					if (options.socket == NULL) {
+						return(EXIT_FAILURE);
+					}
+				}
+			} else if (strncmp("vdir", vals[0], 4) == 0) {
+				if (options.vdir == NULL) {
+					options.vdir = expand_home(vals[1]);
+					if (options.vdir == NULL) {
+						return(EXIT_FAILURE);
+					}
+				}
+			} else if (strncmp("ldif", vals[0], 4) == 0) {
+				if (options.ldif == NULL) {
+					options.ldif = expand_home(vals[1]);
+					if (options.ldif == NULL) {
+						return(EXIT_FAILURE);
+					}
+				}
 			} else if (strncmp("username", vals[0], 8) == 0) {
 				if (options.username == NULL) {
 					len = strlen(vals[1]);
@@ -184,6 +290,95 @@ read_rc(const char *file)
 		abs_file = NULL;
 	}
 
+#ifdef HAVE_UNVEIL
+	if (options.freq_file) {
+		if (unveil(options.freq_file, "r") == -1) {
+			warn(_("Unable to unveil %s"), options.freq_file);
+			return(EXIT_FAILURE);
+		}
+	}
+	if (options.vdir) {
+		if (unveil(options.vdir, "r") == -1) {
+			warn(_("Unable to unveil %s"), options.vdir);
+			return(EXIT_FAILURE);
+		}
+	}
+	if (options.ldif) {
+		if (unveil(options.ldif, "r") == -1) {
+			warn(_("Unable to unveil %s"), options.ldif);
+			return(EXIT_FAILURE);
+		}
+	}
+	/* Discovery and the misses are kept for the server */
+	if (options.url && (abs_file = cache_path(NULL)) != NULL) {
+		if (unveil(abs_file, "rwc") == -1) {
+			warn(_("Unable to unveil %s"), abs_file);
+			free(abs_file);
+			return(EXIT_FAILURE);
+		}
+		free(abs_file);
+		abs_file = NULL;
+	}
+#endif
+
+	if (options.verify == 1) {
+#ifdef HAVE_UNVEIL
+		if (unveil("/etc/ssl", "r") == -1) {
+			warn(_("Unable to unveil %s"), "/etc/ssl/");
+			return(EXIT_FAILURE);
+		}
+#endif
+	}
+	if (options.netrc == 1) {
+		home = getenv("HOME");
+		if (home == NULL) {
+			warnx(_("Unable to obtain home directory"));
+			return(EXIT_FAILURE);
+		}
+		len = strlen(home) + strlen(nfile) + 2;
+		abs_file = xmalloc(len*sizeof(char));
+		if (snprintf(abs_file, len, "%s/%s", home, nfile) >= len) {
+			warnx(_("Unable to build password file string"));
+			return(EXIT_FAILURE);
+		}
+#ifdef HAVE_UNVEIL
+		if (unveil(abs_file, "r") == -1) {
+			warn(_("Unable to unveil %s"), abs_file);
+			return(EXIT_FAILURE);
+		}
+#endif
+		if (abs_file) {
+			free(abs_file);
+			abs_file = NULL;
+		}
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Obtain the credentials selected by the rc file, from the prompt,
+ * the keyring, libsecret or the GPG password file, in that order.
+ *
+ * This is kept apart from read_rc() so that the slow backends can
+ * run while the connection to the server is being made.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+read_credentials(void)
+{
+#if HAVE_GPGME == 1
+	int len = 0;                   /* String length */
+	char *home = NULL;             /* Home directory */
+	char *abs_file = NULL;         /* Absolute filename */
+#endif
+
+	if (!have_rc) {
+		return(EXIT_SUCCESS);
+	}
+
 	if (options.username == NULL && options.netrc == 0) {
 		options.username = strdup(getenv("USER"));
 	}
@@ -192,8 +387,14 @@ read_rc(const char *file)
 		prompt_password();
 	}
 
+#ifdef HAVE_LINUX_KEYCTL_H
+	if (options.keyring && !options.pwprompt) {
+		keyring_lookup();
+	}
+#endif
+
 #if HAVE_LIBSECRET
-	if (options.libsecret) {
+	if (options.libsecret && options.password == NULL) {
 		if (!options.pwprompt) {
 			if (lookup_password() == 1) {
 				return(EXIT_FAILURE);
@@ -249,39 +450,6 @@ read_rc(const char *file)
 #endif
 	}
 
-	if (options.verify == 1) {
-#ifdef HAVE_UNVEIL
-		if (unveil("/etc/ssl", "r") == -1) {
-			warn(_("Unable to unveil %s"), "/etc/ssl/");
-			return(EXIT_FAILURE);
-		}
-#endif
-	}
-	if (options.password == NULL &&
-	    options.netrc == 1) {
-		home = getenv("HOME");
-		if (home == NULL) {
-			warnx(_("Unable to obtain home directory"));
-			return(EXIT_FAILURE);
-		}
-		len = strlen(home) + strlen(nfile) + 2;
-		abs_file = xmalloc(len*sizeof(char));
-		if (snprintf(abs_file, len, "%s/%s", home, nfile) >= len) {
-			warnx(_("Unable to build password file string"));
-			return(EXIT_FAILURE);
-		}
-#ifdef HAVE_UNVEIL
-		if (unveil(abs_file, "r") == -1) {
-			warn(_("Unable to unveil %s"), abs_file);
-			return(EXIT_FAILURE);
-		}
-#endif
-		if (abs_file) {
-			free(abs_file);
-			abs_file = NULL;
-		}
-	}
-
 #if HAVE_LIBSECRET
 	if (options.libsecret == 1) {
 		if (options.password && options.password[0] == '\0') {
@@ -291,6 +459,16 @@ read_rc(const char *file)
 	}
 #endif
 
+#ifdef HAVE_LINUX_KEYCTL_H
+	if (options.keyring && !options.cached) {
+		if (options.password && options.password[0] != '\0') {
+			keyring_store();
+		} else if (options.pwprompt) {
+			keyring_clear();
+		}
+	}
+#endif
+
 	return(EXIT_SUCCESS);
 }
 
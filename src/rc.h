@@ -35,6 +35,9 @@ extern "C"
 /** Read the rc file */
 int read_rc(const char *);
 
+/** Obtain the credentials */
+int read_credentials(void);
+
 #ifdef __cplusplus
 }                               /* extern "C" */
 #endif
@@ -18,7 +18,8 @@
 
 /**
  * \file secret.c
- * Routines to manage access to credential store.
+ * Routines to manage access to credential store, built as a runtime
+ * loaded backend so libsecret and GLib are only linked in when used.
  *
  * \ingroup secret
  * \{
@@ -41,10 +42,7 @@
 #include <termios.h>
 #include "gettext.h"
 #include "defs.h"
-#include "mem.h"
-#include "options.h"
-#include "prompt.h"
-#include "secret.h"
+#include "backend.h"
 
 #if HAVE_LIBSECRET
 #include <libsecret/secret.h>
@@ -64,18 +62,18 @@ static const SecretSchema mcds_secret_schema = {
 	}
 };
 
-int
-store_password(void)
+static int
+store_password(const char *url, const char *user, const char *password)
 {
 	GError *error = NULL;
 
 	secret_password_store_sync(&mcds_secret_schema,
 				   SECRET_COLLECTION_DEFAULT,
 				   "Mutt CardDAV Search user credentials",
-				   options.password,
+				   password,
 				   NULL, &error,
-				   MCDS_SECRET_KEY_URL, options.url,
-				   MCDS_SECRET_KEY_USER, options.username,
+				   MCDS_SECRET_KEY_URL, url,
+				   MCDS_SECRET_KEY_USER, user,
 				   NULL);
 	if (error) {
 		warnx(_("error storing password with libsecret: %s"), error->message);
@@ -85,15 +83,15 @@ store_password(void)
 	return(EXIT_SUCCESS);
 }
 
-int
-lookup_password(void)
+static int
+lookup_password(const char *url, const char *user, char **result)
 {
 	GError *error = NULL;
 
 	gchar *password = secret_password_lookup_sync(&mcds_secret_schema,
 						      NULL, &error,
-						      MCDS_SECRET_KEY_URL, options.url,
-						      MCDS_SECRET_KEY_USER, options.username,
+						      MCDS_SECRET_KEY_URL, url,
+						      MCDS_SECRET_KEY_USER, user,
 						      NULL);
 	if (error) {
 		warnx(_("error retrieving password with libsecret: %s"), error->message);
@@ -102,21 +100,21 @@ lookup_password(void)
 	}
 
 	if (password) {
-		options.password = strdup(password);
+		*result = strdup(password);
 	}
 	secret_password_free(password);
 	return(EXIT_SUCCESS);
 }
 
-int
-clear_password(void)
+static int
+clear_password(const char *url, const char *user)
 {
 	GError *error = NULL;
 
 	gboolean removed = secret_password_clear_sync(&mcds_secret_schema,
 						      NULL, &error,
-						      MCDS_SECRET_KEY_URL, options.url,
-						      MCDS_SECRET_KEY_USER, options.username,
+						      MCDS_SECRET_KEY_URL, url,
+						      MCDS_SECRET_KEY_USER, user,
 						      NULL);
 	if (error) {
 		/* This is a non-fatal condition. */
@@ -125,6 +123,15 @@ clear_password(void)
 	}
 	return(!error && removed ? EXIT_SUCCESS : EXIT_FAILURE);
 }
+
+/** The backend loaded by mcds **/
+ATT_PUBLIC const struct backend mcds_backend = {
+	.version = MCDS_BACKEND_VERSION,
+	.name    = "libsecret",
+	.lookup  = lookup_password,
+	.store   = store_password,
+	.clear   = clear_password,
+};
 #endif
 
 
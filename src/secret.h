@@ -27,10 +27,6 @@
 #ifndef MCDS_SECRET_H
 #define MCDS_SECRET_H
 
-#if HAVE_LIBSECRET
-#include <libsecret/secret.h>
-#endif
-
 #ifdef __cplusplus
 extern "C"
 {
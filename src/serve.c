@@ -0,0 +1,762 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file serve.c
+ * Routines for the resident lookup service.
+ *
+ * The service obtains the credentials and connects on the first
+ * request, then answers lookups from mcds-client over a unix socket.
+ * Each connection is answered by a worker thread with a context from a
+ * pool, so curl handles and their open connections are reused, and
+ * identical lookups arriving together share one query to the server.
+ * Started by systemd, it is handed the socket and may exit when idle;
+ * the next connection starts it again. It also exits when the server
+ * refuses the password, so the next start obtains it anew.
+ *
+ * \ingroup serve
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <curl/curl.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "options.h"
+#include "mem.h"
+#include "curl.h"
+#include "keyring.h"
+#include "rc.h"
+#include "lookup.h"
+#include "mcds.h"
+#include "proto.h"
+#include "serve.h"
+#include "sources.h"
+
+/** First descriptor passed by socket activation, as in sd-daemon.h */
+#define LISTEN_FDS_START 3
+
+/** Most lookups answered at the same time */
+#define SERVE_WORKERS    16
+
+/** Seconds a client has to send its request */
+#define SERVE_TIMEOUT    5
+
+/** The socket path, set only if this process created it **/
+static char *spath = NULL;
+
+/** Contexts waiting for a lookup, and the number answering one **/
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct mcds *idle[SERVE_WORKERS];
+	int nidle;
+	int busy;
+	int refused;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/** Written by a worker to stop the service taking lookups **/
+static int wake[2] = {-1, -1};
+
+/** Queries in flight, shared by the pool's contexts **/
+static struct flights flights;
+
+/** A connection handed to a worker **/
+struct job {
+	struct mcds *ctx;
+	int fd;
+};
+
+/**
+ * Map a field letter onto a search term.
+ *
+ * \retval 0 If the letter is known.
+ * \retval 1 Otherwise.
+ **/
+static int
+term_of(const char *arg, enum s_terms *term)
+{
+	switch (arg[0]) {
+	case 'a':
+	case 'A':
+		*term = address;
+		break;
+	case 'e':
+	case 'E':
+		*term = email;
+		break;
+	case 'n':
+	case 'N':
+		*term = name;
+		break;
+	case 't':
+	case 'T':
+		*term = telephone;
+		break;
+	default:
+		return(EXIT_FAILURE);
+	}
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Parse a client's arguments into a lookup. Only the options that
+ * shape a single lookup are accepted, the rest come from the service's
+ * own options.
+ *
+ * \parm[in] argc Number of arguments.
+ * \parm[in] argv The arguments.
+ * \parm[out] q   The lookup, whose term points into argv.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+parse_request(int argc, char **argv, struct mcds_query *q)
+{
+	int i = 0;
+	size_t j = 0;
+	size_t len = 0;
+	char opt = 0;
+	const char *val = NULL;
+	const char *term = NULL;
+
+	static const struct {
+		const char *name;
+		char opt;
+	} lopts[] = {
+		{"--format", 'f'},
+		{"--fuzzy",  'z'},
+		{"--limit",  'l'},
+		{"--phonetic", 'P'},
+		{"--query",  'q'},
+		{"--search", 's'},
+	};
+
+	for (i = 0; i < argc; ++i) {
+		opt = 0;
+		val = NULL;
+		if (argv[i][0] == '-' && argv[i][1] == '-') {
+			/* As getopt_long, the value may follow an = */
+			len = strcspn(argv[i], "=");
+			if (argv[i][len] == '=') {
+				val = argv[i] + len + 1;
+			}
+			for (j = 0; j < sizeof(lopts)/sizeof(lopts[0]); ++j) {
+				if (strlen(lopts[j].name) == len &&
+				    strncmp(argv[i], lopts[j].name, len) == 0) {
+					opt = lopts[j].opt;
+				}
+			}
+		} else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			opt = argv[i][1];
+			if (argv[i][2] != '\0') {
+				val = argv[i] + 2;
+			}
+		} else if (term == NULL) {
+			term = argv[i];
+			continue;
+		} else {
+			warnx(_("Request has more than one term."));
+			return(EXIT_FAILURE);
+		}
+
+		if (opt == 0 || strchr("flPqsz", opt) == NULL) {
+			warnx(_("Request option %s is not supported."), argv[i]);
+			return(EXIT_FAILURE);
+		}
+		/* The only option without a value */
+		if (opt == 'P') {
+			q->phonetic = 1;
+			continue;
+		}
+
+		if (val == NULL) {
+			if (++i == argc) {
+				warnx(_("Request option %s needs a value."),
+				      argv[i-1]);
+				return(EXIT_FAILURE);
+			}
+			val = argv[i];
+		}
+
+		switch (opt) {
+		case 'f':
+			if (val[0] == 'm' || val[0] == 'M') {
+				q->format = fmt_mutt;
+			} else if (val[0] == 't' || val[0] == 'T') {
+				q->format = fmt_tsv;
+			} else if (val[0] == 'j' || val[0] == 'J') {
+				q->format = fmt_json;
+			}
+			break;
+		case 'l':
+			q->limit = atoi(val);
+			break;
+		case 'q':
+			term_of(val, &q->query);
+			break;
+		case 's':
+			term_of(val, &q->search);
+			break;
+		case 'z':
+			q->fuzzy = atoi(val);
+			if (q->fuzzy < 0 || q->fuzzy > 2) {
+				warnx(_("The typos allowed must be 0, 1 or 2."));
+				return(EXIT_FAILURE);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (term == NULL) {
+		warnx(_("Request has no term to query for."));
+		return(EXIT_FAILURE);
+	}
+	q->term = term;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Note the server refused the password. Every pooled context offers
+ * the same one, so the service stops taking lookups and exits rather
+ * than have each of them refused in turn.
+ **/
+static void
+refused(void)
+{
+	pthread_mutex_lock(&pool.lock);
+	if (!pool.refused) {
+		pool.refused = 1;
+#ifdef HAVE_LINUX_KEYCTL_H
+		/* A stale cached password must not be offered again */
+		if (options.cached) {
+			keyring_clear();
+		}
+#endif
+		if (write(wake[1], "", 1) == -1) {
+			warn(_("Unable to stop the service"));
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Read one request from a client and answer it. The read gives up
+ * after SERVE_TIMEOUT seconds without data.
+ *
+ * \parm[in] ctx The context.
+ * \parm[in] fd  The client connection.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+handle(struct mcds *ctx, int fd)
+{
+	int rtn = EXIT_FAILURE;
+	int argc = 0;
+	char *argv[MCDS_REQUEST_MAX/2 + 1];
+	char req[MCDS_REQUEST_MAX];
+	size_t len = 0;
+	size_t i = 0;
+	ssize_t n = 0;
+	struct mcds_query q = {0};
+
+	/* Read until the empty argument that ends the request */
+	while (len < sizeof(req)) {
+		n = read(fd, req + len, sizeof(req) - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+		if (len >= 2 && req[len-1] == '\0' && req[len-2] == '\0') {
+			break;
+		}
+	}
+	if (len == 0) {
+		/* A probe from another service starting up */
+		return(EXIT_FAILURE);
+	}
+	if (len < 2 || req[len-1] != '\0' || req[len-2] != '\0') {
+		warnx(_("Ignoring a malformed request."));
+		return(EXIT_FAILURE);
+	}
+
+	/* Only the last argument may be empty, and there is room for all */
+	for (i = 0; i < len - 1; i += strlen(req + i) + 1) {
+		if (req[i] == '\0' || argc == MCDS_REQUEST_MAX/2) {
+			warnx(_("Ignoring a malformed request."));
+			return(EXIT_FAILURE);
+		}
+		argv[argc++] = req + i;
+	}
+
+	q.query  = options.query;
+	q.search = options.search;
+	q.format = options.format;
+	q.limit  = options.limit;
+	q.fuzzy  = options.fuzzy;
+	q.phonetic = options.phonetic;
+	if (parse_request(argc, argv, &q)) {
+		return(EXIT_FAILURE);
+	}
+
+	if (options.verbose) {
+		fprintf(stderr, "Serving a lookup for %s\n", q.term);
+	}
+	rtn = lookup(ctx, &q, fd);
+	if (ctx->status == 401) {
+		refused();
+	}
+
+	return(rtn);
+}
+
+/**
+ * Adopt the listening socket passed by the service manager.
+ *
+ * \return The socket, -1 if none was passed to this process.
+ **/
+static int
+activated(void)
+{
+	int fd = LISTEN_FDS_START;
+	const char *pid = NULL;
+	const char *fds = NULL;
+	struct stat sb;
+
+	pid = getenv("LISTEN_PID");
+	fds = getenv("LISTEN_FDS");
+	if (pid == NULL || fds == NULL) {
+		return(-1);
+	}
+	if (strtol(pid, NULL, 10) != (long)getpid() || atoi(fds) < 1) {
+		return(-1);
+	}
+
+	/* Children must not take the socket for their own */
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	if (atoi(fds) > 1) {
+		warnx(_("Only the first of %s passed sockets is used."), fds);
+	}
+	if (fstat(fd, &sb) == -1 || !S_ISSOCK(sb.st_mode)) {
+		warnx(_("The passed descriptor %d is not a socket."), fd);
+		return(-1);
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (options.verbose) {
+		fprintf(stderr, "Listening on the passed socket %d\n", fd);
+	}
+
+	return(fd);
+}
+
+/**
+ * Create the listening socket, refusing to take it over from a
+ * service that is still running. A socket passed by the service
+ * manager is used instead, if there is one.
+ *
+ * \return The listening socket, -1 if an error was encounted.
+ **/
+int
+serve_listen(void)
+{
+	int fd = -1;
+	mode_t mask = 0;
+	struct sockaddr_un sa = {0};
+	char *path = NULL;
+
+	if ((fd = activated()) != -1) {
+		return(fd);
+	}
+
+	path = options.socket ? strdup(options.socket) : socket_path();
+	if (path == NULL) {
+		warn(_("Unable to build the socket path"));
+		return(-1);
+	}
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		warnx(_("Socket path %s is too long"), path);
+		free(path);
+		return(-1);
+	}
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+#ifdef HAVE_UNVEIL
+	if (unveil(path, "rwc") == -1) {
+		warn(_("Unable to unveil %s"), path);
+		free(path);
+		return(-1);
+	}
+#endif
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		warn(_("Unable to create a socket"));
+		free(path);
+		return(-1);
+	}
+
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+		warnx(_("A service is already listening on %s"), path);
+		close(fd);
+		free(path);
+		return(-1);
+	}
+	unlink(path);
+
+	/* Only the user may talk to the service */
+	mask = umask(077);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		umask(mask);
+		warn(_("Unable to bind to %s"), path);
+		close(fd);
+		free(path);
+		return(-1);
+	}
+	umask(mask);
+
+	if (listen(fd, SOMAXCONN) == -1) {
+		warn(_("Unable to listen on %s"), path);
+		close(fd);
+		unlink(path);
+		free(path);
+		return(-1);
+	}
+
+	if (options.verbose) {
+		fprintf(stderr, "Listening on %s\n", path);
+	}
+	spath = path;
+
+	return(fd);
+}
+
+/**
+ * Obtain the credentials and connect to the server, unless every
+ * source is local. On failure the next request tries again.
+ *
+ * \parm[out] ctx The context.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+setup(struct mcds *ctx)
+{
+
+	if (mcds_init(ctx, &options)) {
+		return(EXIT_FAILURE);
+	}
+	if (sources_add(ctx)) {
+		goto rtn;
+	}
+	if (sources_remote()) {
+		if (options.preconnect) {
+			cwarm(ctx);
+		}
+		if (read_credentials()) {
+			goto rtn;
+		}
+		if (cwait(ctx)) {
+			goto rtn;
+		}
+		if (ccreds(ctx)) {
+			goto rtn;
+		}
+	}
+
+#ifdef HAVE_UNVEIL
+	if (unveil(NULL, NULL) == -1) {
+		warn(_("Unable to disable further unveil"));
+		goto rtn;
+	}
+#endif
+
+	return(EXIT_SUCCESS);
+
+rtn:
+	mcds_free(ctx);
+	return(EXIT_FAILURE);
+}
+
+/**
+ * Take a context from the pool, creating one if none is waiting.
+ * Blocks while every worker is busy.
+ *
+ * \return The context, NULL if an error was encounted.
+ **/
+static struct mcds *
+pool_get(void)
+{
+	struct mcds *ctx = NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.nidle == 0 && pool.busy == SERVE_WORKERS) {
+		pthread_cond_wait(&pool.cond, &pool.lock);
+	}
+	if (pool.nidle > 0) {
+		ctx = pool.idle[--pool.nidle];
+	} else {
+		ctx = xmalloc(sizeof(struct mcds));
+		if (mcds_init(ctx, &options) || sources_add(ctx) ||
+		    (sources_remote() && ccreds(ctx))) {
+			mcds_free(ctx);
+			free(ctx);
+			pthread_mutex_unlock(&pool.lock);
+			return(NULL);
+		}
+		ctx->flights = &flights;
+	}
+	++pool.busy;
+	pthread_mutex_unlock(&pool.lock);
+
+	return(ctx);
+}
+
+/**
+ * Return a context to the pool.
+ *
+ * \parm[in] ctx The context.
+ **/
+static void
+pool_put(struct mcds *ctx)
+{
+	pthread_mutex_lock(&pool.lock);
+	pool.idle[pool.nidle++] = ctx;
+	--pool.busy;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * Body of a worker thread, answering one connection.
+ **/
+static void *
+worker(void *arg)
+{
+	struct job *j = (struct job *)arg;
+
+	handle(j->ctx, j->fd);
+	close(j->fd);
+	pool_put(j->ctx);
+	free(j);
+
+	return(NULL);
+}
+
+/**
+ * Hand a connection to a worker thread. If no thread can be started
+ * the lookup is answered before accepting another.
+ *
+ * \parm[in] fd The client connection.
+ **/
+static void
+dispatch(int fd)
+{
+	pthread_t tid;
+	pthread_attr_t attr;
+	struct job *j = NULL;
+
+	j = xmalloc(sizeof(struct job));
+	j->fd = fd;
+	if ((j->ctx = pool_get()) == NULL) {
+		close(fd);
+		free(j);
+		return;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&tid, &attr, worker, j) != 0) {
+		worker(j);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/**
+ * Answer lookups until the service has been idle for
+ * options.idle_timeout seconds or an error is encountered.
+ *
+ * \parm[in] lfd The listening socket.
+ *
+ * \retval 0 If the service exited because it was idle.
+ * \retval 1 If an error was encounted, or the password was refused.
+ **/
+int
+serve(int lfd)
+{
+	int rtn = EXIT_FAILURE;
+	int cfd = -1;
+	int n = 0;
+	int busy = 0;
+	int ready = 0;
+	struct mcds *ctx = NULL;
+	struct pollfd pfd[2] = {{0}};
+	struct timeval tv = {SERVE_TIMEOUT, 0};
+
+	/* A client going away must not take the service with it */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (flights_init(&flights)) {
+		return(EXIT_FAILURE);
+	}
+	if (pipe(wake) == -1) {
+		warn(_("Unable to create a pipe"));
+		flights_free(&flights);
+		return(EXIT_FAILURE);
+	}
+	fcntl(wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(wake[1], F_SETFD, FD_CLOEXEC);
+
+	pfd[0].fd = lfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = wake[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		n = poll(pfd, 2, options.idle_timeout > 0 ?
+			 options.idle_timeout*1000 : -1);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			warn(_("Unable to wait for a connection"));
+			break;
+		}
+		if (n == 0) {
+			pthread_mutex_lock(&pool.lock);
+			busy = pool.busy;
+			pthread_mutex_unlock(&pool.lock);
+			if (busy) {
+				continue;
+			}
+			if (options.verbose) {
+				fprintf(stderr, "Exiting after %d idle seconds\n",
+					options.idle_timeout);
+			}
+			rtn = EXIT_SUCCESS;
+			break;
+		}
+		if (pfd[1].revents & POLLIN) {
+			warnx(_("The server refused the password, exiting."));
+			break;
+		}
+
+		cfd = accept(lfd, NULL, NULL);
+		if (cfd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED ||
+			    errno == EAGAIN) {
+				continue;
+			}
+			warn(_("Unable to accept a connection"));
+			break;
+		}
+
+		if (socket_peer(cfd)) {
+			warnx(_("Refusing a connection from another user."));
+			close(cfd);
+			continue;
+		}
+
+		/* A client that stalls must not hold a worker forever */
+		if (setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+			       sizeof(tv)) == -1) {
+			warn(_("Unable to set a timeout on a connection"));
+			close(cfd);
+			continue;
+		}
+
+		/* The first context obtains the credentials for the rest */
+		if (!ready) {
+			ctx = xmalloc(sizeof(struct mcds));
+			if (setup(ctx)) {
+				free(ctx);
+				close(cfd);
+				continue;
+			}
+			ctx->flights = &flights;
+			pthread_mutex_lock(&pool.lock);
+			pool.idle[pool.nidle++] = ctx;
+			pthread_mutex_unlock(&pool.lock);
+			ready = 1;
+		}
+		dispatch(cfd);
+	}
+
+	/* Wait for the workers, then release their contexts */
+	pthread_mutex_lock(&pool.lock);
+	while (pool.busy > 0) {
+		pthread_cond_wait(&pool.cond, &pool.lock);
+	}
+	while (pool.nidle > 0) {
+		ctx = pool.idle[--pool.nidle];
+		mcds_free(ctx);
+		free(ctx);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	flights_free(&flights);
+	close(wake[0]);
+	close(wake[1]);
+
+	close(lfd);
+	if (spath) {
+		unlink(spath);
+		free(spath);
+		spath = NULL;
+	}
+
+	return(rtn);
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file serve.h
+ * Internal definitions for the resident lookup service.
+ *
+ * \ingroup serve
+ * \{
+ **/
+
+#ifndef MCDS_SERVE_H
+#define MCDS_SERVE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Create, or adopt an activated, listening socket */
+int serve_listen(void);
+
+/** Serve lookups on the listening socket */
+int serve(int);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_SERVE_H */
+/**
+ * \}
+ **/
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file session.c
+ * Routines to keep the cards of an interactive session.
+ *
+ * A session answers one term after another, as they are typed. The
+ * cards matching a term are kept, unfolded, once its lookup is over.
+ * The server only returns cards whose query field contains the term,
+ * so when the next term contains the last one every card that can
+ * match it has been kept already. Such a lookup is answered by running
+ * the matcher over the kept cards, dropping those that no longer match,
+ * without asking the server again.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "mem.h"
+#include "vcard.h"
+#include "mcds.h"
+#include "session.h"
+
+/**
+ * Does a string contain another, ignoring case.
+ **/
+static int
+contains(const char *s, const char *sub)
+{
+	size_t n = strlen(sub);
+
+	for (; *s; ++s) {
+		if (strncasecmp(s, sub, n) == 0) {
+			return(1);
+		}
+	}
+	return(n == 0);
+}
+
+/**
+ * Can a lookup be answered from the kept cards. It can when the cards
+ * hold the same fields and its term contains the one they were kept for.
+ *
+ * \parm[in] s The session.
+ * \parm[in] q The lookup.
+ *
+ * \retval 1 If the kept cards cover the lookup.
+ * \retval 0 Otherwise.
+ **/
+int
+session_covers(const struct session *s, const struct mcds_query *q)
+{
+	/* Cards found despite typos, or by sound, need not hold a longer term */
+	if (!s->on || !s->valid || q->fuzzy || q->phonetic) {
+		return(0);
+	}
+	if (s->query != q->query || s->search != q->search) {
+		return(0);
+	}
+	return(contains(q->term, s->term));
+}
+
+/**
+ * Drop the kept cards and start keeping those of a lookup.
+ *
+ * \parm[in] s The session.
+ * \parm[in] q The lookup.
+ **/
+void
+session_start(struct session *s, const struct mcds_query *q)
+{
+	size_t i = 0;
+
+	for (i = 0; i < s->ncards; ++i) {
+		free(s->card[i]);
+	}
+	s->ncards = 0;
+	free(s->term);
+	s->term = xmalloc(strlen(q->term) + 1);
+	strcpy(s->term, q->term);
+	s->query = q->query;
+	s->search = q->search;
+	s->valid = 0;
+}
+
+/**
+ * Keep a copy of a card.
+ *
+ * \parm[in] s    The session.
+ * \parm[in] card The unfolded card.
+ **/
+void
+session_keep(struct session *s, const char *card)
+{
+	if (s->ncards == s->max) {
+		s->max = s->max ? 2*s->max : 64;
+		s->card = realloc(s->card, s->max*sizeof(char *));
+		if (s->card == NULL) {
+			err(EXIT_FAILURE, _("Unable to keep the cards"));
+		}
+	}
+	s->card[s->ncards] = xmalloc(strlen(card) + 1);
+	strcpy(s->card[s->ncards], card);
+	s->ncards++;
+}
+
+/**
+ * Mark the kept cards as complete for the term they were kept for.
+ * A lookup that failed part way leaves them incomplete, and the next
+ * term goes to the server.
+ *
+ * \parm[in] s The session.
+ **/
+void
+session_done(struct session *s)
+{
+	s->valid = 1;
+}
+
+/**
+ * Answer the context's lookup from the kept cards. The cards that no
+ * longer match are dropped, so each extension of the term has fewer
+ * cards to look through.
+ *
+ * \parm[in] ctx The context, with its matcher compiled and its output
+ *               open.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+session_refine(struct mcds *ctx)
+{
+	size_t i = 0;
+	size_t n = 0;
+	struct session *s = &ctx->session;
+	const struct mcds_query *q = ctx->q;
+
+	s->valid = 0;
+	for (i = 0; i < s->ncards; ++i) {
+		if (search(ctx, s->card[i]) == 0) {
+			s->card[n++] = s->card[i];
+		} else {
+			free(s->card[i]);
+		}
+	}
+	s->ncards = n;
+
+	free(s->term);
+	s->term = xmalloc(strlen(q->term) + 1);
+	strcpy(s->term, q->term);
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Release the kept cards.
+ *
+ * \parm[in] s The session.
+ **/
+void
+session_free(struct session *s)
+{
+	size_t i = 0;
+
+	for (i = 0; i < s->ncards; ++i) {
+		free(s->card[i]);
+	}
+	free(s->card);
+	free(s->term);
+	s->card = NULL;
+	s->term = NULL;
+	s->ncards = 0;
+	s->max = 0;
+	s->valid = 0;
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file session.h
+ * Internal definitions for keeping the cards of an interactive session.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifndef MCDS_SESSION_H
+#define MCDS_SESSION_H
+
+#include <stddef.h>
+#include "options.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+
+/** The cards a session kept from its last lookup **/
+struct session {
+	int on;				/* Keep the cards of each lookup */
+	int valid;			/* Do the cards cover term */
+	char **card;			/* Unfolded cards */
+	size_t ncards;			/* Number of cards held */
+	size_t max;			/* Allocated number of cards */
+	char *term;			/* Term the cards were kept for */
+	enum s_terms query;		/* Field the term was matched in */
+	enum s_terms search;		/* Field the cards were asked for */
+};
+
+/** Can a lookup be answered from the kept cards */
+int session_covers(const struct session *, const struct mcds_query *);
+
+/** Start keeping the cards of a lookup */
+void session_start(struct session *, const struct mcds_query *);
+
+/** Keep a copy of a card */
+void session_keep(struct session *, const char *);
+
+/** Mark the kept cards as covering the lookup's term */
+void session_done(struct session *);
+
+/** Answer a lookup from the kept cards, keeping only those matched */
+int session_refine(struct mcds *);
+
+/** Release the kept cards */
+void session_free(struct session *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_SESSION_H */
+/**
+ * \}
+ **/
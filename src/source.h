@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file source.h
+ * Internal definitions for the sources of cards.
+ *
+ * A source hands the cards it holds for a lookup to search(), so every
+ * source is matched, ranked and written the same way. A context may
+ * hold several sources; they are searched cheapest first, and once the
+ * ranking heap can no longer be improved the costlier ones are skipped.
+ *
+ * \ingroup lookup
+ * \{
+ **/
+
+#ifndef MCDS_SOURCE_H
+#define MCDS_SOURCE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+
+/** What a source can do **/
+enum src_caps {
+	src_filter = 1 << 0,		/* Only returns cards holding the term */
+	src_remote = 1 << 1		/* Needs credentials and the network */
+};
+
+/** Relative costs of searching a source **/
+#define SRC_COST_FILE    10		/* A single local file */
+#define SRC_COST_DIR     20		/* A directory of files */
+#define SRC_COST_NET    100		/* A round trip to a server */
+
+/** A source of cards **/
+struct source {
+	const char *name;		/* Name, for reports */
+	int caps;			/* Capabilities, of enum src_caps */
+	int cost;			/* Relative cost of a search */
+	void *data;			/* State of the source */
+	/* Hand the cards for the context's lookup to search() */
+	int (*search)(const struct source *, struct mcds *);
+};
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_SOURCE_H */
+/**
+ * \}
+ **/
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file sources.c
+ * Routines to set up the sources of cards named by the options.
+ *
+ * The url, vdir and ldif keys each add a source. The sources are shared
+ * by every context, and searched cheapest first.
+ *
+ * \ingroup main
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "options.h"
+#include "carddav.h"
+#include "ldif.h"
+#include "store.h"
+#include "vdir.h"
+#include "mcds.h"
+#include "sources.h"
+
+static struct source src[MCDS_SOURCES];	/**< The sources */
+static int nsrc = 0;			/**< Number of sources */
+static struct vdir vdir;		/**< Local vdir */
+static struct ldif ldif;		/**< Local LDIF export */
+static struct store store;		/**< Local copy of the server's cards */
+
+/**
+ * Set up the sources named by the options.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+sources_open(void)
+{
+	if (options.url) {
+		if (options.sync && store_init(&store, &options)) {
+			goto rtn;
+		}
+		carddav_source(&src[nsrc++], options.sync ? &store : NULL);
+	}
+	if (options.vdir) {
+		if (vdir_init(&vdir, options.vdir, options.verbose)) {
+			goto rtn;
+		}
+		vdir_source(&src[nsrc++], &vdir);
+	}
+	if (options.ldif) {
+		if (ldif_init(&ldif, options.ldif, options.verbose)) {
+			goto rtn;
+		}
+		ldif_source(&src[nsrc++], &ldif);
+	}
+
+	if (nsrc == 0) {
+		warnx(_("No url, vdir or ldif to look up cards in."));
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+
+rtn:
+	sources_close();
+	return(EXIT_FAILURE);
+}
+
+/**
+ * Does a source need credentials and the network.
+ *
+ * \retval 1 If a source is remote.
+ * \retval 0 Otherwise.
+ **/
+int
+sources_remote(void)
+{
+	int i = 0;
+
+	for (i = 0; i < nsrc; ++i) {
+		if (src[i].caps & src_remote) {
+			return(1);
+		}
+	}
+	return(0);
+}
+
+/**
+ * Add every source to a context.
+ *
+ * \parm[in] ctx The context.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+sources_add(struct mcds *ctx)
+{
+	int i = 0;
+
+	for (i = 0; i < nsrc; ++i) {
+		if (mcds_source(ctx, &src[i])) {
+			return(EXIT_FAILURE);
+		}
+	}
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Release the sources. No context may be using them.
+ **/
+void
+sources_close(void)
+{
+	vdir_free(&vdir);
+	ldif_free(&ldif);
+	store_free(&store);
+	nsrc = 0;
+}
+
+/**
+ * \}
+ **/
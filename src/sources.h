@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file sources.h
+ * Internal definitions for the configured sources of cards.
+ *
+ * \ingroup main
+ * \{
+ **/
+
+#ifndef MCDS_SOURCES_H
+#define MCDS_SOURCES_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+
+/** Set up the sources named by the options */
+int sources_open(void);
+
+/** Does a source need credentials and the network */
+int sources_remote(void);
+
+/** Add every source to a context */
+int sources_add(struct mcds *);
+
+/** Release the sources, once no context uses them */
+void sources_close(void);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_SOURCES_H */
+/**
+ * \}
+ **/
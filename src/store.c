@@ -0,0 +1,1873 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file store.c
+ * Routines to keep a local copy of the address book, synced with the
+ * sync-collection report of RFC 6578.
+ *
+ * The first sync of a large address book is fetched in pages of
+ * STORE_PAGE cards. Each page is appended to a write ahead log,
+ * followed by the sync token the server gave with it, and the log is
+ * flushed to disk every STORE_BATCH pages and at the end of the sync.
+ * An interrupted sync resumes from the last token that reached the
+ * disk, and the cards of each page can be searched at once. Later
+ * syncs only fetch what changed, and a card whose entity tag is
+ * unchanged is not logged again.
+ *
+ * The log and the snapshot hold records of the form
+ *
+ *     A <href length> <etag length> <card length> <sum>\n<href><etag><card>\n
+ *     D <href length> <sum>\n<href>\n
+ *     T <token length> <sum>\n<token>\n
+ *
+ * for a card added or changed, a card removed, and the token reached,
+ * where the sum is an FNV-1a hash of what follows the header. A record
+ * cut short or garbled by a crash ends the replay, and is dropped by
+ * the next sync.
+ *
+ * The inline binary properties of a card, its PHOTO, LOGO, SOUND and
+ * KEY, are never searched, so they are split from it and logged after
+ * it in a record of their own
+ *
+ *     C <href length> <etag length> <properties length> <sum>\n...
+ *
+ * which the replay skips.
+ *
+ * Once the log outgrows STORE_COMPACT and half the snapshot, every
+ * card, and the token, is written to a new snapshot. The service does
+ * this in a thread while lookups go on, a single lookup in a child
+ * left behind as it exits, so neither waits on it. The
+ * snapshot is flushed and renamed over the old one, and
+ * only then is the log emptied, so a crash at any point leaves a
+ * snapshot and a log that replay to the same cards. Opening the store
+ * reads the snapshot then replays the log's tail.
+ *
+ * The snapshot starts with a cold segment, a record
+ *
+ *     S <segment length> <sum>\n<C records>\n
+ *
+ * holding the binary properties of the cards, which is never read but
+ * to be copied by the next compaction. When built with Zstandard, the
+ * cards follow in blocks of about STORE_BLOCK bytes of records
+ *
+ *     Z <dictionary length> <sum>\n<dictionary>\n
+ *     B <block length> <records length> <sum>\n<block>\n
+ *
+ * each compressed with a dictionary trained on the cards themselves.
+ *
+ * The service's lookups never wait on a sync. A thread of its own
+ * syncs the store, woken after each lookup, and only the first lookup,
+ * finding neither a snapshot nor anything synced, waits for the sync.
+ * The sync keeps its own array of the cards and, after each page,
+ * publishes a copy of it that is never changed again, by swapping a
+ * pointer. A lookup enters the current
+ * epoch, by counting itself in, and searches whichever copy was last
+ * published. Publishing flips the epoch and waits for the lookups of
+ * the old one to leave before freeing the old copy and the cards
+ * dropped since, so a lookup takes no lock at all.
+ *
+ * Each card's searchable fields are folded once as it is added, and
+ * each published copy holds them by column, so a lookup only runs the
+ * regex over the cards whose query field holds the term. The service
+ * also indexes the trigrams of the columns once a sync is done. A
+ * single lookup scans the columns, building the index would cost it
+ * more than it saves, and publishes the cards only once it has synced.
+ *
+ * \ingroup carddav
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/entities.h>
+#if HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "cache.h"
+#include "carddav.h"
+#include "curl.h"
+#include "mem.h"
+#include "miss.h"
+#include "xml.h"
+#include "mcds.h"
+#include "store.h"
+#include "vcard.h"
+
+/** Cards asked for in each page of a sync */
+#define STORE_PAGE   1000
+
+/** Pages synced between flushes of the log */
+#define STORE_BATCH  8
+
+/** Smallest log compacted into the snapshot */
+#define STORE_COMPACT (256 << 10)
+
+/** Longest record header */
+#define STORE_HDR    96
+
+/** Records compressed together in a block of the snapshot */
+#define STORE_BLOCK  (64 << 10)
+
+/** Largest dictionary trained for the blocks */
+#define STORE_DICT   (32 << 10)
+
+/** Zstandard compression level of the blocks */
+#define STORE_LEVEL  3
+
+/** Sync request **/
+static const char ssync[] =
+"<?xml version='1.0' encoding='utf-8' ?>\n\
+<D:sync-collection xmlns:D='DAV:'\n\
+                   xmlns:C='urn:ietf:params:xml:ns:carddav'>\n\
+  <D:sync-token>%s</D:sync-token>\n\
+  <D:sync-level>1</D:sync-level>\n\
+  <D:limit><D:nresults>%d</D:nresults></D:limit>\n\
+  <D:prop>\n\
+    <D:getetag/>\n\
+    <C:address-data/>\n\
+  </D:prop>\n\
+</D:sync-collection>";
+
+/** A growing buffer of journal records **/
+struct jbuf {
+	char *data;
+	size_t used;
+	size_t size;
+};
+
+/** A record's header, parsed **/
+struct rhdr {
+	char type;			/* The record's type */
+	size_t f[3];			/* Its lengths */
+	unsigned long sum;		/* Sum of what follows the header */
+	size_t hlen;			/* Length of the header */
+	size_t need;			/* Length of the record */
+};
+
+/** Compresses the blocks of a snapshot **/
+struct packer {
+#if HAVE_ZSTD
+	ZSTD_CCtx *cctx;
+	ZSTD_CDict *dict;
+#endif
+	char *data;			/* A compressed block */
+	size_t size;
+	struct jbuf out;		/* Its record */
+};
+
+static void
+put(struct jbuf *b, const void *p, size_t n)
+{
+	if (b->used + n > b->size) {
+		b->size = 2*(b->used + n);
+		b->data = realloc(b->data, b->size);
+		if (b->data == NULL) {
+			err(EXIT_FAILURE, _("Unable to extend the journal buffer"));
+		}
+	}
+	memcpy(b->data + b->used, p, n);
+	b->used += n;
+}
+
+static unsigned long
+sum(unsigned long h, const char *p, size_t len)
+{
+	size_t i = 0;
+
+	for (i = 0; i < len; ++i) {
+		h ^= (unsigned char)p[i];
+		h *= 16777619UL;
+	}
+	return(h & 0xffffffffUL);
+}
+
+/**
+ * Append a record, of up to three fields, to a buffer.
+ **/
+static void
+record(struct jbuf *b, char type, const char *f0, const char *f1,
+       const char *f2)
+{
+	char hdr[STORE_HDR] = {0};
+	unsigned long h = 2166136261UL;
+	int n = 0;
+
+	h = sum(h, f0, strlen(f0));
+	if (f1) {
+		h = sum(sum(h, f1, strlen(f1)), f2, strlen(f2));
+		n = snprintf(hdr, sizeof(hdr), "%c %zu %zu %zu %lu\n", type,
+			     strlen(f0), strlen(f1), strlen(f2), h);
+	} else {
+		n = snprintf(hdr, sizeof(hdr), "%c %zu %lu\n", type,
+			     strlen(f0), h);
+	}
+	put(b, hdr, n);
+	put(b, f0, strlen(f0));
+	if (f1) {
+		put(b, f1, strlen(f1));
+		put(b, f2, strlen(f2));
+	}
+	put(b, "\n", 1);
+}
+
+#if HAVE_ZSTD
+/**
+ * Append a record of binary data, a dictionary, or a block holding
+ * records of a plain length.
+ **/
+static void
+binrec(struct jbuf *b, char type, const char *p, size_t len, size_t plain)
+{
+	char hdr[STORE_HDR] = {0};
+	unsigned long h = sum(2166136261UL, p, len);
+	int n = 0;
+
+	if (type == 'B') {
+		n = snprintf(hdr, sizeof(hdr), "%c %zu %zu %lu\n", type, len,
+			     plain, h);
+	} else {
+		n = snprintf(hdr, sizeof(hdr), "%c %zu %lu\n", type, len, h);
+	}
+	put(b, hdr, n);
+	put(b, p, len);
+	put(b, "\n", 1);
+}
+#endif
+
+/**
+ * Parse the header of a record.
+ *
+ * \parm[in]  rec The record.
+ * \parm[in]  len Bytes of it at hand.
+ * \parm[out] r   The header.
+ *
+ * \retval 0 If the header is whole.
+ * \retval 1 If it is cut short or garbled.
+ **/
+static int
+head(const char *rec, size_t len, struct rhdr *r)
+{
+	int nf = 0;
+	int np = 0;
+	int i = 0;
+	char *p = NULL;
+	const char *nl = NULL;
+
+	nl = memchr(rec, '\n', len < STORE_HDR ? len : STORE_HDR);
+	if (nl == NULL || nl == rec || rec[1] != ' ') {
+		return(EXIT_FAILURE);
+	}
+	/* The number of fields, then how many are lengths of what follows */
+	switch (rec[0]) {
+	case 'A':
+	case 'C':
+		nf = np = 3;
+		break;
+	case 'B':
+		nf = 2;
+		np = 1;
+		break;
+	case 'D':
+	case 'S':
+	case 'T':
+	case 'Z':
+		nf = np = 1;
+		break;
+	default:
+		return(EXIT_FAILURE);
+	}
+
+	r->type = rec[0];
+	r->need = 0;
+	p = (char *)rec + 1;
+	for (i = 0; i < nf; ++i) {
+		r->f[i] = strtoul(p, &p, 10);
+		if (i < np) {
+			r->need += r->f[i];
+		}
+	}
+	r->sum = strtoul(p, &p, 10);
+	if (p != nl) {
+		return(EXIT_FAILURE);
+	}
+	r->hlen = nl - rec + 1;
+	r->need += r->hlen + 1;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Keep a card block that lookups may still be searching until the next
+ * publish.
+ **/
+static void
+retire(struct store *s, char *p)
+{
+	if (s->nretired == s->maxretired) {
+		s->maxretired = s->maxretired ? 2*s->maxretired : 64;
+		s->retired = realloc(s->retired, s->maxretired*sizeof(char *));
+		if (s->retired == NULL) {
+			err(EXIT_FAILURE, _("Unable to extend the store"));
+		}
+	}
+	s->retired[s->nretired++] = p;
+}
+
+/**
+ * Hold a card, replacing the one with the same href.
+ **/
+static void
+add(struct store *s, const char *href, size_t hlen, const char *etag,
+    size_t elen, const char *card, size_t clen)
+{
+	int held = 0;
+	size_t *idx = NULL;
+	size_t base = hlen + elen + clen + 3;
+	size_t fl = 0;
+	size_t nsound = 0;
+	uint32_t flen[nterms];
+	char *p = NULL;
+	struct s_card *c = NULL;
+
+	p = xmalloc(base);
+	memcpy(p, href, hlen);
+	p[hlen] = '\0';
+	memcpy(p + hlen + 1, etag, elen);
+	p[hlen + 1 + elen] = '\0';
+	memcpy(p + hlen + elen + 2, card, clen);
+	p[hlen + elen + 2 + clen] = '\0';
+
+	/* The folded fields, then the sounds of the names, follow the card */
+	unfold(&s->fold, p + hlen + elen + 2, 0);
+	fl = table_fold(p + hlen + elen + 2, NULL, flen);
+	if ((p = realloc(p, base + fl)) == NULL) {
+		err(EXIT_FAILURE, _("Unable to extend the store"));
+	}
+	table_fold(p + hlen + elen + 2, p + base, flen);
+	fl = (base + fl + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+	nsound = table_sounds(p + base, flen, NULL);
+	if ((p = realloc(p, fl + nsound*sizeof(uint32_t))) == NULL) {
+		err(EXIT_FAILURE, _("Unable to extend the store"));
+	}
+	nsound = table_sounds(p + base, flen, (uint32_t *)(p + fl));
+
+	idx = dedup_add(&s->href, p, hlen, &held);
+	if (held) {
+		c = &s->card[*idx];
+		retire(s, c->href);
+	} else {
+		if (s->ncards == s->max) {
+			s->max = s->max ? 2*s->max : 64;
+			s->card = realloc(s->card,
+					  s->max*sizeof(struct s_card));
+			if (s->card == NULL) {
+				err(EXIT_FAILURE, _("Unable to extend the store"));
+			}
+		}
+		*idx = s->ncards;
+		c = &s->card[s->ncards++];
+	}
+	c->href = p;
+	c->etag = p + hlen + 1;
+	c->card = p + hlen + elen + 2;
+	c->fields = p + base;
+	memcpy(c->flen, flen, sizeof(flen));
+	c->sound = (uint32_t *)(p + fl);
+	c->nsound = nsound;
+	s->changed = 1;
+}
+
+/**
+ * Drop the card with an href, the last card takes its place.
+ **/
+static void
+del(struct store *s, const char *href, size_t hlen)
+{
+	size_t i = 0;
+	size_t *idx = NULL;
+	struct s_card *last = NULL;
+
+	if ((idx = dedup_find(&s->href, href, hlen)) == NULL) {
+		return;
+	}
+	i = *idx;
+	retire(s, s->card[i].href);
+	s->changed = 1;
+	dedup_del(&s->href, href, hlen);
+
+	last = &s->card[--s->ncards];
+	if (i != s->ncards) {
+		s->card[i] = *last;
+		idx = dedup_find(&s->href, last->href, strlen(last->href));
+		*idx = i;
+	}
+}
+
+/**
+ * Drop every card and the token.
+ **/
+static void
+clear(struct store *s)
+{
+	size_t i = 0;
+
+	for (i = 0; i < s->ncards; ++i) {
+		retire(s, s->card[i].href);
+	}
+	s->ncards = 0;
+	dedup_free(&s->href);
+	dedup_init(&s->href, 0);
+	free(s->token);
+	s->token = NULL;
+	s->changed = 1;
+}
+
+static size_t replay(struct store *, const char *, size_t);
+
+#if HAVE_ZSTD
+/**
+ * Apply the records of a block of the snapshot, which must all be
+ * whole.
+ *
+ * \retval 0 If the block was applied.
+ * \retval 1 If it could not be decompressed.
+ **/
+static int
+unpack(struct store *s, ZSTD_DCtx *dctx, const ZSTD_DDict *dict,
+       const char *p, size_t len, size_t plain)
+{
+	int rtn = EXIT_FAILURE;
+	size_t n = 0;
+	char *data = NULL;
+
+	data = xmalloc(plain + 1);
+	n = ZSTD_decompress_usingDDict(dctx, data, plain, p, len, dict);
+	if (!ZSTD_isError(n) && n == plain && replay(s, data, n) == n) {
+		rtn = EXIT_SUCCESS;
+	}
+	free(data);
+
+	return(rtn);
+}
+#endif
+
+/**
+ * Apply the complete records of part of the log or snapshot. The
+ * binary properties of the cards are skipped, and the blocks of a
+ * snapshot are only understood when built with Zstandard.
+ *
+ * \return The bytes of complete records applied.
+ **/
+static size_t
+replay(struct store *s, const char *data, size_t len)
+{
+	size_t done = 0;
+	char *p = NULL;
+	const char *rec = NULL;
+	struct rhdr r;
+#if HAVE_ZSTD
+	ZSTD_DCtx *dctx = NULL;
+	ZSTD_DDict *dict = NULL;
+#endif
+
+	while (done < len) {
+		rec = data + done;
+		if (head(rec, len - done, &r) || len - done < r.need ||
+		    rec[r.need - 1] != '\n' ||
+		    sum(2166136261UL, rec + r.hlen,
+			r.need - r.hlen - 1) != r.sum) {
+			break;
+		}
+
+		p = (char *)rec + r.hlen;
+		switch (r.type) {
+		case 'A':
+			add(s, p, r.f[0], p + r.f[0], r.f[1],
+			    p + r.f[0] + r.f[1], r.f[2]);
+			break;
+		case 'D':
+			del(s, p, r.f[0]);
+			break;
+		case 'T':
+			free(s->token);
+			s->token = xmalloc(r.f[0] + 1);
+			memcpy(s->token, p, r.f[0]);
+			s->token[r.f[0]] = '\0';
+			s->changed = 1;
+			break;
+		case 'C':
+		case 'S':
+			break;
+#if HAVE_ZSTD
+		case 'Z':
+			ZSTD_freeDDict(dict);
+			if ((dict = ZSTD_createDDict(p, r.f[0])) == NULL) {
+				goto rtn;
+			}
+			break;
+		case 'B':
+			if (dctx == NULL && (dctx = ZSTD_createDCtx()) == NULL) {
+				goto rtn;
+			}
+			if (unpack(s, dctx, dict, p, r.f[0], r.f[1])) {
+				goto rtn;
+			}
+			break;
+#endif
+		default:
+			goto rtn;
+		}
+		done += r.need;
+	}
+
+rtn:
+#if HAVE_ZSTD
+	ZSTD_freeDCtx(dctx);
+	ZSTD_freeDDict(dict);
+#endif
+
+	return(done);
+}
+
+/**
+ * Replay a file from an offset.
+ *
+ * \return The bytes of complete records applied, -1 on an error.
+ **/
+static off_t
+replay_file(struct store *s, int fd, const char *path, off_t from,
+	    off_t to)
+{
+	size_t len = to - from;
+	size_t got = 0;
+	ssize_t n = 0;
+	char *data = NULL;
+
+	if (to <= from) {
+		return(0);
+	}
+	data = xmalloc(len + 1);
+	while (got < len) {
+		n = pread(fd, data + got, len - got, from + got);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		got += n;
+	}
+	if (n < 0) {
+		warn(_("Unable to read %s"), path);
+		free(data);
+		return(-1);
+	}
+	got = replay(s, data, got);
+	free(data);
+
+	return(got);
+}
+
+/**
+ * Publish a copy of the sync's cards for lookups, then wait for the
+ * lookups that may hold the copy before to finish, and free it with the
+ * cards dropped since. Only the sync calls this.
+ *
+ * \parm[in] s     The store.
+ * \parm[in] index Index the trigrams of the copy, once a sync is done,
+ *                  if the service keeps the store.
+ **/
+static void
+publish(struct store *s, int index)
+{
+	int t = 0;
+	size_t i = 0;
+	size_t nsounds = 0;
+	size_t size[nterms] = {0};
+	unsigned long e = 0;
+	struct s_view *v = NULL;
+	struct s_view *old = NULL;
+
+	v = xmalloc(sizeof(struct s_view));
+	v->card = xmalloc((s->ncards + 1)*sizeof(struct s_card));
+	memcpy(v->card, s->card, s->ncards*sizeof(struct s_card));
+	v->ncards = s->ncards;
+	v->synced = s->token != NULL;
+	for (i = 0; i < s->ncards; ++i) {
+		for (t = 0; t < nterms; ++t) {
+			size[t] += s->card[i].flen[t];
+		}
+		nsounds += s->card[i].nsound;
+	}
+	table_init(&v->table, size, s->ncards, nsounds);
+	for (i = 0; i < s->ncards; ++i) {
+		table_add(&v->table, i, s->card[i].fields, s->card[i].flen,
+			  s->card[i].sound, s->card[i].nsound);
+	}
+	if (index && s->resident) {
+		table_index(&v->table);
+	}
+	s->changed = 0;
+	old = __atomic_exchange_n(&s->view, v, __ATOMIC_SEQ_CST);
+
+	/* New lookups enter the other epoch and can only see the copy */
+	e = __atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&s->epoch, !e, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&s->active[e], __ATOMIC_SEQ_CST)) {
+		sched_yield();
+	}
+
+	if (old) {
+		table_free(&old->table);
+		free(old->card);
+		free(old);
+	}
+	for (i = 0; i < s->nretired; ++i) {
+		free(s->retired[i]);
+	}
+	s->nretired = 0;
+}
+
+/**
+ * Enter the current epoch and take the published cards, which stay
+ * until leave().
+ *
+ * \parm[in]  s The store.
+ * \parm[out] e The epoch entered.
+ *
+ * \return The cards, NULL if none were published.
+ **/
+static const struct s_view *
+enter(struct store *s, unsigned long *e)
+{
+	for (;;) {
+		*e = __atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&s->active[*e], 1, __ATOMIC_SEQ_CST);
+		/* A publish flipped the epoch before this lookup was counted */
+		if (__atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST) == *e) {
+			break;
+		}
+		__atomic_sub_fetch(&s->active[*e], 1, __ATOMIC_SEQ_CST);
+	}
+
+	return(__atomic_load_n(&s->view, __ATOMIC_SEQ_CST));
+}
+
+static void
+leave(struct store *s, unsigned long e)
+{
+	__atomic_sub_fetch(&s->active[e], 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Find where the cards of a snapshot start, past its cold segment.
+ *
+ * \return The offset of the cards.
+ **/
+static off_t
+hot(int fd)
+{
+	char hdr[STORE_HDR] = {0};
+	ssize_t n = 0;
+	struct rhdr r;
+
+	n = pread(fd, hdr, sizeof(hdr), 0);
+	if (n <= 0 || head(hdr, n, &r) || r.type != 'S') {
+		return(0);
+	}
+
+	return(r.need);
+}
+
+/**
+ * Bring the cards up to date with the disk. A new snapshot, written by
+ * this or another process, is read whole with the log after it,
+ * otherwise only what was added to the log is replayed. The log must
+ * be locked and the sync mutex held.
+ *
+ * \parm[in] s   The store.
+ * \parm[in] wfd The log.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If the store could not be read.
+ **/
+static int
+refresh(struct store *s, int wfd)
+{
+	int fd = -1;
+	off_t n = 0;
+	struct stat st = {0};
+	struct stat wst;
+
+	if (fstat(wfd, &wst) == -1) {
+		warn(_("Unable to stat %s"), s->wal);
+		return(EXIT_FAILURE);
+	}
+	if ((fd = open(s->path, O_RDONLY | O_CLOEXEC)) != -1 &&
+	    fstat(fd, &st) == -1) {
+		warn(_("Unable to stat %s"), s->path);
+		close(fd);
+		return(EXIT_FAILURE);
+	}
+
+	if (st.st_dev != s->dev || st.st_ino != s->ino ||
+	    wst.st_size < s->end) {
+		clear(s);
+		s->dev = st.st_dev;
+		s->ino = st.st_ino;
+		s->size = 0;
+		s->end = 0;
+		if (fd != -1) {
+			if ((n = replay_file(s, fd, s->path, hot(fd),
+					     st.st_size)) < 0) {
+				close(fd);
+				return(EXIT_FAILURE);
+			}
+			s->size = st.st_size;
+		}
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+
+	if ((n = replay_file(s, wfd, s->wal, s->end, wst.st_size)) < 0) {
+		return(EXIT_FAILURE);
+	}
+	s->end += n;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Write out a buffer of records.
+ *
+ * \parm[in]     fd The file.
+ * \parm[in,out] b  The records, emptied once written.
+ * \parm[in,out] h  Sum of what was written, or NULL.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If they could not be written.
+ **/
+static int
+spill(int fd, struct jbuf *b, unsigned long *h)
+{
+	if (h) {
+		*h = sum(*h, b->data, b->used);
+	}
+	if (b->used && write(fd, b->data, b->used) != (ssize_t)b->used) {
+		return(EXIT_FAILURE);
+	}
+	b->used = 0;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Copy the binary properties of the cards held, from part of the log or
+ * the old snapshot's cold segment, to a new snapshot. Properties kept
+ * for an entity tag the card no longer has are dropped.
+ *
+ * \parm[in]     s    The store.
+ * \parm[in]     fd   The file copied from.
+ * \parm[in]     from Where its records start.
+ * \parm[in]     to   Where they end.
+ * \parm[in]     out  The new snapshot.
+ * \parm[in,out] b    Records waiting to be written to it.
+ * \parm[in,out] h    Sum of the segment.
+ * \parm[in,out] done The cards whose properties were copied.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If the new snapshot could not be written.
+ **/
+static int
+cold(const struct store *s, int fd, off_t from, off_t to, int out,
+     struct jbuf *b, unsigned long *h, char *done)
+{
+	char hdr[STORE_HDR] = {0};
+	char *p = NULL;
+	const char *etag = NULL;
+	ssize_t n = 0;
+	size_t *idx = NULL;
+	struct rhdr r;
+
+	while (from < to) {
+		n = pread(fd, hdr, to - from < STORE_HDR ? to - from : STORE_HDR,
+			  from);
+		if (n <= 0 || head(hdr, n, &r) || (off_t)r.need > to - from) {
+			break;
+		}
+		if (r.type != 'C') {
+			from += r.need;
+			continue;
+		}
+
+		p = xmalloc(r.need);
+		if (pread(fd, p, r.need, from) == (ssize_t)r.need &&
+		    sum(2166136261UL, p + r.hlen, r.need - r.hlen - 1) == r.sum &&
+		    (idx = dedup_find(&s->href, p + r.hlen, r.f[0])) &&
+		    !done[*idx]) {
+			etag = s->card[*idx].etag;
+			if (strlen(etag) == r.f[1] &&
+			    memcmp(etag, p + r.hlen + r.f[0], r.f[1]) == 0) {
+				done[*idx] = 1;
+				put(b, p, r.need);
+			}
+		}
+		free(p);
+		if (b->used >= STORE_COMPACT && spill(out, b, h)) {
+			return(EXIT_FAILURE);
+		}
+		from += r.need;
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+#if HAVE_ZSTD
+/**
+ * Train a dictionary on the first cards for the blocks of a snapshot,
+ * and append it as a record.
+ *
+ * \return The dictionary, NULL if there were too few cards to train.
+ **/
+static ZSTD_CDict *
+train(const struct store *s, struct jbuf *b)
+{
+	size_t i = 0;
+	size_t n = 0;
+	size_t *sizes = NULL;
+	char *dict = NULL;
+	ZSTD_CDict *cdict = NULL;
+	struct jbuf sample = {0};
+
+	/* About a hundred times the dictionary is enough to train on */
+	sizes = xmalloc((s->ncards + 1)*sizeof(size_t));
+	for (i = 0; i < s->ncards && sample.used < 100*STORE_DICT; ++i) {
+		n = sample.used;
+		record(&sample, 'A', s->card[i].href, s->card[i].etag,
+		       s->card[i].card);
+		sizes[i] = sample.used - n;
+	}
+	dict = xmalloc(STORE_DICT);
+	if (i) {
+		n = ZDICT_trainFromBuffer(dict, STORE_DICT, sample.data,
+					  sizes, i);
+		if (!ZDICT_isError(n) &&
+		    (cdict = ZSTD_createCDict(dict, n, STORE_LEVEL))) {
+			binrec(b, 'Z', dict, n, 0);
+		}
+	}
+	free(dict);
+	free(sizes);
+	free(sample.data);
+
+	return(cdict);
+}
+#endif
+
+/**
+ * Write out a buffer of records to a snapshot, compressed as a block
+ * when built with Zstandard. The packer is unused without it.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If they could not be written.
+ **/
+static int
+block(int fd, struct jbuf *b, struct packer *z)
+{
+#if HAVE_ZSTD
+	size_t n = 0;
+
+	if (z->cctx && b->used) {
+		if ((n = ZSTD_compressBound(b->used)) > z->size) {
+			z->size = n;
+			if ((z->data = realloc(z->data, n)) == NULL) {
+				err(EXIT_FAILURE, _("Unable to extend the store"));
+			}
+		}
+		if (z->dict) {
+			n = ZSTD_compress_usingCDict(z->cctx, z->data, z->size,
+						     b->data, b->used, z->dict);
+		} else {
+			n = ZSTD_compressCCtx(z->cctx, z->data, z->size,
+					      b->data, b->used, STORE_LEVEL);
+		}
+		/* Records that do not compress are written as they are */
+		if (!ZSTD_isError(n) && n < b->used) {
+			binrec(&z->out, 'B', z->data, n, b->used);
+			b->used = 0;
+			return(spill(fd, &z->out, NULL));
+		}
+	}
+#else
+	(void)z;
+#endif
+
+	return(spill(fd, b, NULL));
+}
+
+/**
+ * Write the binary properties, then every card and the token, to a new
+ * snapshot, flush it and rename it over the old one, then empty the
+ * log. Lookups may go on, but neither this nor another process may
+ * sync meanwhile, so the sync's cards are read as they are.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+compact(struct store *s, int wfd)
+{
+	int rtn = EXIT_FAILURE;
+	int fd = -1;
+	int ofd = -1;
+	int dfd = -1;
+	size_t i = 0;
+	size_t len = 0;
+	size_t hlen = 0;
+	ssize_t n = 0;
+	unsigned long h = 2166136261UL;
+	char hdr[STORE_HDR] = {0};
+	char *done = NULL;
+	char *tmp = NULL;
+	char *slash = NULL;
+	struct stat st;
+	struct rhdr r;
+	struct jbuf b = {0};
+	struct packer z = {0};
+
+	len = strlen(s->path) + sizeof(".XXXXXX");
+	tmp = xmalloc(len);
+	snprintf(tmp, len, "%s.XXXXXX", s->path);
+	if ((fd = mkstemp(tmp)) == -1) {
+		warn(_("Unable to create %s"), tmp);
+		goto rtn;
+	}
+
+	/* The cold segment's header is filled in once it is written */
+	hlen = snprintf(hdr, sizeof(hdr), "S %020d %010d\n", 0, 0);
+	if (write(fd, hdr, hlen) != (ssize_t)hlen) {
+		warn(_("Unable to write %s"), tmp);
+		goto rtn;
+	}
+	done = xmalloc(s->ncards + 1);
+	if ((ofd = open(s->path, O_RDONLY | O_CLOEXEC)) != -1 &&
+	    (n = pread(ofd, hdr, sizeof(hdr), 0)) > 0 &&
+	    head(hdr, n, &r) == 0 && r.type == 'S' &&
+	    cold(s, ofd, r.hlen, r.need - 1, fd, &b, &h, done)) {
+		warn(_("Unable to write %s"), tmp);
+		goto rtn;
+	}
+	if (cold(s, wfd, 0, s->end, fd, &b, &h, done) ||
+	    spill(fd, &b, &h)) {
+		warn(_("Unable to write %s"), tmp);
+		goto rtn;
+	}
+	len = lseek(fd, 0, SEEK_CUR) - hlen;
+	snprintf(hdr, sizeof(hdr), "S %020zu %010lu\n", len, h);
+	if (write(fd, "\n", 1) != 1 ||
+	    pwrite(fd, hdr, hlen, 0) != (ssize_t)hlen) {
+		warn(_("Unable to write %s"), tmp);
+		goto rtn;
+	}
+
+#if HAVE_ZSTD
+	if ((z.cctx = ZSTD_createCCtx())) {
+		z.dict = train(s, &b);
+	}
+#endif
+	if (spill(fd, &b, NULL)) {
+		warn(_("Unable to write %s"), tmp);
+		goto rtn;
+	}
+
+	/* Cards are written a block at a time, the token after them */
+	for (i = 0; i <= s->ncards; ++i) {
+		if (i < s->ncards) {
+			record(&b, 'A', s->card[i].href, s->card[i].etag,
+			       s->card[i].card);
+		} else if (s->token) {
+			record(&b, 'T', s->token, NULL, NULL);
+		}
+		if ((b.used >= STORE_BLOCK || i == s->ncards) &&
+		    block(fd, &b, &z)) {
+			warn(_("Unable to write %s"), tmp);
+			goto rtn;
+		}
+	}
+
+	if (fsync(fd) == -1 || fstat(fd, &st) == -1) {
+		warn(_("Unable to write %s"), tmp);
+		goto rtn;
+	}
+	if (rename(tmp, s->path) == -1) {
+		warn(_("Unable to rename %s"), tmp);
+		goto rtn;
+	}
+	tmp[0] = '\0';
+
+	/* The rename must reach the disk before the log is emptied */
+	slash = strrchr(s->path, '/');
+	*slash = '\0';
+	dfd = open(s->path, O_RDONLY | O_CLOEXEC);
+	*slash = '/';
+	if (dfd != -1) {
+		fsync(dfd);
+		close(dfd);
+	}
+	if (ftruncate(wfd, 0) == -1 || fdatasync(wfd) == -1) {
+		warn(_("Unable to truncate %s"), s->wal);
+	}
+	s->dev = st.st_dev;
+	s->ino = st.st_ino;
+	s->size = st.st_size;
+	s->end = 0;
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	if (fd != -1) {
+		close(fd);
+	}
+	if (ofd != -1) {
+		close(ofd);
+	}
+	if (tmp[0]) {
+		unlink(tmp);
+	}
+#if HAVE_ZSTD
+	ZSTD_freeCCtx(z.cctx);
+	ZSTD_freeCDict(z.dict);
+#endif
+	free(z.data);
+	free(z.out.data);
+	free(done);
+	free(tmp);
+	free(b.data);
+
+	return(rtn);
+}
+
+/**
+ * Should the log be compacted.
+ **/
+static int
+due(const struct store *s)
+{
+	return(s->end >= STORE_COMPACT && s->end > s->size/2);
+}
+
+/**
+ * Body of the compacting thread.
+ **/
+static void *
+compactor(void *arg)
+{
+	struct store *s = (struct store *)arg;
+	int wfd = -1;
+
+	pthread_mutex_lock(&s->sync);
+	wfd = open(s->wal, O_RDWR | O_CLOEXEC);
+	if (wfd != -1) {
+		flock(wfd, LOCK_EX);
+		/* Another process may have compacted or synced since */
+		if (refresh(s, wfd) == 0 && s->changed) {
+			publish(s, 1);
+		}
+		if (due(s) && compact(s, wfd) == 0 && s->verbose) {
+			fprintf(stderr, "Compacted %s, %zu cards\n", s->path,
+				s->ncards);
+		}
+		close(wfd);
+	}
+	s->compacting = 2;
+	pthread_mutex_unlock(&s->sync);
+
+	return(NULL);
+}
+
+/**
+ * Compact the log in a child of its own session, so whatever waits for
+ * a single lookup to exit, such as mutt, does not wait on it too. The
+ * child lets go of the lookup's input and output, and of its errors
+ * unless the syncs are reported.
+ **/
+static void
+compact_child(struct store *s)
+{
+	int fd = -1;
+	pid_t pid = 0;
+
+	fflush(stdout);
+	if ((pid = fork()) == -1) {
+		warn(_("Unable to start compacting %s"), s->path);
+		return;
+	}
+	if (pid != 0) {
+		return;
+	}
+
+	setsid();
+	if ((fd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		if (!s->verbose) {
+			dup2(fd, STDERR_FILENO);
+		}
+		if (fd > STDERR_FILENO) {
+			close(fd);
+		}
+	}
+	compactor(s);
+	_exit(EXIT_SUCCESS);
+}
+
+/**
+ * Split the inline binary properties of a card from the rest of it.
+ * The card is read where the parser left it, so only what is logged is
+ * copied.
+ *
+ * \parm[in]  card The card, as the server gave it.
+ * \parm[out] hot  The rest of the card.
+ * \parm[out] cold Its binary properties.
+ **/
+static void
+split(const char *card, struct jbuf *hot, struct jbuf *cold)
+{
+	size_t n = 0;
+	const char *line = card;
+
+	hot->used = 0;
+	cold->used = 0;
+	while (*line) {
+		if ((n = binary(line)) > 0) {
+			put(cold, line, n);
+		} else {
+			n = strchrnul(line, '\n') - line;
+			n += line[n] != '\0';
+			put(hot, line, n);
+		}
+		line += n;
+	}
+	put(hot, "", 1);
+	put(cold, "", 1);
+}
+
+/**
+ * Turn a page of the sync into log records. A card the store already
+ * holds with the same entity tag is left out, and the binary
+ * properties of the others are logged apart from them.
+ *
+ * \parm[in]  s     The store.
+ * \parm[in]  res   The response.
+ * \parm[in]  prev  The token the page was asked from.
+ * \parm[out] b     The records.
+ * \parm[out] more  Set if the server has more pages.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If the response could not be parsed, had no token, or
+ *           would have the same page asked for again.
+ **/
+static int
+page(const struct store *s, const char *res, const char *prev,
+     struct jbuf *b, int *more)
+{
+	int rtn = EXIT_FAILURE;
+	xmlDocPtr doc = NULL;
+	xmlNode *root = NULL;
+	xmlNode *r = NULL;
+	xmlNode *n = NULL;
+	xmlNode *data = NULL;
+	xmlChar *href = NULL;
+	xmlChar *status = NULL;
+	xmlChar *etag = NULL;
+	xmlChar *card = NULL;
+	xmlChar *token = NULL;
+	const char *text = NULL;
+	size_t *idx = NULL;
+	struct jbuf hot = {0};
+	struct jbuf cold = {0};
+
+	*more = 0;
+	doc = xmlReadMemory(res, strlen(res), "noname.xml", NULL,
+			    XML_PARSE_NONET | XML_PARSE_HUGE);
+	if (doc == NULL || (root = xmlDocGetRootElement(doc)) == NULL) {
+		warnx(_("Unable to generate an xml document"));
+		goto rtn;
+	}
+
+	for (r = root->children; r; r = r->next) {
+		if (r->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+		if (xmlStrcmp(r->name, (const xmlChar *)"sync-token") == 0) {
+			xmlFree(token);
+			token = xmlNodeGetContent(r);
+			continue;
+		}
+		if (xmlStrcmp(r->name, (const xmlChar *)"response") != 0) {
+			continue;
+		}
+
+		/* A response's own status is only given without properties */
+		href = NULL;
+		status = NULL;
+		for (n = r->children; n; n = n->next) {
+			if (n->type != XML_ELEMENT_NODE) {
+				continue;
+			}
+			if (xmlStrcmp(n->name, (const xmlChar *)"href") == 0) {
+				href = xmlNodeGetContent(n);
+			} else if (xmlStrcmp(n->name,
+					     (const xmlChar *)"status") == 0) {
+				status = xmlNodeGetContent(n);
+			}
+		}
+		if (href == NULL) {
+			xmlFree(status);
+			continue;
+		}
+		if (status && strstr((const char *)status, " 404")) {
+			record(b, 'D', (const char *)href, NULL, NULL);
+		} else if (status && strstr((const char *)status, " 507")) {
+			*more = 1;
+		} else if ((data = xml_find(r->children, "address-data"))) {
+			n = xml_find(r->children, "getetag");
+			etag = n ? xmlNodeGetContent(n) : NULL;
+			idx = dedup_find(&s->href, (const char *)href,
+					 xmlStrlen(href));
+			if (idx == NULL || etag == NULL || etag[0] == '\0' ||
+			    strcmp(s->card[*idx].etag, (const char *)etag)) {
+				text = xml_text(doc, data, &card);
+				split(text ? text : "", &hot, &cold);
+				record(b, 'A', (const char *)href,
+				       etag ? (const char *)etag : "",
+				       hot.data);
+				if (cold.data[0]) {
+					record(b, 'C', (const char *)href,
+					       etag ? (const char *)etag : "",
+					       cold.data);
+				}
+				xmlFree(card);
+			}
+			xmlFree(etag);
+		}
+		xmlFree(href);
+		xmlFree(status);
+	}
+
+	if (token == NULL || token[0] == '\0') {
+		warnx(_("The server gave no sync token."));
+		goto rtn;
+	}
+	if (*more && prev && strcmp(prev, (const char *)token) == 0) {
+		warnx(_("The server repeated the sync token."));
+		goto rtn;
+	}
+	/* Nothing changed, nothing need be written */
+	if (b->used || prev == NULL || strcmp(prev, (const char *)token)) {
+		record(b, 'T', (const char *)token, NULL, NULL);
+	}
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	xmlFree(token);
+	xmlFreeDoc(doc);
+	free(hot.data);
+	free(cold.data);
+
+	return(rtn);
+}
+
+/**
+ * Open the log, locked against other processes, and pick up what they
+ * synced since it was last read.
+ *
+ * \parm[in] s The store.
+ *
+ * \return The log, -1 if an error was encounted.
+ **/
+static int
+open_log(struct store *s)
+{
+	int fd = -1;
+
+	cache_dirs(s->wal);
+	fd = open(s->wal, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		warn(_("Unable to open %s"), s->wal);
+		return(-1);
+	}
+	flock(fd, LOCK_EX);
+
+	/* Pick up what other processes synced, and drop a torn record */
+	if (refresh(s, fd) == 0) {
+		if (ftruncate(fd, s->end) == -1) {
+			warn(_("Unable to truncate %s"), s->wal);
+		}
+		if (s->changed && s->resident) {
+			publish(s, 1);
+		}
+	}
+
+	return(fd);
+}
+
+/**
+ * Sync the store with the server, page by page. The log is locked
+ * against other processes for the whole sync. The service publishes
+ * the cards as each page arrives, for the lookups that do not wait,
+ * and once the log has grown enough starts a thread to compact it.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+sync_pages(struct store *s, struct mcds *ctx)
+{
+	int rtn = EXIT_FAILURE;
+	int fd = -1;
+	int more = 1;
+	int reset = 0;
+	int pages = 0;
+	int dirty = 0;
+	size_t len = 0;
+	char *body = NULL;
+	char *res = NULL;
+	char *start = NULL;
+	xmlChar *tok = NULL;
+	struct jbuf b = {0};
+
+	if ((fd = open_log(s)) == -1) {
+		return(EXIT_FAILURE);
+	}
+	start = s->token ? strdup(s->token) : NULL;
+
+	while (more) {
+		tok = xmlEncodeSpecialChars(NULL,
+		    (const xmlChar *)(s->token ? s->token : ""));
+		len = sizeof(ssync) + xmlStrlen(tok) + 16;
+		body = xmalloc(len);
+		snprintf(body, len, ssync, (const char *)tok, STORE_PAGE);
+		xmlFree(tok);
+
+		if (request(ctx, "REPORT", ctx->dav.url, "1", body, &res)) {
+			/* The token may have expired, start again from none */
+			if (!reset && s->token &&
+			    (ctx->status == 403 || ctx->status == 409)) {
+				if (s->verbose) {
+					fprintf(stderr, "Sync token refused, "
+						"syncing everything\n");
+				}
+				reset = 1;
+				clear(s);
+				if (unlink(s->path) == -1 && errno != ENOENT) {
+					warn(_("Unable to remove %s"), s->path);
+				}
+				if (ftruncate(fd, 0) == -1) {
+					warn(_("Unable to truncate %s"), s->wal);
+				}
+				s->dev = 0;
+				s->ino = 0;
+				s->size = 0;
+				s->end = 0;
+				if (s->resident) {
+					publish(s, 0);
+				}
+				free(body);
+				body = NULL;
+				continue;
+			}
+			warnx(_("Unable to sync the address book: %ld."),
+			      ctx->status);
+			goto rtn;
+		}
+
+		b.used = 0;
+		if (page(s, res, s->token, &b, &more)) {
+			goto rtn;
+		}
+		free(res);
+		res = NULL;
+		free(body);
+		body = NULL;
+		if (b.used == 0) {
+			continue;
+		}
+
+		/* Pages are flushed in batches, and always before the end */
+		if (write(fd, b.data, b.used) != (ssize_t)b.used) {
+			warn(_("Unable to write %s"), s->wal);
+			goto rtn;
+		}
+		if (++dirty == STORE_BATCH) {
+			if (fdatasync(fd) == -1) {
+				warn(_("Unable to write %s"), s->wal);
+				goto rtn;
+			}
+			dirty = 0;
+		}
+		s->end += replay(s, b.data, b.used);
+		if (s->resident) {
+			publish(s, !more);
+		}
+		pages++;
+
+		if (s->verbose && more) {
+			fprintf(stderr, "Synced page %d, %zu cards\n", pages,
+				s->ncards);
+		}
+	}
+	if (dirty && fdatasync(fd) == -1) {
+		warn(_("Unable to write %s"), s->wal);
+		goto rtn;
+	}
+
+	if (s->verbose) {
+		fprintf(stderr, "Synced %d pages to %s, %zu cards\n", pages,
+			s->token, s->ncards);
+	}
+	/* Whatever the server had no cards for may have been added */
+	if (start == NULL || strcmp(start, s->token) != 0) {
+		miss_sync(ctx->opts, s->token);
+	}
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	/* The service's lookups search an indexed copy between syncs */
+	if (s->changed || s->view == NULL ||
+	    (s->resident && !s->view->table.indexed)) {
+		publish(s, 1);
+	}
+	/* The log is compacted once no lookup waits on the sync */
+	if (s->compacting == 2) {
+		pthread_join(s->compactor, NULL);
+		s->compacting = 0;
+	}
+	if (s->resident && s->compacting == 0 && due(s)) {
+		if (pthread_create(&s->compactor, NULL, compactor, s) == 0) {
+			s->compacting = 1;
+		}
+	}
+	close(fd);
+	free(b.data);
+	free(body);
+	free(res);
+	free(start);
+
+	return(rtn);
+}
+
+/**
+ * Body of the service's syncing thread, which syncs the store each
+ * time a lookup asks until the store is released.
+ **/
+static void *
+syncer(void *arg)
+{
+	struct store *s = (struct store *)arg;
+	struct mcds *ctx = NULL;
+
+	pthread_mutex_lock(&s->wake);
+	ctx = s->sctx;
+	for (;;) {
+		while (!s->kicked && !s->stop) {
+			pthread_cond_wait(&s->kick, &s->wake);
+		}
+		if (s->stop) {
+			break;
+		}
+		s->kicked = 0;
+		pthread_mutex_unlock(&s->wake);
+
+		pthread_mutex_lock(&s->sync);
+		if (sync_pages(s, ctx) && ctx->status == 401) {
+			__atomic_store_n(&s->refused, 1, __ATOMIC_SEQ_CST);
+		}
+		pthread_mutex_unlock(&s->sync);
+
+		pthread_mutex_lock(&s->wake);
+	}
+	pthread_mutex_unlock(&s->wake);
+
+	return(NULL);
+}
+
+/**
+ * Ask the syncing thread for a sync. The thread is started the first
+ * time, with a context of its own for the address book the lookup
+ * found.
+ *
+ * \parm[in] s   The store.
+ * \parm[in] ctx The lookup's context.
+ * \parm[in] now Sync now, rather than only start the thread.
+ **/
+static void
+kick(struct store *s, const struct mcds *ctx, int now)
+{
+	struct mcds *c = NULL;
+
+	pthread_mutex_lock(&s->wake);
+	if (s->sctx == NULL) {
+		c = xmalloc(sizeof(struct mcds));
+		if (mcds_init(c, ctx->opts) || ccreds(c) ||
+		    (c->dav.url = strdup(ctx->dav.url)) == NULL) {
+			mcds_free(c);
+			free(c);
+			pthread_mutex_unlock(&s->wake);
+			return;
+		}
+		c->dav.caps = ctx->dav.caps;
+		s->sctx = c;
+		if (pthread_create(&s->syncer, NULL, syncer, s) != 0) {
+			warnx(_("Unable to start syncing the store."));
+			s->sctx = NULL;
+			mcds_free(c);
+			free(c);
+			pthread_mutex_unlock(&s->wake);
+			return;
+		}
+	}
+	if (now) {
+		s->kicked = 1;
+		pthread_cond_signal(&s->kick);
+	}
+	pthread_mutex_unlock(&s->wake);
+}
+
+/**
+ * Initialise a store, kept in the cache directory under a name made
+ * from the server and user. Nothing is read until the first lookup.
+ *
+ * \parm[out] s The store.
+ * \parm[in]  o The options.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+store_init(struct store *s, const struct opts *o)
+{
+	char name[32] = {0};
+	uint64_t h = 14695981039346656037ULL;
+	const char *p = NULL;
+
+	memset(s, 0, sizeof(struct store));
+
+	for (p = o->url; *p; ++p) {
+		h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+	}
+	h *= 1099511628211ULL;
+	for (p = o->username ? o->username : ""; *p; ++p) {
+		h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+	}
+	snprintf(name, sizeof(name), "store-%016llx", (unsigned long long)h);
+	if ((s->path = cache_path(name)) == NULL) {
+		warnx(_("Unable to name the local store."));
+		return(EXIT_FAILURE);
+	}
+	s->wal = xmalloc(strlen(s->path) + sizeof(".wal"));
+	sprintf(s->wal, "%s.wal", s->path);
+
+	if (regcomp(&s->fold, VCARD_FOLD, REG_EXTENDED) != 0) {
+		warnx(_("Unable to build regex pattern."));
+		free(s->path);
+		free(s->wal);
+		s->path = NULL;
+		return(EXIT_FAILURE);
+	}
+	if (pthread_mutex_init(&s->sync, NULL) != 0) {
+		warnx(_("Unable to initialise the store lock."));
+		regfree(&s->fold);
+		free(s->path);
+		free(s->wal);
+		s->path = NULL;
+		return(EXIT_FAILURE);
+	}
+	if (pthread_mutex_init(&s->wake, NULL) != 0 ||
+	    pthread_cond_init(&s->kick, NULL) != 0) {
+		warnx(_("Unable to initialise the store lock."));
+		pthread_mutex_destroy(&s->sync);
+		regfree(&s->fold);
+		free(s->path);
+		free(s->wal);
+		s->path = NULL;
+		return(EXIT_FAILURE);
+	}
+	/* Hrefs are case sensitive, only the same bytes are the same card */
+	s->href.exact = 1;
+	dedup_init(&s->href, 0);
+	s->resident = o->serve;
+	s->verbose = o->verbose;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Release a store and its cards. No lookup may be using it. A single
+ * lookup leaves a child compacting the log, if it has grown enough.
+ *
+ * \parm[in] s The store.
+ **/
+void
+store_free(struct store *s)
+{
+	if (s->path == NULL) {
+		return;
+	}
+	/* A sync under way is left to finish */
+	if (s->sctx) {
+		pthread_mutex_lock(&s->wake);
+		s->stop = 1;
+		pthread_cond_signal(&s->kick);
+		pthread_mutex_unlock(&s->wake);
+		pthread_join(s->syncer, NULL);
+		mcds_free(s->sctx);
+		free(s->sctx);
+	}
+	/* A compaction under way is left to finish */
+	if (s->compacting) {
+		pthread_join(s->compactor, NULL);
+	} else if (!s->resident && due(s)) {
+		compact_child(s);
+	}
+	clear(s);
+	publish(s, 0);
+	table_free(&s->view->table);
+	free(s->view->card);
+	free(s->view);
+	free(s->retired);
+	dedup_free(&s->href);
+	free(s->card);
+	free(s->path);
+	free(s->wal);
+	regfree(&s->fold);
+	pthread_mutex_destroy(&s->sync);
+	pthread_mutex_destroy(&s->wake);
+	pthread_cond_destroy(&s->kick);
+	memset(s, 0, sizeof(struct store));
+}
+
+/**
+ * Search the cards whose query field holds a folded term. When none
+ * match and the lookup allows typos, the cards whose query field comes
+ * within one typo are searched, then within two.
+ *
+ * \parm[in] ctx  The context.
+ * \parm[in] v    The published cards.
+ * \parm[in] term The term, as folded by table_term().
+ **/
+static void
+scan(struct mcds *ctx, const struct s_view *v, const char *term)
+{
+	int typos = 0;
+	size_t len = 0;
+	size_t matched = ctx->matched;
+	char *card = NULL;
+	const char *val = NULL;
+	const struct column *col = &v->table.col[ctx->q->query];
+	struct t_scan sc;
+
+	for (typos = 0; typos <= ctx->q->fuzzy; ++typos) {
+		/* A short term would come near almost anything */
+		if (typos && (ctx->matched != matched ||
+			      strlen(term) <= 2*(size_t)typos)) {
+			break;
+		}
+		if (typos && ctx->opts->verbose) {
+			fprintf(stderr, "Allowing %d typos in %s\n", typos,
+				term);
+		}
+		table_scan(&sc, col, term, typos);
+		while (table_step(&sc)) {
+			if (!ctx->session.on && rank_full(&ctx->rank)) {
+				break;
+			}
+			card = v->card[col->id[sc.row]].card;
+			if (typos == 0) {
+				if (search(ctx, card) == 0 && ctx->session.on) {
+					session_keep(&ctx->session, card);
+				}
+			} else if ((val = table_value(card, ctx->q->query,
+						      sc.nth, &len))) {
+				search_near(ctx, card, val, len);
+			}
+		}
+		table_done(&sc);
+	}
+}
+
+/**
+ * Search the cards whose names sound like each word of the term, from
+ * the sounds found as they were synced.
+ *
+ * \parm[in] ctx  The context.
+ * \parm[in] v    The published cards.
+ **/
+static void
+sound(struct mcds *ctx, const struct s_view *v)
+{
+	size_t i = 0;
+	size_t n = 0;
+	size_t len = 0;
+	size_t *ids = NULL;
+	char *card = NULL;
+	const char *val = NULL;
+
+	n = table_sound(&v->table, ctx->q->term, &ids);
+	for (i = 0; i < n; ++i) {
+		if (!ctx->session.on && rank_full(&ctx->rank)) {
+			break;
+		}
+		card = v->card[ids[i]].card;
+		if ((val = table_value(card, name, 0, &len))) {
+			search_near(ctx, card, val, len);
+		}
+	}
+	free(ids);
+}
+
+/**
+ * Is there nothing for lookups to search yet.
+ **/
+static int
+empty(struct store *s)
+{
+	int rtn = 0;
+	unsigned long e = 0;
+	const struct s_view *v = NULL;
+
+	v = enter(s, &e);
+	rtn = v == NULL || (!v->synced && v->ncards == 0);
+	leave(s, e);
+
+	return(rtn);
+}
+
+/**
+ * Sync the store with the server, then search its cards for the
+ * context's lookup, stopping early once the ranking heap can no
+ * longer be improved, unless a session is keeping the matched cards.
+ * Only the cards whose query field holds the term are searched, when
+ * the columns can tell, and if none do and the lookup allows typos,
+ * those whose query field comes near it. A phonetic lookup of the
+ * name searches the cards whose names sound like the term instead.
+ * The service searches the cards last published and then has its
+ * syncing thread sync them, only syncing first when there are none
+ * yet. If the server can not be reached a store synced before is
+ * still searched.
+ *
+ * \parm[in] s   The store.
+ * \parm[in] ctx The context, with its matcher compiled and its output
+ *               open, and the address book found.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+store_search(struct store *s, struct mcds *ctx)
+{
+	int rtn = EXIT_SUCCESS;
+	int fd = -1;
+	int synced = 0;
+	size_t i = 0;
+	unsigned long e = 0;
+	char *card = NULL;
+	char *term = NULL;
+	const struct s_view *v = NULL;
+
+	if (!s->resident) {
+		pthread_mutex_lock(&s->sync);
+		rtn = sync_pages(s, ctx);
+		pthread_mutex_unlock(&s->sync);
+	} else if (__atomic_load_n(&s->refused, __ATOMIC_SEQ_CST)) {
+		/* The service must obtain the credentials anew */
+		ctx->status = 401;
+		return(EXIT_FAILURE);
+	} else if (empty(s)) {
+		pthread_mutex_lock(&s->sync);
+		/* A snapshot on disk will do until the syncer catches up */
+		if (empty(s) && (fd = open_log(s)) != -1) {
+			close(fd);
+		}
+		if (empty(s)) {
+			rtn = sync_pages(s, ctx);
+			synced = 1;
+		}
+		pthread_mutex_unlock(&s->sync);
+	}
+	v = enter(s, &e);
+	if (rtn) {
+		if (ctx->status == 401 || v == NULL || !v->synced) {
+			leave(s, e);
+			return(EXIT_FAILURE);
+		}
+		warnx(_("Searching the local copy of the address book."));
+	}
+	if (v && ctx->q->phonetic && ctx->q->query == name) {
+		sound(ctx, v);
+		v = NULL;
+	} else if (v && (term = table_term(ctx->q->term))) {
+		scan(ctx, v, term);
+	}
+	for (i = 0; v && term == NULL && i < v->ncards; ++i) {
+		if (!ctx->session.on && rank_full(&ctx->rank)) {
+			break;
+		}
+		card = v->card[i].card;
+		if (search(ctx, card) == 0 && ctx->session.on) {
+			session_keep(&ctx->session, card);
+		}
+	}
+	leave(s, e);
+	free(term);
+
+	if (s->resident) {
+		kick(s, ctx, !synced);
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * \}
+ **/
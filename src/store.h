@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file store.h
+ * Internal definitions for keeping a local copy of the address book.
+ *
+ * \ingroup carddav
+ * \{
+ **/
+
+#ifndef MCDS_STORE_H
+#define MCDS_STORE_H
+
+#include <pthread.h>
+#include <regex.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "dedup.h"
+#include "options.h"
+#include "table.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+
+/** A card held in the store **/
+struct s_card {
+	char *href;			/* The card's resource on the server */
+	char *etag;			/* Its entity tag, in the same block */
+	char *card;			/* The card, unfolded, in the same block */
+	char *fields;			/* Its fields folded, in the same block */
+	uint32_t flen[nterms];		/* Length of each field's values */
+	uint32_t *sound;		/* Sounds of its names, in the same block */
+	uint32_t nsound;		/* Number of them */
+};
+
+/** The cards lookups search, never changed once published **/
+struct s_view {
+	struct s_card *card;		/* The cards */
+	size_t ncards;			/* Number of cards */
+	struct table table;		/* Their fields, by column */
+	int synced;			/* A token has been reached */
+};
+
+/** The local copy of an address book, shared by contexts **/
+struct store {
+	pthread_mutex_t sync;		/* Held while syncing or compacting */
+	struct s_view *view;		/* Published cards, swapped whole */
+	unsigned long epoch;		/* Epoch lookups enter */
+	unsigned long active[2];	/* Lookups in each epoch */
+	int changed;			/* Cards changed since published */
+	char **retired;			/* Card blocks dropped since published */
+	size_t nretired;
+	size_t maxretired;
+	char *path;			/* The snapshot */
+	char *wal;			/* The write ahead log */
+	char *token;			/* Sync token of the last page kept */
+	regex_t fold;			/* Continuation fold */
+	struct s_card *card;		/* The cards, seen only by the sync */
+	size_t ncards;			/* Number of cards */
+	size_t max;			/* Cards allocated */
+	struct dedup href;		/* Index of each card, by href */
+	dev_t dev;			/* Snapshot replayed */
+	ino_t ino;
+	off_t size;			/* Its size */
+	off_t end;			/* Log bytes replayed */
+	pthread_t compactor;		/* Compacting thread */
+	int compacting;			/* 1 while it runs, 2 once finished */
+	int resident;			/* Kept by the service between lookups */
+	pthread_mutex_t wake;		/* Guards the syncer's fields */
+	pthread_cond_t kick;		/* Signalled when a sync is wanted */
+	pthread_t syncer;		/* Syncing thread of the service */
+	struct mcds *sctx;		/* Its context, NULL until it starts */
+	int kicked;			/* A lookup wants a sync */
+	int stop;			/* The syncer is to exit */
+	int refused;			/* The server refused the syncer */
+	int verbose;			/* Report the syncs */
+};
+
+/** Initialise a store for the server, nothing is read until a lookup */
+int store_init(struct store *, const struct opts *);
+
+/** Release a store and its cards */
+void store_free(struct store *);
+
+/** Sync the store with the server, then search it */
+int store_search(struct store *, struct mcds *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_STORE_H */
+/**
+ * \}
+ **/
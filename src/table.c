@@ -0,0 +1,863 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/**
+ * \file table.c
+ * Routines to hold the searchable fields of cards by column.
+ *
+ * Finding the cards with a term in their name used to mean running the
+ * query regex over the whole of every card, photos and all. A table
+ * instead keeps each field of STERMS_TABLE in a column of its own: the
+ * values of every card, lower cased and each ended by a newline, in one
+ * pool, with the offset of each card's row and the card it came from.
+ * A lookup searches the pool of its query field with memmem(3), and
+ * only the cards of the rows found are handed to the regex, which
+ * still decides what matched.
+ *
+ * Once a sync is complete each column also indexes the trigrams of its
+ * values: the sorted trigrams, and for each the rows holding it as
+ * varint coded gaps. A term of three or more bytes is then only looked
+ * for in the rows holding all of its trigrams. A lookup allowing typos
+ * keeps the rows holding all but three trigrams per typo, and checks
+ * each value by its edit distance to the term.
+ *
+ * The query regex is case insensitive and the term is quoted, so a
+ * term of plain ASCII is found in a row exactly when the regex could
+ * match that field. Terms holding regex operators, or other bytes, are
+ * left to the regex over every card.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "defs.h"
+#include "mem.h"
+#include "mcds.h"
+#include "phonetic.h"
+#include "table.h"
+
+/**
+ * Find where a field's value starts on a line, as the query regex
+ * ^NAME([A-Za-z;=])*: would.
+ *
+ * \return The value, NULL if the line is not the field.
+ **/
+static const char *
+value(const char *line, const char *end, const char *name)
+{
+	size_t n = strlen(name);
+	const char *p = line + n;
+
+	if ((size_t)(end - line) <= n || strncasecmp(line, name, n) != 0) {
+		return(NULL);
+	}
+	while (p < end && (isalpha((unsigned char)*p) || *p == ';' ||
+			   *p == '=')) {
+		++p;
+	}
+
+	return(p < end && *p == ':' ? p + 1 : NULL);
+}
+
+/**
+ * Fold the searchable fields of an unfolded card, field by field in
+ * the order of STERMS_TABLE.
+ *
+ * \parm[in]  card The card.
+ * \parm[out] out  The folded values, each ended by a newline, or NULL
+ *                 to only measure them.
+ * \parm[out] len  The length of each field's values.
+ *
+ * \return The length of all the values.
+ **/
+size_t
+table_fold(const char *card, char *out, uint32_t *len)
+{
+	int t = 0;
+	size_t total = 0;
+	const char *line = NULL;
+	const char *end = NULL;
+	const char *v = NULL;
+
+	for (t = 0; t < nterms; ++t) {
+		len[t] = 0;
+		for (line = card; *line; line = *end ? end + 1 : end) {
+			end = strchrnul(line, '\n');
+			if ((v = value(line, end, sterm_name[t])) == NULL) {
+				continue;
+			}
+			for (; v < end; ++v) {
+				if (*v == '\r' && v + 1 == end) {
+					break;
+				}
+				if (out) {
+					out[total] = tolower((unsigned char)*v);
+				}
+				++total;
+				++len[t];
+			}
+			if (out) {
+				out[total] = '\n';
+			}
+			++total;
+			++len[t];
+		}
+	}
+
+	return(total);
+}
+
+/**
+ * Is a byte part of a word, a letter or digit or part of a multibyte
+ * character.
+ **/
+static int
+word(unsigned char c)
+{
+	return(isalnum(c) || c >= 0x80);
+}
+
+/**
+ * Find the sounds of each word of the names in a card's folded fields,
+ * both Double Metaphone codes of each, without repeats.
+ *
+ * \parm[in]  fields The folded fields.
+ * \parm[in]  len    The length of each field's values.
+ * \parm[out] out    The sounds, or NULL to only count them.
+ *
+ * \return The number of sounds.
+ **/
+size_t
+table_sounds(const char *fields, const uint32_t *len, uint32_t *out)
+{
+	int t = 0;
+	int k = 0;
+	size_t i = 0;
+	size_t n = 0;
+	size_t w = 0;
+	uint32_t code[2] = {0};
+	const char *p = NULL;
+	const char *end = NULL;
+
+	for (t = 0; t < name; ++t) {
+		fields += len[t];
+	}
+	end = fields + len[name];
+	for (p = fields; p < end; p += w) {
+		for (w = 0; p + w < end && word((unsigned char)p[w]); ++w);
+		if (w == 0) {
+			++w;
+			continue;
+		}
+		phonetic(p, w, code);
+		for (k = 0; k < 2 && code[k]; ++k) {
+			for (i = 0; out && i < n && out[i] != code[k]; ++i);
+			if (out == NULL || i == n) {
+				if (out) {
+					out[n] = code[k];
+				}
+				++n;
+			}
+		}
+	}
+
+	return(n);
+}
+
+/**
+ * Size a table for the folded fields and name sounds of a set of cards.
+ *
+ * \parm[out] t       The table.
+ * \parm[in]  size    The length of each field's values.
+ * \parm[in]  ncards  The most rows any column will have.
+ * \parm[in]  nsounds The number of name sounds.
+ **/
+void
+table_init(struct table *t, const size_t *size, size_t ncards,
+	   size_t nsounds)
+{
+	int i = 0;
+
+	memset(t, 0, sizeof(struct table));
+	for (i = 0; i < nterms; ++i) {
+		t->col[i].pool = xmalloc(size[i] + 1);
+		t->col[i].off = xmalloc((ncards + 1)*sizeof(size_t));
+		t->col[i].id = xmalloc((ncards + 1)*sizeof(size_t));
+		t->col[i].off[0] = 0;
+	}
+	t->sound = xmalloc((nsounds + 1)*sizeof(uint64_t));
+}
+
+/**
+ * Add a card's fields, as folded by table_fold(), to each column that
+ * the card has a value for, and the sounds of its names.
+ *
+ * \parm[in] t      The table.
+ * \parm[in] id     The card.
+ * \parm[in] fields The folded fields.
+ * \parm[in] len    The length of each field's values.
+ * \parm[in] sound  The sounds of its names, from table_sounds().
+ * \parm[in] nsound The number of them.
+ **/
+void
+table_add(struct table *t, size_t id, const char *fields,
+	  const uint32_t *len, const uint32_t *sound, size_t nsound)
+{
+	int i = 0;
+	size_t j = 0;
+	struct column *c = NULL;
+
+	for (j = 0; j < nsound; ++j) {
+		t->sound[t->nsounds++] = (uint64_t)sound[j] << 32 | id;
+	}
+
+	for (i = 0; i < nterms; ++i) {
+		if (len[i] == 0) {
+			continue;
+		}
+		c = &t->col[i];
+		memcpy(c->pool + c->off[c->nrows], fields, len[i]);
+		c->id[c->nrows] = id;
+		c->off[c->nrows + 1] = c->off[c->nrows] + len[i];
+		c->nrows++;
+		fields += len[i];
+	}
+}
+
+/**
+ * Release a table.
+ *
+ * \parm[in] t The table.
+ **/
+void
+table_free(struct table *t)
+{
+	int i = 0;
+
+	for (i = 0; i < nterms; ++i) {
+		free(t->col[i].pool);
+		free(t->col[i].off);
+		free(t->col[i].id);
+		free(t->col[i].gram.key);
+		free(t->col[i].gram.post);
+		free(t->col[i].gram.rows);
+	}
+	free(t->sound);
+	free(t->idx.key);
+	free(t->idx.post);
+	free(t->idx.rows);
+	memset(t, 0, sizeof(struct table));
+}
+
+/**
+ * Fold a lookup's term for searching the columns.
+ *
+ * \parm[in] term The term.
+ *
+ * \return The lower cased term, NULL if it holds a regex operator or a
+ *         byte outside of printable ASCII.
+ **/
+char *
+table_term(const char *term)
+{
+	size_t i = 0;
+	char *f = NULL;
+
+	if (strpbrk(term, "*?[]^$|{}\\")) {
+		return(NULL);
+	}
+	f = xmalloc(strlen(term) + 1);
+	for (i = 0; term[i]; ++i) {
+		if (!isprint((unsigned char)term[i]) ||
+		    (unsigned char)term[i] >= 0x80) {
+			free(f);
+			return(NULL);
+		}
+		f[i] = tolower((unsigned char)term[i]);
+	}
+	f[i] = '\0';
+
+	return(f);
+}
+
+/**
+ * The trigram starting at a byte.
+ **/
+static uint32_t
+tri(const char *p)
+{
+	return((uint32_t)(unsigned char)p[0] << 16 |
+	       (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2]);
+}
+
+static int
+cmp_pair(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return(x < y ? -1 : x > y);
+}
+
+static int
+cmp_gram(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return(x < y ? -1 : x > y);
+}
+
+/**
+ * Index pairs of a key and a row, sorting them. Each key's rows are
+ * kept in order as the varint gaps between them.
+ **/
+static void
+build(struct t_index *x, uint64_t *pair, size_t np)
+{
+	size_t r = 0;
+	size_t i = 0;
+	size_t nk = 0;
+	size_t n = 0;
+	size_t gap = 0;
+	size_t prev = 0;
+	uint32_t k = 0;
+
+	qsort(pair, np, sizeof(uint64_t), cmp_pair);
+	for (i = 0; i < np; ++i) {
+		if (i == 0 || pair[i] >> 32 != pair[i - 1] >> 32) {
+			++nk;
+		}
+	}
+	x->key = xmalloc((nk + 1)*sizeof(uint32_t));
+	x->post = xmalloc((nk + 1)*sizeof(size_t));
+	x->rows = xmalloc(5*np + 1);
+
+	for (i = 0, nk = 0; i < np; ++i) {
+		k = pair[i] >> 32;
+		r = pair[i] & 0xffffffffUL;
+		if (i == 0 || k != pair[i - 1] >> 32) {
+			x->key[nk] = k;
+			x->post[nk++] = n;
+			prev = 0;
+		} else if (r == prev) {
+			continue;
+		}
+		/* Seven bits at a time, the last byte without the high bit */
+		for (gap = r - prev; gap >= 0x80; gap >>= 7) {
+			x->rows[n++] = (gap & 0x7f) | 0x80;
+		}
+		x->rows[n++] = gap;
+		prev = r;
+	}
+	x->post[nk] = n;
+	x->nkeys = nk;
+}
+
+/**
+ * Index the trigrams of a column, taken within each value.
+ **/
+static void
+index_column(struct column *c)
+{
+	size_t r = 0;
+	size_t i = 0;
+	size_t np = 0;
+	uint64_t *pair = NULL;
+	const char *p = NULL;
+
+	pair = xmalloc((c->off[c->nrows] + 1)*sizeof(uint64_t));
+	for (r = 0; r < c->nrows; ++r) {
+		for (i = c->off[r]; i + 3 <= c->off[r + 1]; ++i) {
+			p = c->pool + i;
+			if (p[0] != '\n' && p[1] != '\n' && p[2] != '\n') {
+				pair[np++] = (uint64_t)tri(p) << 32 | r;
+			}
+		}
+	}
+	build(&c->gram, pair, np);
+	free(pair);
+}
+
+/**
+ * Index the trigrams of each column of a table, and the sounds of the
+ * names.
+ *
+ * \parm[in] t The table.
+ **/
+void
+table_index(struct table *t)
+{
+	int i = 0;
+
+	for (i = 0; i < nterms; ++i) {
+		index_column(&t->col[i]);
+	}
+	build(&t->idx, t->sound, t->nsounds);
+	t->indexed = 1;
+}
+
+/**
+ * Decode the rows of a key.
+ *
+ * \return The rows, NULL if no row holds the key.
+ **/
+static size_t *
+postings(const struct t_index *x, uint32_t g, size_t *n)
+{
+	size_t r = 0;
+	size_t gap = 0;
+	size_t *rows = NULL;
+	int shift = 0;
+	const uint32_t *at = NULL;
+	const unsigned char *p = NULL;
+	const unsigned char *end = NULL;
+
+	*n = 0;
+	at = bsearch(&g, x->key, x->nkeys, sizeof(uint32_t), cmp_gram);
+	if (at == NULL) {
+		return(NULL);
+	}
+	p = x->rows + x->post[at - x->key];
+	end = x->rows + x->post[at - x->key + 1];
+	rows = xmalloc((end - p + 1)*sizeof(size_t));
+	while (p < end) {
+		for (gap = 0, shift = 0; *p & 0x80; ++p, shift += 7) {
+			gap |= (size_t)(*p & 0x7f) << shift;
+		}
+		gap |= (size_t)*p++ << shift;
+		r += gap;
+		rows[(*n)++] = r;
+	}
+
+	return(rows);
+}
+
+/**
+ * Find the rows that may hold a term from the index. Without typos the
+ * rows of all of its trigrams are intersected, otherwise a row must
+ * hold all but three of its trigrams for each typo.
+ *
+ * \return 1 If the rows were found, 0 if the index can not narrow them.
+ **/
+static int
+candidates(struct t_scan *sc)
+{
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	size_t n = 0;
+	size_t ng = 0;
+	size_t kept = 0;
+	long need = 0;
+	uint32_t *g = NULL;
+	uint32_t *count = NULL;
+	size_t *rows = NULL;
+	const struct column *c = sc->col;
+
+	if (c->gram.key == NULL || sc->len < 3) {
+		return(0);
+	}
+	g = xmalloc((sc->len - 2)*sizeof(uint32_t));
+	for (i = 0; i + 3 <= sc->len; ++i) {
+		g[i] = tri(sc->term + i);
+	}
+	qsort(g, sc->len - 2, sizeof(uint32_t), cmp_gram);
+	for (i = 0; i < sc->len - 2; ++i) {
+		if (ng == 0 || g[i] != g[ng - 1]) {
+			g[ng++] = g[i];
+		}
+	}
+
+	need = (long)ng - 3*sc->typos;
+	if (need <= 0) {
+		free(g);
+		return(0);
+	}
+
+	if (sc->typos == 0) {
+		for (i = 0; i < ng; ++i) {
+			rows = postings(&c->gram, g[i], &n);
+			if (i == 0) {
+				sc->cand = rows;
+				sc->ncand = n;
+				continue;
+			}
+			/* Keep the rows of both, in order */
+			for (j = 0, k = 0, kept = 0; j < n; ++j) {
+				while (k < sc->ncand && sc->cand[k] < rows[j]) {
+					++k;
+				}
+				if (k < sc->ncand && sc->cand[k] == rows[j]) {
+					sc->cand[kept++] = rows[j];
+				}
+			}
+			sc->ncand = kept;
+			free(rows);
+		}
+	} else {
+		count = xmalloc((c->nrows + 1)*sizeof(uint32_t));
+		memset(count, 0, (c->nrows + 1)*sizeof(uint32_t));
+		for (i = 0; i < ng; ++i) {
+			rows = postings(&c->gram, g[i], &n);
+			for (j = 0; j < n; ++j) {
+				count[rows[j]]++;
+			}
+			free(rows);
+		}
+		sc->cand = xmalloc((c->nrows + 1)*sizeof(size_t));
+		for (i = 0; i < c->nrows; ++i) {
+			if (count[i] >= (uint32_t)need) {
+				sc->cand[sc->ncand++] = i;
+			}
+		}
+		free(count);
+	}
+	free(g);
+
+	return(1);
+}
+
+/**
+ * Start a lookup of a folded term in a column. The index, when the
+ * column has one, gives the rows that may hold the term, otherwise
+ * each row is looked at in turn.
+ *
+ * \parm[out] sc    The lookup.
+ * \parm[in]  c     The column.
+ * \parm[in]  term  The term, as folded by table_term().
+ * \parm[in]  typos The edits allowed to the term, 0 for none.
+ **/
+void
+table_scan(struct t_scan *sc, const struct column *c, const char *term,
+	   int typos)
+{
+	memset(sc, 0, sizeof(struct t_scan));
+	sc->col = c;
+	sc->term = term;
+	sc->len = strlen(term);
+	sc->typos = typos;
+	if (typos) {
+		sc->dist = xmalloc((sc->len + 1)*sizeof(unsigned int));
+	}
+	sc->indexed = candidates(sc);
+}
+
+/**
+ * Is a value within the allowed edits of holding the term. The edit
+ * distance of the term to its best substring of the value is found
+ * one byte of the value at a time, as Sellers'.
+ **/
+static int
+near(struct t_scan *sc, const char *v, size_t n)
+{
+	size_t i = 0;
+	size_t j = 0;
+	unsigned int diag = 0;
+	unsigned int up = 0;
+	unsigned int best = 0;
+	unsigned int *d = sc->dist;
+	const unsigned int k = sc->typos;
+
+	for (i = 0; i <= sc->len; ++i) {
+		d[i] = i;
+	}
+	if (d[sc->len] <= k) {
+		return(1);
+	}
+	for (j = 0; j < n; ++j) {
+		diag = d[0];
+		d[0] = 0;
+		for (i = 1; i <= sc->len; ++i) {
+			up = d[i];
+			best = diag + (sc->term[i - 1] != v[j]);
+			if (up + 1 < best) {
+				best = up + 1;
+			}
+			if (d[i - 1] + 1 < best) {
+				best = d[i - 1] + 1;
+			}
+			d[i] = best;
+			diag = up;
+		}
+		if (d[sc->len] <= k) {
+			return(1);
+		}
+	}
+
+	return(0);
+}
+
+/**
+ * Find the next row of a column holding the term of a lookup, and
+ * which of its values holds it.
+ *
+ * \parm[in,out] sc The lookup, with the row and value found.
+ *
+ * \retval 1 If a row was found.
+ * \retval 0 If no more rows hold the term.
+ **/
+int
+table_step(struct t_scan *sc)
+{
+	size_t lo = 0;
+	size_t hi = 0;
+	size_t mid = 0;
+	size_t at = 0;
+	const char *hit = NULL;
+	const char *v = NULL;
+	const char *end = NULL;
+	const char *nl = NULL;
+	const struct column *c = sc->col;
+
+	for (;;) {
+		if (sc->indexed) {
+			if (sc->at >= sc->ncand) {
+				return(0);
+			}
+			sc->row = sc->cand[sc->at++];
+		} else if (sc->typos == 0) {
+			/* The pool is searched whole, from the next row */
+			lo = sc->at;
+			hi = c->nrows;
+			if (lo >= hi) {
+				return(0);
+			}
+			hit = memmem(c->pool + c->off[lo],
+				     c->off[hi] - c->off[lo], sc->term, sc->len);
+			if (hit == NULL) {
+				return(0);
+			}
+			/* The row is the last one starting at or before it */
+			at = hit - c->pool;
+			while (hi - lo > 1) {
+				mid = lo + (hi - lo)/2;
+				if (c->off[mid] <= at) {
+					lo = mid;
+				} else {
+					hi = mid;
+				}
+			}
+			sc->row = lo;
+			sc->at = lo + 1;
+		} else {
+			if (sc->at >= c->nrows) {
+				return(0);
+			}
+			sc->row = sc->at++;
+		}
+
+		v = c->pool + c->off[sc->row];
+		end = c->pool + c->off[sc->row + 1];
+		for (sc->nth = 0; v < end; v = nl + 1, ++sc->nth) {
+			nl = memchr(v, '\n', end - v);
+			if (sc->typos ? near(sc, v, nl - v) :
+			    memmem(v, nl - v, sc->term, sc->len) != NULL) {
+				return(1);
+			}
+		}
+	}
+}
+
+/**
+ * Release a lookup.
+ *
+ * \parm[in] sc The lookup.
+ **/
+void
+table_done(struct t_scan *sc)
+{
+	free(sc->cand);
+	free(sc->dist);
+	memset(sc, 0, sizeof(struct t_scan));
+}
+
+/**
+ * Find the cards with a name sound, from the index or else the sounds
+ * of every card.
+ *
+ * \return The cards, in order and without repeats, NULL if there are
+ *         none.
+ **/
+static size_t *
+sounding(const struct table *t, uint32_t code, size_t *n)
+{
+	size_t i = 0;
+	size_t *ids = NULL;
+
+	if (t->indexed) {
+		return(postings(&t->idx, code, n));
+	}
+	*n = 0;
+	for (i = 0; i < t->nsounds; ++i) {
+		if (t->sound[i] >> 32 != code) {
+			continue;
+		}
+		if (ids == NULL) {
+			ids = xmalloc((t->nsounds - i)*sizeof(size_t));
+		}
+		/* Cards were added in order, each sound once */
+		ids[(*n)++] = t->sound[i] & 0xffffffffUL;
+	}
+
+	return(ids);
+}
+
+/**
+ * Find the cards whose names sound like each word of a term, by either
+ * of its Double Metaphone codes.
+ *
+ * \parm[in]  t    The table.
+ * \parm[in]  term The term.
+ * \parm[out] ids  The cards, in order, to be freed.
+ *
+ * \return The number of cards.
+ **/
+size_t
+table_sound(const struct table *t, const char *term, size_t **ids)
+{
+	int first = 1;
+	size_t i = 0;
+	size_t j = 0;
+	size_t w = 0;
+	size_t na = 0;
+	size_t nb = 0;
+	size_t nu = 0;
+	size_t nids = 0;
+	size_t kept = 0;
+	size_t *a = NULL;
+	size_t *b = NULL;
+	size_t *u = NULL;
+	uint32_t code[2] = {0};
+	const char *p = NULL;
+
+	*ids = NULL;
+	for (p = term; *p; p += w) {
+		for (w = 0; p[w] && word((unsigned char)p[w]); ++w);
+		if (w == 0) {
+			++w;
+			continue;
+		}
+		phonetic(p, w, code);
+		if (code[0] == 0) {
+			continue;
+		}
+		if ((a = sounding(t, code[0], &na)) == NULL) {
+			na = 0;
+		}
+		b = code[1] != code[0] ? sounding(t, code[1], &nb) : NULL;
+		if (b == NULL) {
+			nb = 0;
+		}
+
+		/* The cards with either sound */
+		u = xmalloc((na + nb + 1)*sizeof(size_t));
+		for (i = 0, j = 0, nu = 0; i < na || j < nb;) {
+			if (j == nb || (i < na && a[i] < b[j])) {
+				u[nu++] = a[i++];
+			} else if (i == na || b[j] < a[i]) {
+				u[nu++] = b[j++];
+			} else {
+				u[nu++] = a[i++];
+				++j;
+			}
+		}
+		free(a);
+		free(b);
+
+		/* That sound like the words before too */
+		if (first) {
+			*ids = u;
+			nids = nu;
+			first = 0;
+		} else {
+			for (i = 0, j = 0, kept = 0; i < nids && j < nu;) {
+				if ((*ids)[i] < u[j]) {
+					++i;
+				} else if (u[j] < (*ids)[i]) {
+					++j;
+				} else {
+					(*ids)[kept++] = (*ids)[i];
+					++i;
+					++j;
+				}
+			}
+			nids = kept;
+			free(u);
+		}
+		if (nids == 0) {
+			break;
+		}
+	}
+
+	return(nids);
+}
+
+/**
+ * Find a value of a card's field, numbered in the order table_fold()
+ * folds them.
+ *
+ * \parm[in]  card The unfolded card.
+ * \parm[in]  t    The field.
+ * \parm[in]  nth  The value.
+ * \parm[out] len  Its length.
+ *
+ * \return The value, NULL if the card has no such value.
+ **/
+const char *
+table_value(const char *card, enum s_terms t, size_t nth, size_t *len)
+{
+	const char *line = NULL;
+	const char *end = NULL;
+	const char *v = NULL;
+
+	for (line = card; *line; line = *end ? end + 1 : end) {
+		end = strchrnul(line, '\n');
+		if ((v = value(line, end, sterm_name[t])) == NULL) {
+			continue;
+		}
+		if (nth-- == 0) {
+			*len = end - v;
+			if (*len && v[*len - 1] == '\r') {
+				--*len;
+			}
+			return(v);
+		}
+	}
+
+	return(NULL);
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+/**
+ * \file table.h
+ * Internal definitions for holding the searchable fields of cards by
+ * column.
+ *
+ * \ingroup rank
+ * \{
+ **/
+
+#ifndef MCDS_TABLE_H
+#define MCDS_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "options.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The rows holding each of a set of keys **/
+struct t_index {
+	uint32_t *key;			/* Keys, sorted */
+	size_t *post;			/* Start of each key's rows, then the end */
+	unsigned char *rows;		/* Rows of each key, as varint gaps */
+	size_t nkeys;			/* Number of keys */
+};
+
+/** One field of every card that has it, lower cased **/
+struct column {
+	char *pool;			/* Values, each ended by a newline */
+	size_t *off;			/* Start of each row, then the end */
+	size_t *id;			/* Card of each row */
+	size_t nrows;			/* Number of rows */
+	struct t_index gram;		/* Rows holding each trigram */
+};
+
+/** The searchable fields of a set of cards **/
+struct table {
+	struct column col[nterms];
+	uint64_t *sound;		/* Each name sound, then its card */
+	size_t nsounds;			/* Number of them */
+	struct t_index idx;		/* Cards holding each name sound */
+	int indexed;			/* Are the trigrams and sounds indexed */
+};
+
+/** A lookup of a term in a column **/
+struct t_scan {
+	const struct column *col;	/* The column */
+	const char *term;		/* The folded term */
+	size_t len;			/* Its length */
+	int typos;			/* Edits allowed to the term */
+	size_t *cand;			/* Rows the index found, in order */
+	size_t ncand;			/* Number of them */
+	size_t at;			/* Next of them */
+	int indexed;			/* Were the rows found by the index */
+	size_t row;			/* Row found */
+	size_t nth;			/* Its value holding the term */
+	unsigned int *dist;		/* Edit distances, for typos */
+};
+
+/** Fold a card's fields, returning their length, lengths by field */
+size_t table_fold(const char *, char *, uint32_t *);
+
+/** Find the sounds of the names in folded fields */
+size_t table_sounds(const char *, const uint32_t *, uint32_t *);
+
+/** Size a table's columns for the folded fields and name sounds */
+void table_init(struct table *, const size_t *, size_t, size_t);
+
+/** Add a card's folded fields and name sounds as the rows of a card id */
+void table_add(struct table *, size_t, const char *, const uint32_t *,
+	       const uint32_t *, size_t);
+
+/** Index the trigrams of each column */
+void table_index(struct table *);
+
+/** Release a table */
+void table_free(struct table *);
+
+/** Fold a term for table_next(), NULL if the columns can not answer it */
+char *table_term(const char *);
+
+/** Start a lookup of a folded term in a column, allowing typos */
+void table_scan(struct t_scan *, const struct column *, const char *, int);
+
+/** Find the next row holding the term */
+int table_step(struct t_scan *);
+
+/** Release a lookup */
+void table_done(struct t_scan *);
+
+/** Find the cards whose names sound like each word of a term */
+size_t table_sound(const struct table *, const char *, size_t **);
+
+/** Find a value of a card's field, as numbered by table_fold() */
+const char *table_value(const char *, enum s_terms, size_t, size_t *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_TABLE_H */
+/**
+ * \}
+ **/
@@ -29,8 +29,15 @@
 #include "config.h"
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <err.h>
 #include <regex.h>
 #include <locale.h>
@@ -38,7 +45,7 @@
 #include "defs.h"
 #include "options.h"
 #include "mem.h"
-#include "vcard.h"
+#include "mcds.h"
 
 /**
  * Compile regex, checking and handling errors.
@@ -76,17 +83,17 @@ xregcomp(regex_t *preg, const char *regex, int cflags) {
  *
  * It will remove the gaps between folded lines in-place.
  *
- * \parm[in,out] card The vcard.
+ * \parm[in] re         The compiled continuation fold.
+ * \parm[in,out] card   The vcard.
+ * \parm[in] verbose    Report what was cut.
  *
  * \retval 0 If there were no errors.
  * \retval 1 If an error was encounted.
  **/
-static int
-unfold(char *vcard)
+int
+unfold(const regex_t *re, char *vcard, int verbose)
 {
-	static const char r[] = "\r?\n[ \t]";     /* Continuation fold */
 	regmatch_t matches[1];
-	regex_t re;
 	size_t length = strlen(vcard);
 
 	/* We have two cursors. The read pointer is never behind the
@@ -94,17 +101,13 @@ unfold(char *vcard)
 	size_t in_ptr = 0;
 	size_t out_ptr = 0;
 
-	if (xregcomp(&re, r, 0) != 0) {
-		return 1;
-	}
-
 	/* Hunt for folds and move the chunks inbetween them back by
 	 * the accumulated number of folding characters.
 	 *   Counter intuitively, we always move the section that is
 	 * BEFORE the whitespace we just found, because then we know
 	 * how much to move and don't blindly move all the rest of the
 	 * buffer for each iteration. */
-	while (regexec(&re, vcard + in_ptr, 1, matches, 0) == 0) {
+	while (regexec(re, vcard + in_ptr, 1, matches, 0) == 0) {
 		/* We have matched some whitespace representing a 'fold'.
 		 * Sanity-check the matches record */
 		if (matches[0].rm_so == -1 || matches[0].rm_eo == -1) {
@@ -129,142 +132,342 @@ unfold(char *vcard)
 		/* Move the write pointer to beyond the text we just moved. */
 		out_ptr  = out_ptr + matches[0].rm_so;
 	}
-	if (options.verbose) {
+	if (verbose) {
 		fprintf(stderr, "Unfolding cut %zd bytes\n", in_ptr - out_ptr);
 	}
-	/* Move the final segment. Will be a NOP if we have had no folds. */
-	memmove(vcard + out_ptr, vcard + in_ptr, length - in_ptr + 1);
+	/* Move the final segment. An unfolded card is left untouched, so
+	 * cards shared between threads are only ever read. */
+	if (in_ptr != out_ptr) {
+		memmove(vcard + out_ptr, vcard + in_ptr, length - in_ptr + 1);
+	}
 
-	regfree(&re);
 	return 0;
 }
 
+/** Properties whose values are inline binary, never searched **/
+static const char *const bprop[] = {"PHOTO", "LOGO", "SOUND", "KEY", NULL};
+
+/**
+ * Measure an inline binary property, a PHOTO, LOGO, SOUND or KEY, with
+ * the continuation lines folded after it.
+ *
+ * \parm[in] line The start of a line of a folded card.
+ *
+ * \return The length of the property, up to and including its last
+ *         line break, 0 if the line starts another property.
+ **/
+size_t
+binary(const char *line)
+{
+	int i = 0;
+	size_t n = 0;
+	const char *name = line;
+	const char *p = line;
+
+	/* The property may be named with a group */
+	while (isalnum((unsigned char)*p) || *p == '-') {
+		++p;
+	}
+	if (*p == '.') {
+		name = p + 1;
+	}
+	for (i = 0; bprop[i]; ++i) {
+		n = strlen(bprop[i]);
+		if (strncasecmp(name, bprop[i], n) == 0 &&
+		    (name[n] == ';' || name[n] == ':')) {
+			break;
+		}
+	}
+	if (bprop[i] == NULL) {
+		return(0);
+	}
+
+	p = name;
+	do {
+		p = strchrnul(p, '\n');
+		if (*p) {
+			++p;
+		}
+	} while (*p == ' ' || *p == '\t');
+
+	return(p - line);
+}
+
 /**
- * Search a query's result. This will run regexs over the result
- * to filter the data.
+ * Cut the inline binary properties out of a folded card in place. Each
+ * is only scanned for its end, and the lines after it moved back, so
+ * the work is in the card's other properties.
+ *
+ * \parm[in,out] card The card.
+ *
+ * \return The length of what is left.
+ **/
+size_t
+strip(char *card)
+{
+	size_t n = 0;
+	char *in = card;
+	char *out = card;
+
+	while (*in) {
+		if ((n = binary(in)) > 0) {
+			in += n;
+			continue;
+		}
+		n = strchrnul(in, '\n') - in;
+		n += in[n] != '\0';
+		if (out != in) {
+			memmove(out, in, n);
+		}
+		in += n;
+		out += n;
+	}
+	/* A card with nothing to cut is left untouched, like unfold() */
+	if (out != in) {
+		*out = '\0';
+	}
+
+	return(out - card);
+}
+
+/**
+ * Compile the regexs for a lookup.
  * The first regex will be to obtain the name (FN property).
  * While the second one will be to find all requested fields.
  *
- * It will print all matches found to stdout.
- *
- * \parm[in] card The vcard.
+ * \parm[out] m      The matcher.
+ * \parm[in] q       The lookup.
+ * \parm[in] verbose Report the patterns.
  *
  * \retval 0 If there were no errors.
  * \retval 1 If an error was encounted.
  **/
 int
-search(char *card)
+match_init(struct matcher *m, const struct mcds_query *q, int verbose)
 {
 	/* Regex patterns */
+	static const char f[] = VCARD_FOLD;        /* Continuation fold */
 	static const char r[] = "%s(.*):(.*)";     /* Whole result */
 	static const char t[] = "^%s([A-Za-z;=])*:(.*%s.*)"; /* Query term  */
 
+	int rtn = EXIT_FAILURE;		/* Return code */
 	int plen = 0;			/* Length of snprintf()'s */
-
-	int rerr = 0;			/* Regex error code */
-
 	size_t qlen = 0;		/* Length of the query string */
-	char *q = NULL;			/* Regex pattern for query */
+	char *qs = NULL;		/* Regex pattern for query */
 	char *qt = NULL;		/* Quoted query term */
-	regex_t rq = {0};		/* Regex precompiled query */
-	char *qres = NULL;		/* Result of the query */
-
 	size_t slen = 0;		/* Length of the search string */
 	char *s = NULL;			/* Regex pattern for search */
-	regex_t rs = {0};		/* Regex precompiled search */
 
-	regmatch_t match[3] = {0};	/* Regex matches */
-
-	if (unfold(card)) {
-		warnx(_("Error unfolding vCard."));
-		return(EXIT_FAILURE);
-	}
+	match_free(m);
 
 	/* Generate a quoted query term */
-	if (quote(options.term, &qt)) {
+	if (quote(q->term, &qt)) {
 		warnx(_("Unable to build quoted term."));
 		return(EXIT_FAILURE);
 	}
 
-	/* Compile the regex for the query */
+	/* Build the regex for the query */
 	qlen = strlen(t) -4
-		+ strlen(sterm_name[options.query])
+		+ strlen(sterm_name[q->query])
 		+ strlen(qt) +1;
-	q = xmalloc(qlen*sizeof(char));
+	qs = xmalloc(qlen*sizeof(char));
 
-	plen = snprintf(q, qlen, t, sterm_name[options.query], qt);
+	plen = snprintf(qs, qlen, t, sterm_name[q->query], qt);
 	if (plen < 0 || (size_t)plen != qlen -1) {
 		warnx(_("Unable to build regex pattern."));
-		return(EXIT_FAILURE);
-	}
-
-	if (xregcomp(&rq, q, REG_NEWLINE|REG_ICASE) != 0) {
-		return(EXIT_FAILURE);
+		goto rtn;
 	}
 
-	/* Compile the regex for the search */
+	/* Build the regex for the search */
 	slen = strlen(r) -2
-		+ strlen(sterm_name[options.search]) +1;
+		+ strlen(sterm_name[q->search]) +1;
 	s = xmalloc((slen)*sizeof(char));
 
-	plen = snprintf(s, slen, r, sterm_name[options.search]);
+	plen = snprintf(s, slen, r, sterm_name[q->search]);
 	if (plen < 0 || (size_t)plen != slen -1) {
 		warnx(_("Unable to build regex pattern."));
-		return(EXIT_FAILURE);
-	}
-
-	if (xregcomp(&rs, s, REG_NEWLINE) != 0) {
-		return(EXIT_FAILURE);
+		goto rtn;
 	}
 
-	if (options.verbose) {
-		fprintf(stderr, "Regex for query term: %s\n", q);
+	if (verbose) {
+		fprintf(stderr, "Regex for query term: %s\n", qs);
 		fprintf(stderr, "Regex for search term: %s\n", s);
 	}
 
-	/* Look for the query term in the original card */
-	rerr = regexec(&rq, &card[0], 3, match, 0);
-	if (rerr != 0) {
+	if (xregcomp(&m->fold, f, 0) != 0) {
 		goto rtn;
 	}
+	if (xregcomp(&m->rq, qs, REG_NEWLINE|REG_ICASE) != 0) {
+		regfree(&m->fold);
+		goto rtn;
+	}
+	if (xregcomp(&m->rs, s, REG_NEWLINE) != 0) {
+		regfree(&m->fold);
+		regfree(&m->rq);
+		goto rtn;
+	}
+	m->compiled = 1;
+	rtn = EXIT_SUCCESS;
 
-	qlen = (int)(match[2].rm_eo - match[2].rm_so);
-	qres = xmalloc(qlen+1);
-	memcpy(qres, card+match[2].rm_so, qlen);
-	if (qres[qlen-1] == '\r') {
-		qres[qlen-1] = '\0';
-	} else {
-		qres[qlen] ='\0';
+rtn:
+	if (qt) {
+		free(qt);
+		qt = NULL;
+	}
+	if (qs) {
+		free(qs);
+		qs = NULL;
+	}
+	if (s) {
+		free(s);
+		s = NULL;
+	}
+
+	return(rtn);
+}
+
+/**
+ * Release the compiled regexs.
+ *
+ * \parm[in] m The matcher.
+ **/
+void
+match_free(struct matcher *m)
+{
+	if (!m->compiled) {
+		return;
 	}
+	regfree(&m->fold);
+	regfree(&m->rq);
+	regfree(&m->rs);
+	m->compiled = 0;
+}
+
+/**
+ * Write, or rank, each search field of a card that matched, with the
+ * query field's value it matched in.
+ *
+ * \parm[in] ctx  The context.
+ * \parm[in] card The unfolded vcard.
+ * \parm[in] qres The query field's value.
+ **/
+static void
+fields(struct mcds *ctx, const char *card, const char *qres)
+{
+	int held = 0;			/* Was the value written already */
+	int rerr = 0;			/* Regex error code */
+	size_t slen = 0;		/* Length of the search result */
+	regmatch_t match[3] = {0};	/* Regex matches */
+	struct result res = {0};	/* A search result */
+	const struct mcds_query *q = ctx->q;
 
 	/* Grab all the fields that we wanted */
-	rerr = regexec(&rs, card, 3, match, 0);
+	rerr = regexec(&ctx->m.rs, card, 3, match, 0);
 	while (rerr == 0) {
 		/* TODO: For addresses convert ";" to "\n" */
 		slen = match[2].rm_eo - match[2].rm_so;
 		if (card[match[2].rm_eo -1] == '\r') {
 			slen -= 1;
 		}
-		printf("%.*s\t%s\n", (int)slen, card + match[2].rm_so, qres);
+		res.val[q->query] = qres;
+		res.len[q->query] = strlen(qres);
+		res.val[q->search] = card + match[2].rm_so;
+		res.len[q->search] = slen;
+		if (q->limit > 0) {
+			rank_add(&ctx->rank, &res, rank_score(qres, q->term));
+		} else {
+			/* Only the first result for each value is written */
+			dedup_add(&ctx->seen, res.val[q->search],
+				  res.len[q->search], &held);
+			if (!held) {
+				output_record(&ctx->out, &res);
+			}
+		}
 
 		card += match[0].rm_eo;
-		rerr = regexec(&rs, card, 3, match, REG_NOTBOL);
+		rerr = regexec(&ctx->m.rs, card, 3, match, REG_NOTBOL);
 	}
+}
 
-	regfree(&rq);
-	regfree(&rs);
+/**
+ * Search a query's result. This will run the lookup's compiled
+ * regexs over the result to filter the data.
+ *
+ * It will write the matches found to the output, skipping values
+ * already written, or when a limit is set offer them to the ranking heap.
+ *
+ * \parm[in] ctx  The context, with its matcher compiled.
+ * \parm[in] card The vcard.
+ *
+ * \retval 0 If the card matched the query term.
+ * \retval 1 If it did not, or an error was encounted.
+ **/
+int
+search(struct mcds *ctx, char *card)
+{
+	int rtn = EXIT_FAILURE;
+	int rerr = 0;			/* Regex error code */
+	size_t qlen = 0;		/* Length of the query result */
+	char *qres = NULL;		/* Result of the query */
+	regmatch_t match[3] = {0};	/* Regex matches */
+
+	if (unfold(&ctx->m.fold, card, ctx->opts->verbose)) {
+		warnx(_("Error unfolding vCard."));
+		return(EXIT_FAILURE);
+	}
+
+	/* Look for the query term in the original card */
+	rerr = regexec(&ctx->m.rq, &card[0], 3, match, 0);
+	if (rerr != 0) {
+		goto rtn;
+	}
+	rtn = EXIT_SUCCESS;
+	ctx->matched++;
+
+	qlen = (int)(match[2].rm_eo - match[2].rm_so);
+	qres = xmalloc(qlen+1);
+	memcpy(qres, card+match[2].rm_so, qlen);
+	if (qres[qlen-1] == '\r') {
+		qres[qlen-1] = '\0';
+	} else {
+		qres[qlen] ='\0';
+	}
+
+	fields(ctx, card, qres);
 
 rtn:
 	if (qres) {
 		free(qres);
 		qres = NULL;
 	}
-	if (qt) {
-		free(qt);
-		qt = NULL;
-	}
 
-	return(rerr);
+	return(rtn);
+}
+
+/**
+ * Search a card whose query field came within the allowed typos of the
+ * term, with the value that did standing for the query's result.
+ *
+ * \parm[in] ctx  The context, with its matcher compiled.
+ * \parm[in] card The unfolded vcard.
+ * \parm[in] val  The query field's value.
+ * \parm[in] len  Its length.
+ *
+ * \retval 0 Always, the card matched.
+ **/
+int
+search_near(struct mcds *ctx, const char *card, const char *val, size_t len)
+{
+	char *qres = NULL;
+
+	qres = xmalloc(len + 1);
+	memcpy(qres, val, len);
+	qres[len] = '\0';
+	ctx->matched++;
+	fields(ctx, card, qres);
+	free(qres);
+
+	return(EXIT_SUCCESS);
 }
 
 /**
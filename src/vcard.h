@@ -27,14 +27,48 @@
 #ifndef MCDS_VCARD_H
 #define MCDS_VCARD_H
 
+#include <regex.h>
+#include "options.h"
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-/** Search the vcard.
+struct mcds;
+
+/** Regex matching a continuation fold, RFC6350 section 3.2 **/
+#define VCARD_FOLD "\r?\n[ \t]"
+
+/** The matcher of a lookup, compiled once for all of its cards **/
+struct matcher {
+	regex_t fold;			/* Continuation fold */
+	regex_t rq;			/* Query field holding the term */
+	regex_t rs;			/* Search field */
+	int compiled;			/* Are the regexs compiled */
+};
+
+/** Compile the matcher for a lookup */
+int match_init(struct matcher *, const struct mcds_query *, int);
+
+/** Release a compiled matcher */
+void match_free(struct matcher *);
+
+/** Search the vcard, returning 0 when it matched the query term.
  * The supplied card string will be unfolded in place so must be modifiable. */
-int search(char *);
+int search(struct mcds *, char *);
+
+/** Search an unfolded vcard whose query field came near the term */
+int search_near(struct mcds *, const char *, const char *, size_t);
+
+/** Unfold a vcard in place */
+int unfold(const regex_t *, char *, int);
+
+/** Length of an inline binary property starting a line, 0 if none */
+size_t binary(const char *);
+
+/** Cut the inline binary properties out of a folded card in place */
+size_t strip(char *);
 
 /** Quote a string for regex's */
 int quote(const char *, char **);
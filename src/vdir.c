@@ -0,0 +1,552 @@
+/*
+ * Copyright (C) 2014  Timothy Brown
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file vdir.c
+ * Routines to look up cards in a local vdir.
+ *
+ * A vdir, as kept by vdirsyncer, is a directory of .vcf files, or of
+ * collections each holding .vcf files. The cards are read once, unfolded
+ * and kept; each lookup only stats the files again and rereads those
+ * whose modification time or size changed. Files are read in batches
+ * by a few threads, so a cold start over thousands of small files is
+ * not bound by the latency of each open and read.
+ * Cards are searched with the same matcher as the server's responses,
+ * and nothing is ever fetched from the network.
+ *
+ * \ingroup vdir
+ * \{
+ **/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <locale.h>
+#include "gettext.h"
+#include "defs.h"
+#include "mem.h"
+#include "vcard.h"
+#include "mcds.h"
+#include "vdir.h"
+
+/** Most threads reading files */
+#define VDIR_THREADS 8
+
+/** Files a thread takes at a time */
+#define VDIR_BATCH   32
+
+/** Files waiting to be read, shared by the reading threads **/
+struct loader {
+	pthread_mutex_t lock;
+	struct vdir *v;
+	int dfd;			/* The vdir */
+	struct vfile **todo;		/* Files to read */
+	size_t ntodo;			/* Number of files to read */
+	size_t next;			/* First file not yet taken */
+};
+
+/** A list of files being scanned **/
+struct vlist {
+	struct vfile *file;
+	size_t n;
+	size_t max;
+};
+
+static int
+by_name(const void *a, const void *b)
+{
+	return(strcmp(((const struct vfile *)a)->name,
+		      ((const struct vfile *)b)->name));
+}
+
+/**
+ * Release a file's contents.
+ **/
+static void
+vfile_free(struct vfile *f)
+{
+	free(f->name);
+	free(f->data);
+	free(f->card);
+	f->name = NULL;
+	f->data = NULL;
+	f->card = NULL;
+	f->ncards = 0;
+}
+
+/**
+ * List the .vcf files of a directory, descending into the collections
+ * of the top level.
+ *
+ * \parm[in]  dfd    The directory, which is closed.
+ * \parm[in]  prefix The directory's path relative to the vdir.
+ * \parm[in]  depth  How deep the directory is in the vdir.
+ * \parm[out] l      The list to add the files to.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+list_dir(int dfd, const char *prefix, int depth, struct vlist *l)
+{
+	DIR *d = NULL;
+	struct dirent *de = NULL;
+	struct stat st;
+	struct vfile *f = NULL;
+	size_t len = 0;
+	int sub = -1;
+	char *path = NULL;
+	int rtn = EXIT_SUCCESS;
+
+	if ((d = fdopendir(dfd)) == NULL) {
+		warn(_("Unable to read %s"), prefix[0] ? prefix : ".");
+		close(dfd);
+		return(EXIT_FAILURE);
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		if (fstatat(dfd, de->d_name, &st, 0) == -1) {
+			continue;
+		}
+		len = strlen(prefix) + strlen(de->d_name) + 2;
+		path = xmalloc(len);
+		snprintf(path, len, "%s%s%s", prefix, prefix[0] ? "/" : "",
+			 de->d_name);
+
+		if (S_ISDIR(st.st_mode) && depth == 0) {
+			sub = openat(dfd, de->d_name,
+				     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (sub != -1 && list_dir(sub, path, depth + 1, l)) {
+				rtn = EXIT_FAILURE;
+			}
+			free(path);
+			continue;
+		}
+
+		len = strlen(de->d_name);
+		if (!S_ISREG(st.st_mode) || len < 4 ||
+		    strcasecmp(de->d_name + len - 4, ".vcf") != 0) {
+			free(path);
+			continue;
+		}
+
+		if (l->n == l->max) {
+			l->max = l->max ? 2*l->max : 256;
+			l->file = realloc(l->file, l->max*sizeof(struct vfile));
+			if (l->file == NULL) {
+				err(EXIT_FAILURE, _("Unable to list %s"), path);
+			}
+		}
+		f = &l->file[l->n++];
+		memset(f, 0, sizeof(struct vfile));
+		f->name = path;
+		f->mtime = st.st_mtim;
+		f->size = st.st_size;
+	}
+	closedir(d);
+
+	return(rtn);
+}
+
+/**
+ * Read, unfold and split a file into its cards.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+load(struct vdir *v, int dfd, struct vfile *f)
+{
+	int fd = -1;
+	struct stat st;
+	size_t len = 0;
+	size_t max = 0;
+	ssize_t n = 0;
+	char *p = NULL;
+
+	if ((fd = openat(dfd, f->name, O_RDONLY | O_CLOEXEC)) == -1) {
+		warn(_("Unable to open %s"), f->name);
+		return(EXIT_FAILURE);
+	}
+	if (fstat(fd, &st) == -1) {
+		warn(_("Unable to stat %s"), f->name);
+		close(fd);
+		return(EXIT_FAILURE);
+	}
+	f->mtime = st.st_mtim;
+	f->size = st.st_size;
+
+	f->data = xmalloc(st.st_size + 1);
+	while ((size_t)st.st_size > len) {
+		n = read(fd, f->data + len, st.st_size - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			warn(_("Unable to read %s"), f->name);
+			close(fd);
+			free(f->data);
+			f->data = NULL;
+			return(EXIT_FAILURE);
+		}
+		if (n == 0) {
+			break;
+		}
+		len += n;
+	}
+	close(fd);
+	f->data[len] = '\0';
+
+	/* Photos are cut first, so unfolding only moves the text */
+	strip(f->data);
+	unfold(&v->fold, f->data, 0);
+
+	/* Each card starts a line with BEGIN:VCARD and ends the last */
+	p = f->data;
+	while (p) {
+		if (strncasecmp(p, "BEGIN:VCARD", 11) == 0) {
+			if (p != f->data) {
+				p[-1] = '\0';
+			}
+			if (f->ncards == max) {
+				max = max ? 2*max : 1;
+				f->card = realloc(f->card, max*sizeof(char *));
+				if (f->card == NULL) {
+					err(EXIT_FAILURE,
+					    _("Unable to split %s"), f->name);
+				}
+			}
+			f->card[f->ncards++] = p;
+		}
+		if ((p = strchr(p, '\n')) != NULL) {
+			++p;
+		}
+	}
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Body of a reading thread, taking batches of files until none is left.
+ **/
+static void *
+loader(void *arg)
+{
+	struct loader *ld = (struct loader *)arg;
+	size_t i = 0;
+	size_t end = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&ld->lock);
+		i = ld->next;
+		end = i + VDIR_BATCH < ld->ntodo ? i + VDIR_BATCH : ld->ntodo;
+		ld->next = end;
+		pthread_mutex_unlock(&ld->lock);
+		if (i == end) {
+			break;
+		}
+		for (; i < end; ++i) {
+			/* A file that could not be read is tried again */
+			if (load(ld->v, ld->dfd, ld->todo[i])) {
+				ld->todo[i]->size = -1;
+			}
+		}
+	}
+
+	return(NULL);
+}
+
+/**
+ * Read files with up to VDIR_THREADS threads, the caller being one.
+ **/
+static void
+load_all(struct vdir *v, int dfd, struct vfile **todo, size_t ntodo)
+{
+	pthread_t tid[VDIR_THREADS];
+	struct loader ld = {0};
+	long ncpu = 0;
+	size_t want = 0;
+	size_t started = 0;
+	size_t i = 0;
+
+	pthread_mutex_init(&ld.lock, NULL);
+	ld.v = v;
+	ld.dfd = dfd;
+	ld.todo = todo;
+	ld.ntodo = ntodo;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	want = (ntodo + VDIR_BATCH - 1) / VDIR_BATCH;
+	if (ncpu > 0 && want > (size_t)ncpu) {
+		want = ncpu;
+	}
+	if (want > VDIR_THREADS) {
+		want = VDIR_THREADS;
+	}
+	for (i = 1; i < want; ++i) {
+		if (pthread_create(&tid[started], NULL, loader, &ld) != 0) {
+			break;
+		}
+		++started;
+	}
+	loader(&ld);
+	for (i = 0; i < started; ++i) {
+		pthread_join(tid[i], NULL);
+	}
+
+	pthread_mutex_destroy(&ld.lock);
+}
+
+/**
+ * Bring the kept files up to date with the directory. Files that are
+ * unchanged keep their cards, the others are read again.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+static int
+refresh(struct vdir *v)
+{
+	int dfd = -1;
+	int changed = 0;
+	size_t i = 0;
+	size_t ntodo = 0;
+	char *reused = NULL;
+	struct vfile *old = NULL;
+	struct vfile **todo = NULL;
+	struct vlist l = {0};
+	struct vfile *prev = NULL;
+	size_t nprev = 0;
+
+	pthread_mutex_lock(&v->scan);
+
+	dfd = open(v->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1) {
+		warn(_("Unable to open %s"), v->path);
+		pthread_mutex_unlock(&v->scan);
+		return(EXIT_FAILURE);
+	}
+	if (list_dir(dup(dfd), "", 0, &l)) {
+		close(dfd);
+		for (i = 0; i < l.n; ++i) {
+			vfile_free(&l.file[i]);
+		}
+		free(l.file);
+		pthread_mutex_unlock(&v->scan);
+		return(EXIT_FAILURE);
+	}
+	qsort(l.file, l.n, sizeof(struct vfile), by_name);
+
+	/* Only this thread changes the files, so they can be read unlocked */
+	reused = xmalloc(v->nfiles + 1);
+	memset(reused, 0, v->nfiles + 1);
+	todo = xmalloc((l.n + 1)*sizeof(struct vfile *));
+	for (i = 0; i < l.n; ++i) {
+		old = bsearch(&l.file[i], v->file, v->nfiles,
+			      sizeof(struct vfile), by_name);
+		if (old && old->size == l.file[i].size &&
+		    old->mtime.tv_sec == l.file[i].mtime.tv_sec &&
+		    old->mtime.tv_nsec == l.file[i].mtime.tv_nsec) {
+			l.file[i].data = old->data;
+			l.file[i].card = old->card;
+			l.file[i].ncards = old->ncards;
+			reused[old - v->file] = 1;
+		} else {
+			todo[ntodo++] = &l.file[i];
+		}
+	}
+	changed = ntodo > 0 || l.n != v->nfiles;
+
+	if (ntodo > 0) {
+		load_all(v, dfd, todo, ntodo);
+	}
+	close(dfd);
+
+	if (v->verbose) {
+		fprintf(stderr, "Read %zu of %zu files in %s\n",
+			ntodo, l.n, v->path);
+	}
+
+	if (changed) {
+		pthread_rwlock_wrlock(&v->lock);
+		prev = v->file;
+		nprev = v->nfiles;
+		v->file = l.file;
+		v->nfiles = l.n;
+		pthread_rwlock_unlock(&v->lock);
+
+		for (i = 0; i < nprev; ++i) {
+			if (reused[i]) {
+				free(prev[i].name);
+			} else {
+				vfile_free(&prev[i]);
+			}
+		}
+		free(prev);
+	} else {
+		for (i = 0; i < l.n; ++i) {
+			free(l.file[i].name);
+		}
+		free(l.file);
+	}
+
+	free(reused);
+	free(todo);
+	pthread_mutex_unlock(&v->scan);
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Initialise a vdir. Nothing is read until the first lookup.
+ *
+ * \parm[out] v       The vdir.
+ * \parm[in]  path    The directory.
+ * \parm[in]  verbose Report each scan.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+vdir_init(struct vdir *v, const char *path, int verbose)
+{
+	memset(v, 0, sizeof(struct vdir));
+
+	if (regcomp(&v->fold, VCARD_FOLD, REG_EXTENDED) != 0) {
+		warnx(_("Unable to build regex pattern."));
+		return(EXIT_FAILURE);
+	}
+	if (pthread_mutex_init(&v->scan, NULL) != 0 ||
+	    pthread_rwlock_init(&v->lock, NULL) != 0) {
+		warnx(_("Unable to initialise the vdir locks."));
+		regfree(&v->fold);
+		return(EXIT_FAILURE);
+	}
+	v->path = xmalloc(strlen(path) + 1);
+	strcpy(v->path, path);
+	v->verbose = verbose;
+
+	return(EXIT_SUCCESS);
+}
+
+/**
+ * Release a vdir and its cards. No lookup may be using it.
+ *
+ * \parm[in] v The vdir.
+ **/
+void
+vdir_free(struct vdir *v)
+{
+	size_t i = 0;
+
+	if (v->path == NULL) {
+		return;
+	}
+	for (i = 0; i < v->nfiles; ++i) {
+		vfile_free(&v->file[i]);
+	}
+	free(v->file);
+	free(v->path);
+	regfree(&v->fold);
+	pthread_rwlock_destroy(&v->lock);
+	pthread_mutex_destroy(&v->scan);
+	memset(v, 0, sizeof(struct vdir));
+}
+
+/**
+ * Bring the vdir up to date then search its cards for the context's
+ * lookup, stopping early once the ranking heap can no longer be
+ * improved, unless a session is keeping the matched cards.
+ *
+ * \parm[in] v   The vdir.
+ * \parm[in] ctx The context, with its matcher compiled and its output
+ *               open.
+ *
+ * \retval 0 If there were no errors.
+ * \retval 1 If an error was encounted.
+ **/
+int
+vdir_search(struct vdir *v, struct mcds *ctx)
+{
+	size_t i = 0;
+	size_t j = 0;
+	char *card = NULL;
+
+	if (refresh(v)) {
+		return(EXIT_FAILURE);
+	}
+
+	pthread_rwlock_rdlock(&v->lock);
+	for (i = 0; i < v->nfiles; ++i) {
+		for (j = 0; j < v->file[i].ncards; ++j) {
+			if (!ctx->session.on && rank_full(&ctx->rank)) {
+				goto done;
+			}
+			card = v->file[i].card[j];
+			if (search(ctx, card) == 0 && ctx->session.on) {
+				session_keep(&ctx->session, card);
+			}
+		}
+	}
+done:
+	pthread_rwlock_unlock(&v->lock);
+
+	return(EXIT_SUCCESS);
+}
+
+static int
+vdir_source_search(const struct source *src, struct mcds *ctx)
+{
+	return(vdir_search((struct vdir *)src->data, ctx));
+}
+
+/**
+ * Describe a vdir as a source of cards.
+ *
+ * \parm[out] src The source.
+ * \parm[in]  v   The vdir, which must outlive the source.
+ **/
+void
+vdir_source(struct source *src, struct vdir *v)
+{
+	src->name = "vdir";
+	src->caps = 0;
+	src->cost = SRC_COST_DIR;
+	src->data = v;
+	src->search = vdir_source_search;
+}
+
+/**
+ * \}
+ **/
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2014 Timothy Brown
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ * \file vdir.h
+ * Internal definitions for looking up cards in a local vdir.
+ *
+ * \ingroup vdir
+ * \{
+ **/
+
+#ifndef MCDS_VDIR_H
+#define MCDS_VDIR_H
+
+#include <pthread.h>
+#include <regex.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct mcds;
+struct source;
+
+/** A .vcf file, as last read **/
+struct vfile {
+	char *name;			/* Path relative to the vdir */
+	struct timespec mtime;		/* Modification time when read */
+	off_t size;			/* Size when read */
+	char *data;			/* Unfolded contents */
+	char **card;			/* Cards, NUL terminated in data */
+	size_t ncards;			/* Number of cards */
+};
+
+/** A vdir and the cards read from it, shared by contexts **/
+struct vdir {
+	pthread_mutex_t scan;		/* Held while rescanning */
+	pthread_rwlock_t lock;		/* Guards the files */
+	char *path;			/* The directory */
+	regex_t fold;			/* Continuation fold */
+	struct vfile *file;		/* Files, sorted by name */
+	size_t nfiles;			/* Number of files */
+	int verbose;			/* Report the scans */
+};
+
+/** Initialise a vdir, nothing is read until the first lookup */
+int vdir_init(struct vdir *, const char *, int);
+
+/** Release a vdir and its cards */
+void vdir_free(struct vdir *);
+
+/** Rescan a vdir and search its cards for the context's lookup */
+int vdir_search(struct vdir *, struct mcds *);
+
+/** Describe a vdir as a source of cards */
+void vdir_source(struct source *, struct vdir *);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif                          /* MCDS_VDIR_H */
+/**
+ * \}
+ **/
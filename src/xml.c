@@ -20,6 +20,13 @@
  * \file xml.c
  * Routines to interact with XML.
  *
+ * A large multistatus response, such as a whole address book, is cut
+ * into chunks at its response elements. Each chunk, wrapped in a copy
+ * of the root element so its namespaces still resolve, is parsed and
+ * matched on its own thread with its own matcher. The cards each chunk
+ * matched are then searched in document order, so the results are the
+ * same as a single parse would give.
+ *
  * \ingroup XML
  * \{
  **/
@@ -28,37 +35,73 @@
 #include "config.h"
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <err.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <locale.h>
 #include "gettext.h"
 #include "defs.h"
 #include "xml.h"
-#include "vcard.h"
 #include "options.h"
+#include "mem.h"
+#include "mcds.h"
+
+/** Smallest response parsed in chunks */
+#define XML_CHUNK_MIN  (4 << 20)
+
+/** Most threads parsing chunks */
+#define XML_THREADS    8
+
+/** A part of a response, parsed on its own **/
+struct chunk {
+	const struct mcds *ctx;		/* The lookup's context */
+	const char *head;		/* Root start tag */
+	size_t hlen;
+	const char *body;		/* Responses of the chunk */
+	size_t blen;
+	const char *tail;		/* Root end tag */
+	size_t tlen;
+	struct matcher m;		/* The chunk's own matcher */
+	char **card;			/* Matched cards, unfolded */
+	size_t ncards;
+	size_t max;
+	int rtn;			/* Status of the parse */
+};
 
 /** Internal functions **/
-static void walk_tree(xmlDocPtr, xmlNode *);
+static void walk_tree(struct mcds *, xmlDocPtr, xmlNode *);
+static int parse_chunks(struct mcds *, const char *, size_t);
 
 /**
  * Parse the output of curl to get the vcards.
  *
+ * \parm[in] ctx The context, with its lookup set.
  * \parm[in] res The query result.
  *
  * \retval 0 If there were no errors.
  * \retval 1 If an error was encounted.
  **/
 int
-parse_xml(const char *res)
+parse_xml(struct mcds *ctx, const char *res)
 {
 	size_t len      = 0;		/* Length of the result */
 	xmlDocPtr doc   = NULL;		/* XML document pointer */
 	xmlNodePtr node = NULL;		/* XML node pointer */
 
 	len = strlen(res);
+	if (len >= XML_CHUNK_MIN && parse_chunks(ctx, res, len) == 0) {
+		return(EXIT_SUCCESS);
+	}
+
 	doc = xmlReadMemory(res, len, "noname.xml", NULL, 0);
 	if (doc == NULL) {
 		warnx(_("Unable to generate an xml document"));
@@ -68,21 +111,24 @@ parse_xml(const char *res)
 	node = xmlDocGetRootElement(doc);
 	if (node == NULL) {
 		warnx(_("Unable to get the root node of the xml document"));
+		xmlFreeDoc(doc);
 		return(EXIT_FAILURE);
 	}
 
-	walk_tree(doc, node);
+	walk_tree(ctx, doc, node);
 
 	xmlFreeDoc(doc);
-	xmlCleanupParser();
 
 	return(EXIT_SUCCESS);
 }
 
 /**
  * Recursively walk an xml tree, when an "address-data" node is found
- * call the search function on that data.
+ * call the search function on that data. The walk stops early once
+ * the ranking heap can no longer be improved, unless a session is
+ * keeping the matched cards.
  *
+ * \parm[in] ctx   The context.
  * \parm[in] doc   The whole xml document.
  * \parm[in] node  The current node to traverse from.
  *
@@ -90,32 +136,352 @@ parse_xml(const char *res)
  * \retval 1 If an error was encounted.
  **/
 static void
-walk_tree(xmlDocPtr doc, xmlNode *node)
+walk_tree(struct mcds *ctx, xmlDocPtr doc, xmlNode *node)
 {
 	static const xmlChar adr[] = "address-data";
 	xmlChar *data = NULL;
 	xmlNode *cur = NULL;
+	char *card = NULL;
 
 	for (cur = node; cur; cur = cur->next) {
+		if (!ctx->session.on && rank_full(&ctx->rank)) {
+			return;
+		}
 		if (cur->type == XML_ELEMENT_NODE) {
-				if (!xmlStrcmp(cur->name, adr)) {
-					data = xmlNodeListGetString(doc,
-							cur->xmlChildrenNode,
-							1);
-					if (options.verbose) {
+				if (!xmlStrcmp(cur->name, adr) &&
+				    (card = xml_text(doc, cur, &data))) {
+					strip(card);
+					if (ctx->opts->verbose) {
 						fprintf(stderr,
 							_("Data:\n%s\n"),
-							data);
+							card);
+					}
+					if (search(ctx, card) == 0 &&
+					    ctx->session.on) {
+						session_keep(&ctx->session,
+							     card);
 					}
-					search((char *)data);
 					xmlFree(data);
 				}
 		}
-	walk_tree(doc, cur->children);
+	walk_tree(ctx, doc, cur->children);
 	}
 	return;
 }
 
+/**
+ * Walk a chunk's tree, keeping a copy of each card that matches the
+ * query term.
+ **/
+static void
+collect_tree(struct chunk *c, xmlDocPtr doc, xmlNode *node)
+{
+	static const xmlChar adr[] = "address-data";
+	xmlChar *data = NULL;
+	xmlNode *cur = NULL;
+	char *card = NULL;
+
+	for (cur = node; cur; cur = cur->next) {
+		if (cur->type == XML_ELEMENT_NODE &&
+		    !xmlStrcmp(cur->name, adr)) {
+			if ((card = xml_text(doc, cur, &data)) == NULL) {
+				continue;
+			}
+			strip(card);
+			unfold(&c->m.fold, card, 0);
+			if (regexec(&c->m.rq, card, 0, NULL, 0) != 0) {
+				xmlFree(data);
+				continue;
+			}
+			if (c->ncards == c->max) {
+				c->max = c->max ? 2*c->max : 64;
+				c->card = realloc(c->card,
+						  c->max*sizeof(char *));
+				if (c->card == NULL) {
+					err(EXIT_FAILURE,
+					    _("Unable to keep the cards"));
+				}
+			}
+			/* Only what is left of the card is copied */
+			c->card[c->ncards++] = data ? (char *)data :
+					       (char *)xmlStrdup((xmlChar *)card);
+			continue;
+		}
+		collect_tree(c, doc, cur->children);
+	}
+}
+
+/**
+ * Body of a chunk's thread: parse the chunk wrapped in the root
+ * element, then collect its matching cards.
+ **/
+static void *
+parse_chunk(void *arg)
+{
+	struct chunk *c = (struct chunk *)arg;
+	char *buf = NULL;
+	size_t len = c->hlen + c->blen + c->tlen;
+	xmlDocPtr doc = NULL;
+	xmlNodePtr node = NULL;
+
+	c->rtn = EXIT_FAILURE;
+	if (match_init(&c->m, c->ctx->q, 0)) {
+		return(NULL);
+	}
+
+	buf = xmalloc(len);
+	memcpy(buf, c->head, c->hlen);
+	memcpy(buf + c->hlen, c->body, c->blen);
+	memcpy(buf + c->hlen + c->blen, c->tail, c->tlen);
+	doc = xmlReadMemory(buf, len, "noname.xml", NULL, 0);
+	free(buf);
+	if (doc == NULL) {
+		match_free(&c->m);
+		return(NULL);
+	}
+
+	if ((node = xmlDocGetRootElement(doc)) != NULL) {
+		collect_tree(c, doc, node);
+		c->rtn = EXIT_SUCCESS;
+	}
+	xmlFreeDoc(doc);
+	match_free(&c->m);
+
+	return(NULL);
+}
+
+/**
+ * Find the start of the next response element, at or after p.
+ *
+ * \return The start, or end if there is none.
+ **/
+static const char *
+next_response(const char *p, const char *end, const char *tag, size_t tlen)
+{
+	while (p && p < end) {
+		p = memmem(p, end - p, tag, tlen);
+		if (p == NULL) {
+			break;
+		}
+		if (p + tlen < end && (p[tlen] == '>' || p[tlen] == ' ' ||
+				       p[tlen] == '\t' || p[tlen] == '\r' ||
+				       p[tlen] == '\n')) {
+			return(p);
+		}
+		p += tlen;
+	}
+	return(end);
+}
+
+/**
+ * Parse a large response in chunks, on several threads.
+ * Responses this can not safely cut, because of CDATA sections,
+ * comments or an unexpected layout, are left to the caller.
+ *
+ * \parm[in] ctx The context, with its lookup set.
+ * \parm[in] res The response.
+ * \parm[in] len Length of the response.
+ *
+ * \retval 0 If the response was parsed and searched.
+ * \retval 1 If it should be parsed whole.
+ **/
+static int
+parse_chunks(struct mcds *ctx, const char *res, size_t len)
+{
+	int rtn = EXIT_FAILURE;
+	const char *end = res + len;
+	const char *root = NULL;
+	const char *body = NULL;
+	const char *tail = NULL;
+	const char *p = NULL;
+	const char *colon = NULL;
+	char tag[128];
+	char etag[128];
+	size_t nlen = 0;
+	size_t tlen = 0;
+	long ncpu = 0;
+	size_t n = 0;
+	size_t i = 0;
+	size_t j = 0;
+	size_t started = 0;
+	struct chunk c[XML_THREADS];
+	pthread_t tid[XML_THREADS];
+
+	if (memmem(res, len, "<![CDATA[", 9) || memmem(res, len, "<!--", 4)) {
+		return(EXIT_FAILURE);
+	}
+
+	/* The root element, after any declaration */
+	for (root = res; (root = memchr(root, '<', end - root)); ++root) {
+		if (root + 1 < end && root[1] != '?' && root[1] != '!') {
+			break;
+		}
+	}
+	if (root == NULL) {
+		return(EXIT_FAILURE);
+	}
+	nlen = strcspn(root + 1, " \t\r\n/>");
+	if ((body = memchr(root, '>', end - root)) == NULL ||
+	    body[-1] == '/' || nlen + 4 > sizeof(etag)) {
+		return(EXIT_FAILURE);
+	}
+	++body;
+
+	/* Its end tag, and the response tag in the same namespace */
+	snprintf(etag, sizeof(etag), "</%.*s", (int)nlen, root + 1);
+	for (p = body; (p = memmem(p, end - p, etag, nlen + 2)); ++p) {
+		tail = p;
+	}
+	if (tail == NULL) {
+		return(EXIT_FAILURE);
+	}
+	colon = memchr(root + 1, ':', nlen);
+	tlen = snprintf(tag, sizeof(tag), "<%.*s%sresponse",
+			colon ? (int)(colon - root - 1) : 0, root + 1,
+			colon ? ":" : "");
+	if (tlen >= sizeof(tag)) {
+		return(EXIT_FAILURE);
+	}
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	n = ncpu > 1 ? (size_t)ncpu : 1;
+	if (n > XML_THREADS) {
+		n = XML_THREADS;
+	}
+	if (n < 2) {
+		return(EXIT_FAILURE);
+	}
+
+	/* Cut the body into n chunks, each starting at a response */
+	memset(c, 0, sizeof(c));
+	p = body;
+	for (i = 0; i < n && p < tail; ++i) {
+		c[i].ctx = ctx;
+		c[i].head = root;
+		c[i].hlen = body - root;
+		c[i].tail = tail;
+		c[i].tlen = end - tail;
+		c[i].body = p;
+		if (i == n - 1) {
+			p = tail;
+		} else {
+			p = next_response(body + (tail - body)*(i + 1)/n,
+					  tail, tag, tlen);
+			if (p < c[i].body) {
+				p = c[i].body;
+			}
+		}
+		c[i].blen = p - c[i].body;
+	}
+	n = i;
+
+	if (ctx->opts->verbose) {
+		fprintf(stderr, "Parsing %zu bytes in %zu chunks\n", len, n);
+	}
+
+	for (i = 1; i < n; ++i) {
+		if (pthread_create(&tid[i], NULL, parse_chunk, &c[i]) != 0) {
+			break;
+		}
+		started = i;
+	}
+	parse_chunk(&c[0]);
+	for (i = 1; i <= started; ++i) {
+		pthread_join(tid[i], NULL);
+	}
+	for (i = started + 1; i < n; ++i) {
+		parse_chunk(&c[i]);
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (c[i].rtn) {
+			goto rtn;
+		}
+	}
+
+	/* Search the matched cards in document order */
+	for (i = 0; i < n; ++i) {
+		for (j = 0; j < c[i].ncards; ++j) {
+			if (!ctx->session.on && rank_full(&ctx->rank)) {
+				break;
+			}
+			if (search(ctx, c[i].card[j]) == 0 &&
+			    ctx->session.on) {
+				session_keep(&ctx->session, c[i].card[j]);
+			}
+		}
+	}
+	rtn = EXIT_SUCCESS;
+
+rtn:
+	for (i = 0; i < n; ++i) {
+		for (j = 0; j < c[i].ncards; ++j) {
+			xmlFree(c[i].card[j]);
+		}
+		free(c[i].card);
+	}
+
+	return(rtn);
+}
+
+/**
+ * Find the text an element holds. Text held in a single node of its
+ * own, as the parser leaves all but the oddest cards, is given where it
+ * is, and may be changed in place until the document is freed. Any
+ * other is gathered into a copy.
+ *
+ * \parm[in]  doc  The document.
+ * \parm[in]  node The element.
+ * \parm[out] copy The copy made, to be freed with xmlFree(), or NULL.
+ *
+ * \return The text, NULL if there is none.
+ **/
+char *
+xml_text(xmlDoc *doc, xmlNode *node, xmlChar **copy)
+{
+	xmlNode *n = node->children;
+
+	*copy = NULL;
+	/* Text the parser interned may be shared with other nodes */
+	if (n && n->next == NULL && n->content &&
+	    (n->type == XML_TEXT_NODE || n->type == XML_CDATA_SECTION_NODE) &&
+	    (doc->dict == NULL || !xmlDictOwns(doc->dict, n->content))) {
+		return((char *)n->content);
+	}
+	*copy = xmlNodeListGetString(doc, n, 1);
+
+	return((char *)*copy);
+}
+
+/**
+ * Find the first element with a local name, at or below a node or
+ * any of its following siblings, whatever its namespace.
+ *
+ * \parm[in] node The node to start from.
+ * \parm[in] name The local name.
+ *
+ * \return The element, NULL if there is none.
+ **/
+xmlNode *
+xml_find(xmlNode *node, const char *name)
+{
+	xmlNode *n = NULL;
+	xmlNode *r = NULL;
+
+	for (n = node; n; n = n->next) {
+		if (n->type != XML_ELEMENT_NODE) {
+			continue;
+		}
+		if (xmlStrcmp(n->name, (const xmlChar *)name) == 0) {
+			return(n);
+		}
+		if ((r = xml_find(n->children, name)) != NULL) {
+			return(r);
+		}
+	}
+	return(NULL);
+}
+
 /**
  * \}
  **/
@@ -32,8 +32,18 @@ extern "C"
 {
 #endif
 
+struct mcds;
+struct _xmlDoc;
+struct _xmlNode;
+
 /** Parse the query result */
-int parse_xml(const char *);
+int parse_xml(struct mcds *, const char *);
+
+/** Find the text an element holds, in place when it can */
+char *xml_text(struct _xmlDoc *, struct _xmlNode *, unsigned char **);
+
+/** Find the first element with a local name, at or below a node */
+struct _xmlNode *xml_find(struct _xmlNode *, const char *);
 
 #ifdef __cplusplus
 }                               /* extern "C" */